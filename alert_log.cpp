@@ -0,0 +1,466 @@
+// Native alert log for the IoT security monitor (app.py).
+//
+// Alerts are fixed 16-byte binary records (timestamp, device index, alert
+// type) in a power-of-two ring. Any number of threads append without
+// locks: a position is claimed with one fetch_add and the slot is filled
+// under a per-slot sequence word, so readers detect records that are being
+// written or were overwritten while they copied them. Nothing is formatted
+// on the write path; app.py turns the handful of records a request returns
+// into text.
+//
+// Queries:
+//   last N             newest records, optionally for one device
+//   time range         a coarse index (one entry per granularity bucket,
+//                      holding the first sequence number seen in it) finds
+//                      where to start scanning
+// Optionally every record is also appended to an mmap'd segment file
+// (path, path.1, path.2, ... as segments fill) for history beyond the ring.
+//
+// Build the shared library loaded by app.py through ctypes:
+//   g++ -O2 -std=c++17 -shared -fPIC -pthread alert_log.cpp -o libalert_log.so
+//   (alert_log.dll on Windows, without spill support)
+// or the benchmark / segment dump tool:
+//   g++ -O2 -std=c++17 -pthread -DALERT_LOG_MAIN alert_log.cpp -o alert_log
+//   ./alert_log bench [threads] [appends per thread]
+//   ./alert_log dump <segment file>
+
+#include <bits/stdc++.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+#ifdef _WIN32
+#define ALERT_API extern "C" __declspec(dllexport)
+#else
+#define ALERT_API extern "C" __attribute__((visibility("default")))
+#endif
+
+// Record handed to readers; seq is the position in the log.
+struct AlertRecord {
+    uint64_t seq;
+    double timestamp; // seconds since the epoch
+    uint32_t device;
+    uint16_t type;
+    uint16_t reserved;
+};
+static_assert(sizeof(AlertRecord) == 24, "AlertRecord layout is part of the C API");
+
+// Record as stored in spill segments (seq is implicit).
+struct SpillRecord {
+    double timestamp;
+    uint32_t device;
+    uint16_t type;
+    uint16_t reserved;
+};
+static_assert(sizeof(SpillRecord) == 16, "spill segment layout");
+
+inline uint64_t packRecord(uint32_t device, uint16_t type) { return (uint64_t)device << 16 | type; }
+
+inline uint64_t doubleBits(double d) {
+    uint64_t u;
+    memcpy(&u, &d, sizeof u);
+    return u;
+}
+
+inline double bitsDouble(uint64_t u) {
+    double d;
+    memcpy(&d, &u, sizeof d);
+    return d;
+}
+
+// ---------- Spill segments ----------
+// Append-only file: a 64-byte header then capacity SpillRecords. The
+// header's count is written when the segment is closed; dump falls back to
+// scanning for the first empty record if the process died first.
+constexpr char spill_magic[8] = {'A', 'L', 'O', 'G', 'S', 'E', 'G', '1'};
+constexpr size_t spill_header = 64;
+
+struct SpillSegment {
+    string path;
+    char *base = nullptr;
+    size_t bytes = 0;
+    uint64_t capacity = 0;
+    atomic<uint64_t> claimed{0};
+
+    ~SpillSegment() { close(); }
+
+    bool open(const string &p, uint64_t records) {
+#ifdef _WIN32
+        (void)p;
+        (void)records;
+        return false;
+#else
+        path = p;
+        capacity = records;
+        bytes = spill_header + records * sizeof(SpillRecord);
+        int fd = ::open(p.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        if (ftruncate(fd, (off_t)bytes) != 0) {
+            ::close(fd);
+            return false;
+        }
+        void *m = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (m == MAP_FAILED) return false;
+        base = static_cast<char *>(m);
+        memcpy(base, spill_magic, sizeof spill_magic);
+        uint32_t record_size = sizeof(SpillRecord);
+        memcpy(base + 8, &record_size, sizeof record_size);
+        memcpy(base + 16, &capacity, sizeof capacity);
+        return true;
+#endif
+    }
+
+    // Claims a record slot; false once the segment is full.
+    bool append(double ts, uint32_t device, uint16_t type) {
+        uint64_t i = claimed.fetch_add(1, memory_order_relaxed);
+        if (i >= capacity) return false;
+        SpillRecord r{ts, device, type, 0};
+        memcpy(base + spill_header + i * sizeof(SpillRecord), &r, sizeof r);
+        return true;
+    }
+
+    // Records the final count; the mapping stays valid for stragglers.
+    void finish() {
+#ifndef _WIN32
+        if (!base) return;
+        uint64_t count = min(claimed.load(), capacity);
+        memcpy(base + 24, &count, sizeof count);
+        msync(base, bytes, MS_ASYNC);
+#endif
+    }
+
+    void close() {
+#ifndef _WIN32
+        if (!base) return;
+        finish();
+        munmap(base, bytes);
+        base = nullptr;
+#endif
+    }
+};
+
+// ---------- Alert log ----------
+struct AlertLog {
+    struct alignas(32) Slot {
+        // 0 = never written, 2p+1 = position p being written, 2p+2 = p done
+        atomic<uint64_t> seq{0};
+        atomic<uint64_t> ts_bits{0};
+        atomic<uint64_t> payload{0};
+    };
+
+    // Index entries pack (bucket mod 2^24) << 40 | (first seq mod 2^40).
+    static constexpr int tag_bits = 24, seq_bits = 40;
+    static constexpr uint64_t tag_mask = (1ull << tag_bits) - 1, seq_mask = (1ull << seq_bits) - 1;
+
+    vector<Slot> ring;
+    uint64_t mask;
+    double granularity;
+    vector<atomic<uint64_t>> index;
+    atomic<uint64_t> head{0};
+    atomic<int64_t> latest_bucket{INT64_MIN};
+    atomic<uint64_t> lost{0}; // writes dropped because a newer lap owned the slot
+
+    atomic<SpillSegment *> spill{nullptr};
+    mutex spill_mtx; // rotation only; appends never take it
+    vector<unique_ptr<SpillSegment>> segments;
+    string spill_path;
+    uint64_t spill_records = 0;
+    atomic<uint64_t> spilled{0}, spill_dropped{0};
+
+    AlertLog(uint32_t capacity, double gran, uint32_t buckets)
+        : ring(capacity), mask(capacity - 1), granularity(gran), index(buckets) {
+        for (auto &e : index) e.store(UINT64_MAX, memory_order_relaxed);
+    }
+
+    int64_t bucketOf(double ts) const { return (int64_t)floor(ts / granularity); }
+
+    uint64_t append(double ts, uint32_t device, uint16_t type) {
+        uint64_t p = head.fetch_add(1, memory_order_relaxed);
+        Slot &s = ring[p & mask];
+        uint64_t cur = s.seq.load(memory_order_relaxed);
+        bool owned = false;
+        for (;;) {
+            if (cur >= 2 * p + 1) { // a later lap already took the slot
+                lost.fetch_add(1, memory_order_relaxed);
+                break;
+            }
+            if (cur & 1) { // the previous lap is mid-write; it finishes shortly
+                this_thread::yield();
+                cur = s.seq.load(memory_order_relaxed);
+                continue;
+            }
+            if (s.seq.compare_exchange_weak(cur, 2 * p + 1, memory_order_relaxed)) {
+                owned = true;
+                break;
+            }
+        }
+        if (owned) {
+            atomic_thread_fence(memory_order_release);
+            s.ts_bits.store(doubleBits(ts), memory_order_relaxed);
+            s.payload.store(packRecord(device, type), memory_order_relaxed);
+            s.seq.store(2 * p + 2, memory_order_release);
+        }
+        indexRecord(bucketOf(ts), p);
+        if (SpillSegment *seg = spill.load(memory_order_acquire)) spillRecord(seg, ts, device, type);
+        return p;
+    }
+
+    // Keeps index[b % buckets] at the smallest sequence number seen in
+    // bucket b; a newer bucket mapping to the same entry replaces it.
+    void indexRecord(int64_t b, uint64_t p) {
+        int64_t latest = latest_bucket.load(memory_order_relaxed);
+        while (b > latest && !latest_bucket.compare_exchange_weak(latest, b, memory_order_relaxed)) {
+        }
+        atomic<uint64_t> &e = index[(uint64_t)b % index.size()];
+        uint64_t tag = (uint64_t)b & tag_mask, want = tag << seq_bits | (p & seq_mask);
+        uint64_t cur = e.load(memory_order_relaxed);
+        for (;;) {
+            if (cur != UINT64_MAX) {
+                uint64_t cur_tag = cur >> seq_bits;
+                if (cur_tag == tag) {
+                    if ((cur & seq_mask) <= (p & seq_mask)) return;
+                } else if (((tag - cur_tag) & tag_mask) >= (1ull << (tag_bits - 1))) {
+                    return; // entry already belongs to a newer bucket
+                }
+            }
+            if (e.compare_exchange_weak(cur, want, memory_order_release, memory_order_relaxed)) return;
+        }
+    }
+
+    // First sequence number recorded for bucket b, if the index still has it.
+    bool indexLookup(int64_t b, uint64_t head_now, uint64_t &seq) const {
+        uint64_t e = index[(uint64_t)b % index.size()].load(memory_order_acquire);
+        if (e == UINT64_MAX || (e >> seq_bits) != ((uint64_t)b & tag_mask)) return false;
+        // Widen the 40-bit sequence back using the current head.
+        uint64_t low = e & seq_mask;
+        seq = head_now - ((head_now - low) & seq_mask);
+        return true;
+    }
+
+    void spillRecord(SpillSegment *seg, double ts, uint32_t device, uint16_t type) {
+        while (!seg->append(ts, device, type)) {
+            SpillSegment *next = rotateSpill(seg);
+            if (!next) {
+                spill_dropped.fetch_add(1, memory_order_relaxed);
+                return;
+            }
+            seg = next;
+        }
+        spilled.fetch_add(1, memory_order_relaxed);
+    }
+
+    // Called by whoever finds `full` full: the first caller opens the next
+    // segment, later callers pick it up. Retired segments stay mapped until
+    // the log is destroyed, so a producer still writing into one is safe.
+    SpillSegment *rotateSpill(SpillSegment *full) {
+        lock_guard<mutex> lk(spill_mtx);
+        SpillSegment *cur = spill.load(memory_order_acquire);
+        if (cur != full) return cur;
+        auto seg = make_unique<SpillSegment>();
+        string path = spill_path + "." + to_string(segments.size());
+        if (!seg->open(path, spill_records)) return nullptr;
+        SpillSegment *raw = seg.get();
+        segments.push_back(move(seg));
+        spill.store(raw, memory_order_release);
+        full->finish();
+        return raw;
+    }
+
+    bool openSpill(const string &path, uint64_t records) {
+        lock_guard<mutex> lk(spill_mtx);
+        if (spill.load() || records == 0) return false;
+        auto seg = make_unique<SpillSegment>();
+        if (!seg->open(path, records)) return false;
+        spill_path = path;
+        spill_records = records;
+        spill.store(seg.get(), memory_order_release);
+        segments.push_back(move(seg));
+        return true;
+    }
+
+    // Copies position p if it is complete and still in the ring.
+    bool read(uint64_t p, AlertRecord &out) const {
+        const Slot &s = ring[p & mask];
+        uint64_t s1 = s.seq.load(memory_order_acquire);
+        if (s1 != 2 * p + 2) return false;
+        uint64_t ts = s.ts_bits.load(memory_order_relaxed);
+        uint64_t payload = s.payload.load(memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (s.seq.load(memory_order_relaxed) != s1) return false;
+        out = AlertRecord{p, bitsDouble(ts), (uint32_t)(payload >> 16), (uint16_t)(payload & 0xffff), 0};
+        return true;
+    }
+
+    uint64_t oldest(uint64_t head_now) const { return head_now > ring.size() ? head_now - ring.size() : 0; }
+
+    // Newest n records (all devices, or only `device`), oldest first.
+    size_t last(size_t n, int64_t device, AlertRecord *out) const {
+        uint64_t h = head.load(memory_order_acquire), lo = oldest(h);
+        size_t k = 0;
+        AlertRecord r;
+        for (uint64_t p = h; p > lo && k < n; --p) {
+            if (read(p - 1, r) && (device < 0 || r.device == (uint64_t)device)) out[k++] = r;
+        }
+        reverse(out, out + k);
+        return k;
+    }
+
+    // Records with t0 <= timestamp <= t1, oldest first, at most limit.
+    size_t range(double t0, double t1, AlertRecord *out, size_t limit) const {
+        uint64_t h = head.load(memory_order_acquire), lo = oldest(h);
+        int64_t b0 = bucketOf(t0), b1 = bucketOf(t1);
+        int64_t latest = latest_bucket.load(memory_order_relaxed);
+        int64_t covered = latest - (int64_t)index.size() + 1; // oldest bucket the index can hold
+        uint64_t start = lo;
+        if (b0 >= covered) {
+            bool found = false;
+            for (int64_t b = b0; b <= min(b1, latest) && !found; ++b) found = indexLookup(b, h, start);
+            if (!found) return 0;
+            start = max(start, lo);
+        }
+        size_t k = 0;
+        AlertRecord r;
+        for (uint64_t p = start; p < h && k < limit; ++p) {
+            if (!read(p, r)) continue;
+            if (r.timestamp >= t0 && r.timestamp <= t1) out[k++] = r;
+            else if (r.timestamp > t1 + granularity) break; // past the range, allowing for late stamps
+        }
+        return k;
+    }
+
+    ~AlertLog() {
+        for (auto &seg : segments) seg->close();
+    }
+};
+
+// ---------- C API ----------
+// Appends and queries may run concurrently from any number of threads.
+
+// capacity is rounded up to a power of two; granularity is the index
+// bucket width in seconds and buckets the number of index entries.
+ALERT_API void *alert_log_create(uint32_t capacity, double granularity, uint32_t buckets) {
+    uint32_t cap = 1;
+    while (cap < max(capacity, 2u) && cap < (1u << 30)) cap <<= 1;
+    if (!(granularity > 0)) granularity = 1.0;
+    return new AlertLog(cap, granularity, max(buckets, 1u));
+}
+
+ALERT_API void alert_log_destroy(void *log) { delete static_cast<AlertLog *>(log); }
+
+// Returns the record's sequence number.
+ALERT_API uint64_t alert_log_append(void *log, uint32_t device, uint16_t type, double timestamp) {
+    return static_cast<AlertLog *>(log)->append(timestamp, device, type);
+}
+
+// n alerts stamped with the same time, e.g. one simulation tick.
+ALERT_API void alert_log_append_batch(void *log, size_t n, const uint32_t *device, const uint16_t *type,
+                                      double timestamp) {
+    auto *l = static_cast<AlertLog *>(log);
+    for (size_t i = 0; i < n; ++i) l->append(timestamp, device[i], type[i]);
+}
+
+// Newest n records, oldest first; device < 0 means every device.
+ALERT_API size_t alert_log_last(void *log, int64_t device, size_t n, AlertRecord *out) {
+    return static_cast<AlertLog *>(log)->last(n, device, out);
+}
+
+ALERT_API size_t alert_log_range(void *log, double t0, double t1, AlertRecord *out, size_t limit) {
+    return static_cast<AlertLog *>(log)->range(t0, t1, out, limit);
+}
+
+// Starts spilling every record to path (then path.1, path.2, ...), each
+// segment holding `records` records. Returns 0 on success.
+ALERT_API int alert_log_open_spill(void *log, const char *path, uint64_t records) {
+    return static_cast<AlertLog *>(log)->openSpill(path, records) ? 0 : -1;
+}
+
+// out = {appended, retained in the ring, spilled, spill dropped, lost}
+ALERT_API void alert_log_counters(void *log, uint64_t out[5]) {
+    auto *l = static_cast<AlertLog *>(log);
+    uint64_t h = l->head.load();
+    out[0] = h;
+    out[1] = h - l->oldest(h);
+    out[2] = l->spilled.load();
+    out[3] = l->spill_dropped.load();
+    out[4] = l->lost.load();
+}
+
+#ifdef ALERT_LOG_MAIN
+int bench(int threads, uint64_t per_thread) {
+    void *log = alert_log_create(1 << 16, 1.0, 4096);
+    atomic<bool> stop{false};
+    atomic<uint64_t> queries{0};
+    // One reader polls the way the dashboard does while producers append.
+    thread reader([&] {
+        vector<AlertRecord> out(256);
+        while (!stop) {
+            alert_log_last(log, -1, 20, out.data());
+            queries++;
+        }
+    });
+    auto t0 = chrono::steady_clock::now();
+    vector<thread> producers;
+    for (int t = 0; t < threads; ++t) {
+        producers.emplace_back([&] {
+            double base = 1.7e9;
+            for (uint64_t i = 0; i < per_thread; ++i) { // 10k alerts per second per producer
+                alert_log_append(log, (uint32_t)(i % 1000), (uint16_t)(i % 10), base + (double)i * 1e-4);
+            }
+        });
+    }
+    for (auto &p : producers) p.join();
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    stop = true;
+    reader.join();
+
+    vector<AlertRecord> out(1 << 16);
+    auto q0 = chrono::steady_clock::now();
+    double newest = 1.7e9 + (double)(per_thread - 1) * 1e-4;
+    size_t found = alert_log_range(log, newest - 1, newest, out.data(), out.size());
+    double range_us = chrono::duration<double, micro>(chrono::steady_clock::now() - q0).count();
+    uint64_t c[5];
+    alert_log_counters(log, c);
+    cout << fixed << setprecision(1) << threads << " producers x " << per_thread << " appends: "
+         << c[0] / secs / 1e6 << " M appends/s, " << queries.load() << " last-20 reads meanwhile\n"
+         << "1 s range query: " << found << " records in " << range_us << " us\n"
+         << "retained " << c[1] << ", lost " << c[4] << "\n";
+    alert_log_destroy(log);
+    return 0;
+}
+
+int dump(const char *path) {
+    ifstream in(path, ios::binary);
+    char header[spill_header];
+    if (!in.read(header, sizeof header) || memcmp(header, spill_magic, sizeof spill_magic) != 0) {
+        cerr << "Not an alert log segment: " << path << "\n";
+        return 1;
+    }
+    uint64_t capacity, count;
+    memcpy(&capacity, header + 16, sizeof capacity);
+    memcpy(&count, header + 24, sizeof count);
+    if (count == 0) count = capacity; // not closed cleanly; stop at the first empty record
+    SpillRecord r;
+    for (uint64_t i = 0; i < count && in.read(reinterpret_cast<char *>(&r), sizeof r); ++i) {
+        if (r.timestamp == 0) break;
+        cout << fixed << setprecision(3) << r.timestamp << "\t" << r.device << "\t" << r.type << "\n";
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    string mode = argc > 1 ? argv[1] : "bench";
+    if (mode == "dump" && argc > 2) return dump(argv[2]);
+    if (mode == "bench") {
+        int threads = argc > 2 ? atoi(argv[2]) : 4;
+        uint64_t n = argc > 3 ? strtoull(argv[3], nullptr, 10) : 2000000;
+        return bench(max(threads, 1), n);
+    }
+    cerr << "Usage: " << argv[0] << " bench [threads] [appends per thread] | dump <segment file>\n";
+    return 1;
+}
+#endif
@@ -17,10 +17,88 @@ import random
 import smtplib 
 from email.message import EmailMessage
 from datetime import datetime
+import ctypes
+import os
+import threading
 
 warnings.filterwarnings('ignore')
 
 
+class NativeForest:
+    """A .forest file (see export_forest.py) scored by libforest_engine
+    (forest_engine.cpp); same predict()/predict_proba() shape as sklearn."""
+
+    def __init__(self, lib, path):
+        self.lib = lib
+        self.handle = lib.forest_load(path.encode())
+        if not self.handle:
+            raise ValueError(f"cannot load forest: {path}")
+        self.n_features = lib.forest_num_features(self.handle)
+
+    def _rows(self, X):
+        rows = np.ascontiguousarray(X, dtype=np.float64)
+        if rows.ndim == 1:
+            rows = rows.reshape(1, -1)
+        if rows.shape[1] != self.n_features:
+            raise ValueError(f"X has {rows.shape[1]} features, but the model expects {self.n_features}")
+        return rows
+
+    def _score(self, X):
+        rows = self._rows(X)
+        labels = np.empty(len(rows), dtype=np.int64)
+        proba = np.empty(len(rows), dtype=np.float64)
+        if len(rows) == 1:
+            p = ctypes.c_double()
+            labels[0] = self.lib.forest_predict(self.handle, rows.ctypes.data_as(ctypes.POINTER(ctypes.c_double)),
+                                                ctypes.byref(p))
+            proba[0] = p.value
+        else:
+            self.lib.forest_predict_batch(self.handle, rows.ctypes.data_as(ctypes.POINTER(ctypes.c_double)),
+                                          len(rows), labels.ctypes.data_as(ctypes.POINTER(ctypes.c_int64)),
+                                          proba.ctypes.data_as(ctypes.POINTER(ctypes.c_double)))
+        return labels, proba
+
+    def predict(self, X):
+        return self._score(X)[0]
+
+    def predict_proba(self, X):
+        p = self._score(X)[1]
+        return np.column_stack([1.0 - p, p])
+
+
+def load_forest_lib():
+    default = "forest_engine.dll" if os.name == "nt" else "libforest_engine.so"
+    path = os.environ.get("FOREST_ENGINE_LIB") or os.path.join(os.path.dirname(os.path.abspath(__file__)), default)
+    try:
+        lib = ctypes.CDLL(path)
+    except OSError:
+        return None
+    p, dp = ctypes.c_void_p, ctypes.POINTER(ctypes.c_double)
+    lib.forest_load.restype, lib.forest_load.argtypes = p, [ctypes.c_char_p]
+    lib.forest_num_features.restype, lib.forest_num_features.argtypes = ctypes.c_uint32, [p]
+    lib.forest_predict.restype, lib.forest_predict.argtypes = ctypes.c_int64, [p, dp, dp]
+    lib.forest_predict_batch.restype = None
+    lib.forest_predict_batch.argtypes = [p, dp, ctypes.c_size_t, ctypes.POINTER(ctypes.c_int64), dp]
+    return lib
+
+
+# Models are loaded once per process, not per request: model_2017.forest
+# through the native engine when both exist, else model_2017.sav.
+forest_lib = load_forest_lib()
+models = {}
+models_lock = threading.Lock()
+
+def load_model(name):
+    with models_lock:
+        if name not in models:
+            forest = name + '.forest'
+            if forest_lib and os.path.exists(forest):
+                models[name] = NativeForest(forest_lib, forest)
+            else:
+                models[name] = joblib.load(name + '.sav')
+        return models[name]
+
+
 
 app = Flask(__name__)
 
@@ -125,7 +203,7 @@ def predict():
     int_features= [float(x) for x in request.form.values()]
     print(int_features,len(int_features))
     final4=[np.array(int_features)]
-    model = joblib.load('model_2017.sav')
+    model = load_model('model_2017')
     predict = model.predict(final4)
 
     if predict==1:
@@ -142,7 +220,7 @@ def predict1():
     int_features= [float(x) for x in request.form.values()]
     print(int_features,len(int_features))
     final4=[np.array(int_features)]
-    model = joblib.load('model_2018.sav')
+    model = load_model('model_2018')
     predict = model.predict(final4)
 
     if predict==1:
@@ -154,4 +232,4 @@ def predict1():
     return render_template('prediction1.html', output=output)
 
 if __name__ == "__main__":
-    app.run(debug=True)
\ No newline at end of file
+    app.run(debug=True)
\ No newline at end of file
@@ -5,61 +5,354 @@ import threading
 import time
 import random
 import datetime
-from collections import defaultdict
+from collections import defaultdict, deque
+import ctypes
 import os
+import weakref
 
 app = Flask(__name__)
 
-# Global state for IoT devices
+# Device status codes and threat flag bits shared with iot_engine.cpp
+STATUSES = ("online", "suspicious", "compromised", "offline", "quarantined")
+STATUS_CODE = {name: code for code, name in enumerate(STATUSES)}
+THREAT_FLAGS = ((1, "high_cpu"), (2, "high_memory"), (4, "port_scan"), (8, "bruteforce"))
+HIGH_RISK = 70
+
+# Alert types stored in the alert log, formatted only when read
+ALERT_TYPES = ("high_cpu", "high_memory", "port_scan", "bruteforce", "suspicious", "traffic",
+               "action", "quarantine", "restart", "scan")
+ALERT_CODE = {name: code for code, name in enumerate(ALERT_TYPES)}
+ALERT_MESSAGES = {
+    "high_cpu": "🚨 HIGH CPU USAGE (>95%)",
+    "high_memory": "⚠️  CRITICAL MEMORY (>90%)",
+    "port_scan": "🔍 PORT SCAN DETECTED",
+    "bruteforce": "🔒 BRUTE FORCE ATTEMPTS",
+    "suspicious": "🌐 SUSPICIOUS CONNECTION",
+    "traffic": "📈 UNUSUAL TRAFFIC SPIKE",
+    "quarantine": "🔒 QUARANTINED by admin",
+    "restart": "🔄 RESTARTED by admin",
+    "scan": "🔍 SCAN initiated",
+}
+
+# Snapshot columns in iot_engine.cpp's Column order
+COLUMNS = (
+    ("cpu", ctypes.c_float),
+    ("memory", ctypes.c_float),
+    ("disk", ctypes.c_float),
+    ("ports", ctypes.c_int32),
+    ("connections", ctypes.c_int32),
+    ("failed_logins", ctypes.c_int32),
+    ("last_seen", ctypes.c_double),
+    ("risk", ctypes.c_float),
+    ("flags", ctypes.c_uint8),
+    ("status", ctypes.c_uint8),
+)
+COLUMN_INDEX = {name: column for column, (name, _) in enumerate(COLUMNS)}
+
+
+class FleetSnapshot:
+    """Immutable view of every device's metrics at one publish. The summary
+    fields are O(1); columns maps a column name to a sequence indexable by
+    device."""
+
+    def __init__(self, version, size, columns, status_count, high_risk, flagged):
+        self.version = version
+        self.size = size
+        self.columns = columns
+        self.status_count = status_count
+        self.high_risk = high_risk
+        self.flagged = flagged
+
+
+class SnapshotPin:
+    """Holds a native snapshot handle and releases it once unreferenced."""
+
+    def __init__(self, lib, handle):
+        self.handle = handle
+        weakref.finalize(self, lib.iot_snapshot_release, handle)
+
+
+class NativeColumns(dict):
+    """Columns of a pinned native snapshot, each mapped on first access as a
+    zero-copy ctypes array over the C++ memory. The snapshot stays pinned
+    while this mapping or any array taken from it is alive."""
+
+    def __init__(self, lib, pin, size):
+        super().__init__()
+        self.lib, self.pin, self.size = lib, pin, size
+
+    def __missing__(self, name):
+        column = COLUMN_INDEX[name]
+        if self.size == 0:
+            view = []
+        else:
+            address = self.lib.iot_snapshot_column(self.pin.handle, column)
+            view = (COLUMNS[column][1] * self.size).from_address(address)
+            view._pin = self.pin
+        self[name] = view
+        return view
+
+
+class NativeFleetEngine:
+    """ctypes binding to libiot_engine.so (see iot_engine.cpp).
+
+    Metrics live in C++ column arrays; risk and threat flags are computed
+    there with vectorized kernels, and readers get RCU-style snapshots
+    that never take the simulation thread's lock.
+    """
+
+    def __init__(self, lib):
+        self.lib = lib
+        p, i32, f32, u8 = ctypes.c_void_p, ctypes.POINTER(ctypes.c_int32), ctypes.POINTER(ctypes.c_float), ctypes.POINTER(ctypes.c_uint8)
+        size_t, u64 = ctypes.c_size_t, ctypes.c_uint64
+        signatures = {
+            "iot_create": (p, [ctypes.c_uint32]),
+            "iot_destroy": (None, [p]),
+            "iot_add_device": (ctypes.c_int32, [p, ctypes.c_double]),
+            "iot_update_batch": (size_t, [p, size_t, i32, f32, f32, f32, i32, i32, i32, ctypes.c_double]),
+            "iot_set_status_batch": (None, [p, size_t, i32, u8]),
+            "iot_evaluate": (size_t, [p, u8, size_t]),
+            "iot_publish": (u64, [p]),
+            "iot_snapshot_acquire": (p, [p]),
+            "iot_snapshot_release": (None, [p]),
+            "iot_snapshot_size": (size_t, [p]),
+            "iot_snapshot_version": (u64, [p]),
+            "iot_snapshot_column": (p, [p, ctypes.c_int]),
+            "iot_snapshot_summary": (None, [p, ctypes.POINTER(ctypes.c_uint32)]),
+        }
+        for name, (restype, argtypes) in signatures.items():
+            fn = getattr(lib, name)
+            fn.restype = restype
+            fn.argtypes = argtypes
+        self.engine = lib.iot_create(64)
+
+    def add_device(self, now):
+        return self.lib.iot_add_device(self.engine, now)
+
+    def update_batch(self, indices, cpu, memory, disk, ports, connections, failed_logins, now):
+        n = len(indices)
+        f32, i32 = ctypes.c_float * n, ctypes.c_int32 * n
+        self.lib.iot_update_batch(self.engine, n, i32(*indices), f32(*cpu), f32(*memory), f32(*disk),
+                                  i32(*ports), i32(*connections), i32(*failed_logins), now)
+
+    def evaluate(self):
+        n = self.lib.iot_evaluate(self.engine, None, 0)
+        flags = (ctypes.c_uint8 * n)()
+        self.lib.iot_evaluate(self.engine, flags, n)
+        return list(flags)
+
+    def set_status_batch(self, indices, statuses):
+        n = len(indices)
+        self.lib.iot_set_status_batch(self.engine, n, (ctypes.c_int32 * n)(*indices), (ctypes.c_uint8 * n)(*statuses))
+
+    def publish(self):
+        return self.lib.iot_publish(self.engine)
+
+    def snapshot(self):
+        """Pins the current snapshot: O(1); columns are mapped lazily."""
+        handle = self.lib.iot_snapshot_acquire(self.engine)
+        n = self.lib.iot_snapshot_size(handle)
+        columns = NativeColumns(self.lib, SnapshotPin(self.lib, handle), n)
+        summary = (ctypes.c_uint32 * (len(STATUSES) + 2))()
+        self.lib.iot_snapshot_summary(handle, summary)
+        version = self.lib.iot_snapshot_version(handle)
+        status_count = dict(zip(STATUSES, summary[:len(STATUSES)]))
+        return FleetSnapshot(version, n, columns, status_count, summary[len(STATUSES)], summary[len(STATUSES) + 1])
+
+
+class PythonFleetEngine:
+    """Pure-Python stand-in with the same interface, used when the native
+    library has not been built. Publishing copies the columns, so readers
+    still never need the writer's lock."""
+
+    def __init__(self):
+        self.cols = {name: [] for name, _ in COLUMNS}
+        self.version = 0
+        self.current = FleetSnapshot(0, 0, {name: [] for name, _ in COLUMNS}, dict.fromkeys(STATUSES, 0), 0, 0)
+
+    def add_device(self, now):
+        for name, _ in COLUMNS:
+            self.cols[name].append(0)
+        self.cols["last_seen"][-1] = now
+        return len(self.cols["cpu"]) - 1
+
+    def update_batch(self, indices, cpu, memory, disk, ports, connections, failed_logins, now):
+        c = self.cols
+        for k, i in enumerate(indices):
+            c["cpu"][i], c["memory"][i], c["disk"][i] = cpu[k], memory[k], disk[k]
+            c["ports"][i], c["connections"][i], c["failed_logins"][i] = ports[k], connections[k], failed_logins[k]
+            c["last_seen"][i] = now
+
+    def evaluate(self):
+        c = self.cols
+        for i in range(len(c["cpu"])):
+            cpu, memory, ports = c["cpu"][i], c["memory"][i], c["ports"][i]
+            failed, connections = c["failed_logins"][i], c["connections"][i]
+            c["risk"][i] = min(100, cpu * 0.4 + memory * 0.3 + ports / 50.0 * 20
+                               + failed / 10.0 * 15 + connections / 100.0 * 10)
+            c["flags"][i] = ((cpu > 95) * 1 | (memory > 90) * 2 | (ports > 45) * 4 | (failed > 8) * 8)
+        return list(c["flags"])
+
+    def set_status_batch(self, indices, statuses):
+        for i, status in zip(indices, statuses):
+            self.cols["status"][i] = status
+
+    def publish(self):
+        self.evaluate()
+        columns = {name: list(values) for name, values in self.cols.items()}
+        status_count = dict.fromkeys(STATUSES, 0)
+        for status in columns["status"]:
+            status_count[STATUSES[status]] += 1
+        high_risk = sum(1 for r in columns["risk"] if r > HIGH_RISK)
+        flagged = sum(1 for f in columns["flags"] if f)
+        self.version += 1
+        self.current = FleetSnapshot(self.version, len(columns["cpu"]), columns, status_count, high_risk, flagged)
+        return self.version
+
+    def snapshot(self):
+        return self.current
+
+
+class AlertRecord(ctypes.Structure):
+    _fields_ = [("seq", ctypes.c_uint64), ("timestamp", ctypes.c_double), ("device", ctypes.c_uint32),
+                ("type", ctypes.c_uint16), ("reserved", ctypes.c_uint16)]
+
+
+class NativeAlertLog:
+    """ctypes binding to libalert_log.so (see alert_log.cpp): a lock-free
+    ring of binary alert records with an optional mmap'd spill file."""
+
+    def __init__(self, lib, capacity, spill_path=None):
+        self.lib = lib
+        p, size_t, records = ctypes.c_void_p, ctypes.c_size_t, ctypes.POINTER(AlertRecord)
+        signatures = {
+            "alert_log_create": (p, [ctypes.c_uint32, ctypes.c_double, ctypes.c_uint32]),
+            "alert_log_append": (ctypes.c_uint64, [p, ctypes.c_uint32, ctypes.c_uint16, ctypes.c_double]),
+            "alert_log_append_batch": (None, [p, size_t, ctypes.POINTER(ctypes.c_uint32),
+                                              ctypes.POINTER(ctypes.c_uint16), ctypes.c_double]),
+            "alert_log_last": (size_t, [p, ctypes.c_int64, size_t, records]),
+            "alert_log_range": (size_t, [p, ctypes.c_double, ctypes.c_double, records, size_t]),
+            "alert_log_open_spill": (ctypes.c_int, [p, ctypes.c_char_p, ctypes.c_uint64]),
+        }
+        for name, (restype, argtypes) in signatures.items():
+            fn = getattr(lib, name)
+            fn.restype = restype
+            fn.argtypes = argtypes
+        self.log = lib.alert_log_create(capacity, 1.0, 4096)
+        if spill_path and lib.alert_log_open_spill(self.log, spill_path.encode(), 1 << 20) != 0:
+            print(f"⚠️  cannot open alert spill file {spill_path}")
+
+    def append(self, device, alert_type, now):
+        self.lib.alert_log_append(self.log, device, alert_type, now)
+
+    def append_batch(self, devices, types, now):
+        n = len(devices)
+        self.lib.alert_log_append_batch(self.log, n, (ctypes.c_uint32 * n)(*devices), (ctypes.c_uint16 * n)(*types), now)
+
+    def last(self, n, device=-1):
+        out = (AlertRecord * n)()
+        k = self.lib.alert_log_last(self.log, device, n, out)
+        return [(r.timestamp, r.device, r.type) for r in out[:k]]
+
+    def range(self, t0, t1, limit):
+        out = (AlertRecord * limit)()
+        k = self.lib.alert_log_range(self.log, t0, t1, out, limit)
+        return [(r.timestamp, r.device, r.type) for r in out[:k]]
+
+
+class PythonAlertLog:
+    """Bounded stand-in used without the native library (no spill)."""
+
+    def __init__(self, capacity, spill_path=None):
+        self.records = deque(maxlen=capacity)
+
+    def append(self, device, alert_type, now):
+        self.records.append((now, device, alert_type))
+
+    def append_batch(self, devices, types, now):
+        self.records.extend((now, d, t) for d, t in zip(devices, types))
+
+    def last(self, n, device=-1):
+        records = list(self.records)  # one copy; appends may run concurrently
+        if device < 0:
+            return records[-n:] if n > 0 else []
+        out = []
+        for record in reversed(records):
+            if len(out) == n:
+                break
+            if device < 0 or record[1] == device:
+                out.append(record)
+        return out[::-1]
+
+    def range(self, t0, t1, limit):
+        return [r for r in list(self.records) if t0 <= r[0] <= t1][:limit]
+
+
+def load_native(env_var, stem, what):
+    """ctypes handle for lib<stem>.so (<stem>.dll) from $env_var or next to app.py, else None."""
+    default = f"{stem}.dll" if os.name == "nt" else f"lib{stem}.so"
+    path = os.environ.get(env_var) or os.path.join(os.path.dirname(os.path.abspath(__file__)), default)
+    try:
+        return ctypes.CDLL(path)
+    except OSError:
+        print(f"ℹ️  {path} not available, using the Python {what}")
+        return None
+
+
+def load_fleet_engine():
+    lib = load_native("IOT_ENGINE_LIB", "iot_engine", "fleet engine")
+    return NativeFleetEngine(lib) if lib else PythonFleetEngine()
+
+
+def load_alert_log():
+    """Ring of ALERT_LOG_CAPACITY alerts; ALERT_SPILL names a history file."""
+    capacity = int(os.environ.get("ALERT_LOG_CAPACITY", 65536))
+    spill_path = os.environ.get("ALERT_SPILL")
+    lib = load_native("ALERT_LOG_LIB", "alert_log", "alert log")
+    return NativeAlertLog(lib, capacity, spill_path) if lib else PythonAlertLog(capacity)
+
+
+# Global state for IoT devices. Metrics live in the fleet engine and
+# alerts in the alert log; the lock only serializes metric writers
+# (simulation, admin actions), dashboard reads never take it.
+fleet = load_fleet_engine()
+alert_log = load_alert_log()
+# /api/devices shows each device's alerts among the newest DEVICE_ALERT_SCAN
+# records, fetched with one log query per request
+DEVICE_ALERT_SCAN = int(os.environ.get("DEVICE_ALERT_SCAN", 4096))
 devices = {}
-alerts_history = []
+device_order = []
 lock = threading.Lock()
 
 class IoTDevice:
+    """Static device attributes; metrics are columns in the fleet engine at self.index."""
     def __init__(self, device_id, name, ip):
         self.id = device_id
         self.name = name
         self.ip = ip
         self.mac = f"{random.randint(0x00,0xff):02x}:{random.randint(0x00,0xff):02x}:{random.randint(0x00,0xff):02x}:{random.randint(0x00,0xff):02x}:{random.randint(0x00,0xff):02x}:{random.randint(0x00,0xff):02x}"
-        self.status = "online"
-        self.cpu = random.uniform(5, 25)
-        self.memory = random.uniform(10, 40)
-        self.disk = random.uniform(20, 60)
-        self.ports = random.randint(3, 8)
-        self.connections = random.randint(5, 20)
-        self.failed_logins = 0
-        self.last_seen = datetime.datetime.now().strftime("%Y-%m-%d %H:%M:%S")
         self.firmware = f"v{random.randint(1,3)}.{random.randint(0,9)}.{random.randint(0,9)}"
-        self.alerts = []
-        self.risk_score = 0
+        self.index = fleet.add_device(time.time())
     
-    def to_dict(self):
+    def to_dict(self, snap, alerts=()):
+        c, i = snap.columns, self.index
         return {
             'id': self.id,
             'name': self.name,
             'ip': self.ip,
             'mac': self.mac,
-            'status': self.status,
-            'cpu': round(self.cpu, 1),
-            'memory': round(self.memory, 1),
-            'disk': round(self.disk, 1),
-            'ports': self.ports,
-            'connections': self.connections,
-            'failed_logins': self.failed_logins,
-            'last_seen': self.last_seen,
+            'status': STATUSES[c['status'][i]],
+            'cpu': round(c['cpu'][i], 1),
+            'memory': round(c['memory'][i], 1),
+            'disk': round(c['disk'][i], 1),
+            'ports': c['ports'][i],
+            'connections': c['connections'][i],
+            'failed_logins': c['failed_logins'][i],
+            'last_seen': datetime.datetime.fromtimestamp(c['last_seen'][i]).strftime("%Y-%m-%d %H:%M:%S"),
             'firmware': self.firmware,
-            'alerts': self.alerts[-5:],  # Last 5 alerts
-            'risk_score': round(self.calculate_risk(), 1)
+            'alerts': [alert_text(r) for r in alerts],
+            'risk_score': round(c['risk'][i], 1)
         }
-    
-    def calculate_risk(self):
-        score = 0
-        score += self.cpu * 0.4
-        score += self.memory * 0.3
-        score += (self.ports / 50.0) * 20
-        score += (self.failed_logins / 10.0) * 15
-        score += (self.connections / 100.0) * 10
-        return min(100, score)
 
 def initialize_devices():
     """Initialize sample IoT devices"""
@@ -80,26 +373,43 @@ def initialize_devices():
     with lock:
         for device_id, name, ip in device_list:
             devices[device_id] = IoTDevice(device_id, name, ip)
+            device_order.append(devices[device_id])
+        indices = [d.index for d in device_order]
+        n = len(indices)
+        fleet.update_batch(indices,
+                           [random.uniform(5, 25) for _ in range(n)],
+                           [random.uniform(10, 40) for _ in range(n)],
+                           [random.uniform(20, 60) for _ in range(n)],
+                           [random.randint(3, 8) for _ in range(n)],
+                           [random.randint(5, 20) for _ in range(n)],
+                           [0] * n, time.time())
+        fleet.publish()
 
 def generate_alert(device, alert_type):
-    """Generate security alert"""
-    alert_messages = {
-        "high_cpu": "🚨 HIGH CPU USAGE (>95%)",
-        "high_memory": "⚠️  CRITICAL MEMORY (>90%)",
-        "port_scan": "🔍 PORT SCAN DETECTED",
-        "bruteforce": "🔒 BRUTE FORCE ATTEMPTS",
-        "suspicious": "🌐 SUSPICIOUS CONNECTION",
-        "traffic": "📈 UNUSUAL TRAFFIC SPIKE"
-    }
-    
-    alert = f"{alert_messages.get(alert_type, '⚠️  SECURITY ALERT')} - {datetime.datetime.now().strftime('%H:%M:%S')}"
-    device.alerts.append(alert)
-    alerts_history.append({
+    """Generate security alert (a binary record; text is made at read time)"""
+    alert_log.append(device.index, ALERT_CODE[alert_type], time.time())
+
+def recent_alerts_by_device(per_device=5):
+    """device index -> its last per_device alerts (oldest first) among the
+    newest DEVICE_ALERT_SCAN records."""
+    recent = defaultdict(list)
+    for record in alert_log.last(DEVICE_ALERT_SCAN):
+        recent[record[1]].append(record)
+    return {device: records[-per_device:] for device, records in recent.items()}
+
+def alert_text(record):
+    timestamp, _, alert_type = record
+    when = datetime.datetime.fromtimestamp(timestamp).strftime('%H:%M:%S')
+    return f"{ALERT_MESSAGES.get(ALERT_TYPES[alert_type], '⚠️  SECURITY ALERT')} - {when}"
+
+def alert_dict(record):
+    device = device_order[record[1]]
+    return {
         'device': device.name,
         'ip': device.ip,
-        'alert': alert,
-        'timestamp': datetime.datetime.now().strftime("%Y-%m-%d %H:%M:%S")
-    })
+        'alert': alert_text(record),
+        'timestamp': datetime.datetime.fromtimestamp(record[0]).strftime("%Y-%m-%d %H:%M:%S")
+    }
 
 def simulate_security_events():
     """Simulate real-time IoT security events"""
@@ -107,27 +417,25 @@ def simulate_security_events():
         time.sleep(3)
         
         with lock:
-            for device_id, device in devices.items():
-                # Update metrics
-                device.cpu = random.uniform(5, 100)
-                device.memory = random.uniform(10, 95)
-                device.disk = random.uniform(20, 85)
-                device.ports = random.randint(2, 65)
-                device.connections = random.randint(5, 150)
-                device.failed_logins = random.randint(0, 15)
-                device.last_seen = datetime.datetime.now().strftime("%Y-%m-%d %H:%M:%S")
-                
-                # Threat detection
-                threats_detected = []
-                
-                if device.cpu > 95:
-                    threats_detected.append("high_cpu")
-                if device.memory > 90:
-                    threats_detected.append("high_memory")
-                if device.ports > 45:
-                    threats_detected.append("port_scan")
-                if device.failed_logins > 8:
-                    threats_detected.append("bruteforce")
+            # Update metrics in one batch
+            indices = [d.index for d in device_order]
+            n = len(indices)
+            fleet.update_batch(indices,
+                               [random.uniform(5, 100) for _ in range(n)],
+                               [random.uniform(10, 95) for _ in range(n)],
+                               [random.uniform(20, 85) for _ in range(n)],
+                               [random.randint(2, 65) for _ in range(n)],
+                               [random.randint(5, 150) for _ in range(n)],
+                               [random.randint(0, 15) for _ in range(n)],
+                               time.time())
+            
+            # Threat detection: risk and rule flags for the whole fleet
+            flags = fleet.evaluate()
+            statuses = []
+            alert_devices, alert_types = [], []
+            
+            for device in device_order:
+                threats_detected = [name for bit, name in THREAT_FLAGS if flags[device.index] & bit]
                 
                 # Random threats
                 if random.random() < 0.03:
@@ -138,20 +446,22 @@ def simulate_security_events():
                 # Generate alerts and update status
                 if threats_detected:
                     for threat in threats_detected:
-                        generate_alert(device, threat)
+                        alert_devices.append(device.index)
+                        alert_types.append(ALERT_CODE[threat])
                     
                     if random.random() < 0.2:
-                        device.status = "compromised"
+                        status = "compromised"
                     else:
-                        device.status = "suspicious"
+                        status = "suspicious"
                 elif random.random() < 0.08:
-                    device.status = "offline"
+                    status = "offline"
                 else:
-                    device.status = "online"
-                
-                # Limit alerts history
-                if len(device.alerts) > 10:
-                    device.alerts = device.alerts[-10:]
+                    status = "online"
+                statuses.append(STATUS_CODE[status])
+            
+            alert_log.append_batch(alert_devices, alert_types, time.time())
+            fleet.set_status_batch(indices, statuses)
+            fleet.publish()
 
 # Flask Routes
 @app.route('/')
@@ -160,32 +470,38 @@ def dashboard():
 
 @app.route('/api/devices')
 def get_devices():
-    with lock:
-        return jsonify([device.to_dict() for device in devices.values()])
+    snap = fleet.snapshot()
+    alerts = recent_alerts_by_device()
+    return jsonify([device.to_dict(snap, alerts.get(device.index, ())) for device in device_order[:snap.size]])
 
 @app.route('/api/stats')
 def get_stats():
-    with lock:
-        total = len(devices)
-        online = sum(1 for d in devices.values() if d.status == "online")
-        suspicious = sum(1 for d in devices.values() if d.status == "suspicious")
-        compromised = sum(1 for d in devices.values() if d.status == "compromised")
-        offline = total - online - suspicious - compromised
-        
-        high_risk = sum(1 for d in devices.values() if d.risk_score > 70)
-        
-        return jsonify({
-            'total': total,
-            'online': online,
-            'suspicious': suspicious,
-            'compromised': compromised,
-            'offline': offline,
-            'high_risk': high_risk
-        })
+    snap = fleet.snapshot()
+    counts = snap.status_count
+    total = snap.size
+    online = counts["online"]
+    suspicious = counts["suspicious"]
+    compromised = counts["compromised"]
+    offline = total - online - suspicious - compromised
+    
+    return jsonify({
+        'total': total,
+        'online': online,
+        'suspicious': suspicious,
+        'compromised': compromised,
+        'offline': offline,
+        'high_risk': snap.high_risk
+    })
 
 @app.route('/api/alerts')
 def get_alerts():
-    return jsonify(alerts_history[-20:])  # Last 20 alerts
+    # ?since=&until= (epoch seconds) selects a time range, else the last 20
+    since, until = request.args.get('since', type=float), request.args.get('until', type=float)
+    if since is None and until is None:
+        return jsonify([alert_dict(r) for r in alert_log.last(20)])  # Last 20 alerts
+    limit = min(request.args.get('limit', 1000, type=int), 10000)
+    records = alert_log.range(since or 0.0, until if until is not None else time.time() + 60, limit)
+    return jsonify([alert_dict(r) for r in records])
 
 @app.route('/api/action/<device_id>/<action>')
 def take_action(device_id, action):
@@ -194,16 +510,19 @@ def take_action(device_id, action):
             device = devices[device_id]
             
             if action == "quarantine":
-                device.status = "quarantined"
-                device.alerts.append(f"🔒 QUARANTINED by admin - {datetime.datetime.now().strftime('%H:%M:%S')}")
+                fleet.set_status_batch([device.index], [STATUS_CODE["quarantined"]])
+                generate_alert(device, "quarantine")
             elif action == "restart":
-                device.status = "online"
-                device.cpu = random.uniform(5, 20)
-                device.alerts.append(f"🔄 RESTARTED by admin - {datetime.datetime.now().strftime('%H:%M:%S')}")
+                c, i = fleet.snapshot().columns, device.index
+                fleet.update_batch([i], [random.uniform(5, 20)], [c['memory'][i]], [c['disk'][i]], [c['ports'][i]],
+                                   [c['connections'][i]], [c['failed_logins'][i]], c['last_seen'][i])
+                fleet.set_status_batch([i], [STATUS_CODE["online"]])
+                generate_alert(device, "restart")
             elif action == "scan":
-                device.alerts.append(f"🔍 SCAN initiated - {datetime.datetime.now().strftime('%H:%M:%S')}")
+                generate_alert(device, "scan")
             
             generate_alert(device, "action")
+            fleet.publish()
             return jsonify({'status': 'success', 'action': action})
     
     return jsonify({'status': 'error', 'message': 'Device not found'}), 404
@@ -0,0 +1,480 @@
+// Streaming brute-force / port-scan detector for the IoT security monitor.
+//
+// app.py flags bruteforce and port_scan from one metrics sample every few
+// seconds (failed_logins > 8, ports > 45), which misses slow or
+// distributed attacks and fires on single spikes. This detector consumes
+// the raw events instead - failed logins and connection attempts keyed by
+// source IP and device - and keeps sliding-window statistics in fixed
+// memory:
+//
+//   failures per (source, device)   count-min sketch    -> bruteforce
+//   failures per device             count-min sketch    -> distributed_bruteforce,
+//   distinct sources per device     HyperLogLog sketch     when both are high
+//   distinct ports per source       HyperLogLog sketch  -> port_scan
+//
+// The window is split into time buckets. Each count-min sketch keeps one
+// slice per bucket plus a running total, so an update and its windowed
+// estimate cost `depth` counter increments. The HyperLogLog sketches keep
+// one register set per bucket; only an item that raises a register above
+// its window maximum (rare once a sketch has warmed up) triggers a
+// re-estimate. Expiry is lazy: every cell remembers the bucket it was
+// last touched in and drops the slices that left the window the next time
+// it is touched, so a bucket rollover costs nothing up front. Every event
+// is O(1) and memory never grows. An alert for a key is raised at most
+// once per window.
+//
+// Build the library:
+//   g++ -O2 -std=c++17 -shared -fPIC attack_detector.cpp -o libattack_detector.so
+// or the generator / replay benchmark:
+//   g++ -O2 -std=c++17 -DATTACK_DETECTOR_MAIN attack_detector.cpp -o attack_detector
+//   ./attack_detector gen events.txt [events]
+//   ./attack_detector replay events.txt
+// Event lines: "<epoch seconds> fail <source ip> <device>" or
+//              "<epoch seconds> conn <source ip> <device> <port>".
+
+#include <bits/stdc++.h>
+using namespace std;
+
+#ifdef _WIN32
+#define DETECTOR_API extern "C" __declspec(dllexport)
+#else
+#define DETECTOR_API extern "C" __attribute__((visibility("default")))
+#endif
+
+enum EventKind : uint8_t { EVENT_LOGIN_FAILURE = 0, EVENT_CONNECTION = 1 };
+
+enum AttackType : uint16_t {
+    ATTACK_BRUTEFORCE = 0,
+    ATTACK_DISTRIBUTED_BRUTEFORCE = 1,
+    ATTACK_PORT_SCAN = 2,
+    ATTACK_TYPES = 3,
+};
+
+const char *const attack_names[ATTACK_TYPES] = {"bruteforce", "distributed_bruteforce", "port_scan"};
+
+struct DetectorEvent {
+    double timestamp; // seconds
+    uint32_t source;  // IPv4 address, host order
+    uint32_t device;
+    uint16_t port;    // connections only
+    uint8_t kind;     // EventKind
+    uint8_t reserved;
+};
+static_assert(sizeof(DetectorEvent) == 24, "DetectorEvent layout is part of the C API");
+
+struct DetectorAlert {
+    double timestamp;
+    uint32_t source; // 0 for per-device alerts
+    uint32_t device; // 0 for per-source alerts
+    uint32_t estimate;
+    uint16_t type;   // AttackType
+    uint16_t reserved;
+};
+static_assert(sizeof(DetectorAlert) == 24, "DetectorAlert layout is part of the C API");
+
+struct DetectorConfig {
+    double window = 300;            // seconds
+    uint32_t buckets = 10;          // window granularity, at most 14
+    uint32_t cms_width = 1 << 14;   // counters per row (power of two)
+    uint32_t cms_depth = 4;
+    uint32_t hll_width = 1 << 12;   // sketches per row (power of two)
+    uint32_t hll_depth = 2;
+    uint32_t fail_threshold = 20;          // failures from one source on one device
+    uint32_t device_fail_threshold = 100;  // failures on one device, all sources
+    uint32_t device_source_threshold = 10; // ... from at least this many sources
+    uint32_t port_threshold = 45;          // distinct ports from one source
+};
+static_assert(sizeof(DetectorConfig) == 48, "DetectorConfig layout is part of the C API");
+
+inline uint64_t mix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+// Row d's column for a key hash (double hashing).
+inline uint32_t sketchCell(uint64_t h, uint32_t d, uint32_t mask) {
+    return (uint32_t)(h + d * ((h >> 32) | 1)) & mask;
+}
+
+// ---------- Windowed count-min sketch ----------
+// Each counter cell keeps the window total and the bucket it was last
+// touched in next to its per-bucket slices in one cache line, so an update
+// touches one line per row.
+struct WindowedCountMin {
+    static constexpr uint32_t max_buckets = 14;
+    struct alignas(64) Cell {
+        uint32_t total;
+        uint32_t bucket; // slices are current as of this bucket
+        uint32_t slice[max_buckets];
+    };
+    static_assert(sizeof(Cell) == 64, "a cell fills one cache line");
+    uint32_t width, depth, buckets;
+    vector<Cell> cells; // [row][column]
+
+    WindowedCountMin(uint32_t w, uint32_t d, uint32_t b) : width(w), depth(d), buckets(b), cells((size_t)d * w) {}
+
+    // Subtracts the slices of buckets that left the window since c was last touched.
+    void refresh(Cell &c, uint32_t bucket) {
+        uint32_t stale = bucket - c.bucket;
+        if (stale >= buckets) {
+            c = Cell{};
+        } else {
+            for (uint32_t s = c.bucket % buckets; stale; --stale) {
+                if (++s == buckets) s = 0;
+                c.total -= c.slice[s];
+                c.slice[s] = 0;
+            }
+        }
+        c.bucket = bucket;
+    }
+
+    // Counts one occurrence in `bucket` and returns the window estimate.
+    uint32_t add(uint64_t h, uint32_t bucket) {
+        uint32_t est = UINT32_MAX, slot = bucket % buckets;
+        for (uint32_t d = 0; d < depth; ++d) {
+            Cell &c = cells[(size_t)d * width + sketchCell(h, d, width - 1)];
+            if (c.bucket != bucket) refresh(c, bucket);
+            c.slice[slot]++;
+            est = min(est, ++c.total);
+        }
+        return est;
+    }
+
+    size_t bytes() const { return cells.size() * sizeof(Cell); }
+};
+
+// ---------- Windowed HyperLogLog ----------
+// A grid of small HLL sketches (64 six-bit registers, ~13% error),
+// indexed like a count-min sketch by key hash; the estimate for a key is
+// the minimum over its rows, which limits inflation from colliding keys.
+// A register's per-bucket values sit side by side, so an update sees the
+// window's value of that register (the max over buckets) in the same
+// cache line and can tell whether the window estimate moved at all.
+// Each sketch is stamped with the bucket it was last touched in; expired
+// register sets are cleared when the sketch is next looked up.
+struct WindowedHll {
+    static constexpr int p = 6, m = 1 << p;
+    uint32_t width, depth, buckets;
+    vector<uint8_t> regs;    // [row][column][register][bucket]
+    vector<uint32_t> stamp;  // [row][column]
+    double inv_pow2[64 - p + 2];
+
+    WindowedHll(uint32_t w, uint32_t d, uint32_t b)
+        : width(w), depth(d), buckets(b), regs((size_t)d * w * m * b), stamp((size_t)d * w) {
+        for (int r = 0; r < 64 - p + 2; ++r) inv_pow2[r] = ldexp(1.0, -r);
+    }
+
+    uint8_t *sketch(uint32_t d, uint64_t key, uint32_t bucket) {
+        size_t cell = (size_t)d * width + sketchCell(key, d, width - 1);
+        uint8_t *s = &regs[cell * m * buckets];
+        uint32_t stale = bucket - stamp[cell];
+        if (stale >= buckets) {
+            memset(s, 0, (size_t)m * buckets);
+        } else {
+            for (uint32_t slot = stamp[cell] % buckets; stale; --stale) {
+                if (++slot == buckets) slot = 0;
+                for (int k = 0; k < m; ++k) s[(size_t)k * buckets + slot] = 0;
+            }
+        }
+        stamp[cell] = bucket;
+        return s;
+    }
+
+    // Adds item to key's sketches in `bucket`; returns true when the window
+    // value of a register grew, i.e. the estimate may have changed.
+    bool add(uint64_t key, uint64_t item, uint32_t bucket) {
+        uint32_t j = (uint32_t)(item >> (64 - p)), slot = bucket % buckets;
+        uint8_t rank = (uint8_t)(__builtin_clzll((item << p) | (1ull << (p - 1))) + 1);
+        bool grew = false;
+        for (uint32_t d = 0; d < depth; ++d) {
+            uint8_t *r = sketch(d, key, bucket) + (size_t)j * buckets;
+            if (rank <= r[slot]) continue;
+            grew |= rank > *max_element(r, r + buckets);
+            r[slot] = rank;
+        }
+        return grew;
+    }
+
+    uint32_t estimate(uint64_t key, uint32_t bucket) {
+        double best = numeric_limits<double>::infinity();
+        for (uint32_t d = 0; d < depth; ++d) {
+            const uint8_t *s = sketch(d, key, bucket);
+            double sum = 0;
+            int zeros = 0;
+            for (int k = 0; k < m; ++k, s += buckets) {
+                uint8_t v = *max_element(s, s + buckets);
+                sum += inv_pow2[v];
+                zeros += v == 0;
+            }
+            double e = 0.709 * m * m / sum;
+            if (e <= 2.5 * m && zeros) e = m * log((double)m / zeros); // linear counting
+            best = min(best, e);
+        }
+        return (uint32_t)llround(best);
+    }
+
+    size_t bytes() const { return regs.size() + stamp.size() * sizeof(uint32_t); }
+};
+
+// ---------- Detector ----------
+struct AttackDetector {
+    DetectorConfig cfg;
+    double bucket_seconds;
+    int64_t epoch = INT64_MIN; // current bucket number
+    uint32_t bucket = 0;       // buckets since the first event; what sketch cells are stamped with
+    WindowedCountMin pair_failures, device_failures;
+    WindowedHll device_sources, source_ports;
+
+    // Direct-mapped "already alerted" table: key hash -> window end.
+    struct Cooldown {
+        uint64_t key = 0;
+        double until = 0;
+    };
+    vector<Cooldown> cooldown;
+    uint64_t events = 0, alerts[ATTACK_TYPES] = {0, 0, 0};
+
+    explicit AttackDetector(const DetectorConfig &c)
+        : cfg(c), bucket_seconds(c.window / c.buckets), pair_failures(c.cms_width, c.cms_depth, c.buckets),
+          device_failures(c.cms_width, c.cms_depth, c.buckets), device_sources(c.hll_width, c.hll_depth, c.buckets),
+          source_ports(c.hll_width, c.hll_depth, c.buckets), cooldown(1 << 16) {}
+
+    // Moves to the event's bucket. The sketches expire old buckets lazily;
+    // a gap longer than the window counts as one window, which already
+    // expires everything.
+    void advance(double ts) {
+        int64_t e = (int64_t)floor(ts / bucket_seconds);
+        if (e <= epoch) return; // same bucket, or a late event: count it in the current one
+        if (epoch != INT64_MIN) bucket += (uint32_t)min<int64_t>(e - epoch, cfg.buckets);
+        epoch = e;
+    }
+
+    bool firstInWindow(uint64_t key, double ts) {
+        Cooldown &c = cooldown[key & (cooldown.size() - 1)];
+        if (c.key == key && ts < c.until) return false;
+        c.key = key;
+        c.until = ts + cfg.window;
+        return true;
+    }
+
+    bool raise(AttackType type, uint64_t key, const DetectorEvent &ev, uint32_t src, uint32_t dev, uint32_t est,
+               DetectorAlert *out) {
+        if (!firstInWindow(mix64(key ^ ((uint64_t)type << 56)), ev.timestamp)) return false;
+        alerts[type]++;
+        *out = DetectorAlert{ev.timestamp, src, dev, est, type, 0};
+        return true;
+    }
+
+    // Ingests one event; writes up to two alerts to out and returns how many.
+    int ingest(const DetectorEvent &ev, DetectorAlert *out) {
+        events++;
+        advance(ev.timestamp);
+        int n = 0;
+        uint64_t src_key = mix64(ev.source), dev_key = mix64((uint64_t)ev.device << 32 | 0x5bd1e995u);
+        if (ev.kind == EVENT_LOGIN_FAILURE) {
+            uint64_t pair_key = mix64(src_key ^ dev_key);
+            uint32_t pair = pair_failures.add(pair_key, bucket);
+            if (pair >= cfg.fail_threshold &&
+                raise(ATTACK_BRUTEFORCE, pair_key, ev, ev.source, ev.device, pair, out + n)) {
+                n++;
+            }
+            uint32_t total = device_failures.add(dev_key, bucket);
+            bool new_source = device_sources.add(dev_key, src_key, bucket);
+            if (total >= cfg.device_fail_threshold && (new_source || total == cfg.device_fail_threshold)) {
+                uint32_t sources = device_sources.estimate(dev_key, bucket);
+                if (sources >= cfg.device_source_threshold &&
+                    raise(ATTACK_DISTRIBUTED_BRUTEFORCE, dev_key, ev, 0, ev.device, sources, out + n)) {
+                    n++;
+                }
+            }
+        } else if (source_ports.add(src_key, mix64(ev.port), bucket)) {
+            uint32_t ports = source_ports.estimate(src_key, bucket);
+            if (ports >= cfg.port_threshold && raise(ATTACK_PORT_SCAN, src_key, ev, ev.source, 0, ports, out + n)) n++;
+        }
+        return n;
+    }
+
+    size_t bytes() const {
+        return pair_failures.bytes() + device_failures.bytes() + device_sources.bytes() + source_ports.bytes() +
+               cooldown.size() * sizeof(Cooldown);
+    }
+};
+
+// ---------- C API ----------
+// A detector is not thread-safe: feed each one from a single thread.
+
+// config may be null for the defaults above.
+DETECTOR_API void *detector_create(const DetectorConfig *config) {
+    DetectorConfig c = config ? *config : DetectorConfig();
+    auto pow2 = [](uint32_t v) {
+        uint32_t p = 1;
+        while (p < v && p < (1u << 30)) p <<= 1;
+        return p;
+    };
+    c.cms_width = pow2(max(c.cms_width, 2u));
+    c.hll_width = pow2(max(c.hll_width, 2u));
+    c.cms_depth = max(c.cms_depth, 1u);
+    c.hll_depth = max(c.hll_depth, 1u);
+    c.buckets = clamp(c.buckets, 1u, WindowedCountMin::max_buckets);
+    if (!(c.window > 0)) c.window = 300;
+    return new AttackDetector(c);
+}
+
+DETECTOR_API void detector_destroy(void *detector) { delete static_cast<AttackDetector *>(detector); }
+
+// Ingests n events in order; writes at most max_alerts alerts and returns
+// how many were raised (alerts past max_alerts are counted but dropped).
+DETECTOR_API size_t detector_ingest(void *detector, const DetectorEvent *events, size_t n, DetectorAlert *alerts,
+                                    size_t max_alerts) {
+    auto *d = static_cast<AttackDetector *>(detector);
+    size_t raised = 0;
+    DetectorAlert buf[2];
+    for (size_t i = 0; i < n; ++i) {
+        int k = d->ingest(events[i], buf);
+        for (int j = 0; j < k; ++j, ++raised) {
+            if (raised < max_alerts) alerts[raised] = buf[j];
+        }
+    }
+    return raised;
+}
+
+DETECTOR_API size_t detector_memory_bytes(void *detector) { return static_cast<AttackDetector *>(detector)->bytes(); }
+
+#ifdef ATTACK_DETECTOR_MAIN
+string ipString(uint32_t ip) {
+    return to_string(ip >> 24) + "." + to_string(ip >> 16 & 255) + "." + to_string(ip >> 8 & 255) + "." +
+           to_string(ip & 255);
+}
+
+// Background traffic over `hours` plus three injected attacks:
+//   fast brute force      10.66.0.1 -> device 3, 40 failures in 20 s
+//   slow distributed      60 sources -> device 7, one failure each per 90 s
+//   slow port scan        10.77.0.1, one new port every 4 s across devices
+int generate(const string &path, size_t n) {
+    ofstream out(path);
+    if (!out.is_open()) {
+        cerr << "Cannot write " << path << "\n";
+        return 1;
+    }
+    mt19937_64 rng(2024);
+    const double start = 1.7e9, hours = 2.0, span = hours * 3600;
+    const uint16_t common_ports[] = {22, 23, 53, 80, 123, 443, 554, 1883, 8080, 8883};
+    struct Line {
+        double ts;
+        string text;
+    };
+    vector<Line> lines;
+    lines.reserve(n + 4000);
+    char buf[96];
+    for (size_t i = 0; i < n; ++i) {
+        double ts = start + uniform_real_distribution<double>(0, span)(rng);
+        uint32_t src = (192u << 24 | 168u << 16) + (uint32_t)(rng() % 50000);
+        uint32_t dev = (uint32_t)(rng() % 200);
+        if (rng() % 100 == 0) {
+            snprintf(buf, sizeof buf, "%.3f fail %s %u", ts, ipString(src).c_str(), dev);
+        } else {
+            snprintf(buf, sizeof buf, "%.3f conn %s %u %u", ts, ipString(src).c_str(), dev,
+                     common_ports[rng() % size(common_ports)]);
+        }
+        lines.push_back({ts, buf});
+    }
+    for (int i = 0; i < 40; ++i) {
+        double ts = start + 1800 + i * 0.5;
+        snprintf(buf, sizeof buf, "%.3f fail 10.66.0.1 3", ts);
+        lines.push_back({ts, buf});
+    }
+    for (int s = 0; s < 60; ++s) {
+        for (double ts = start + 3600 + s * 1.5; ts < start + 5400; ts += 90) {
+            snprintf(buf, sizeof buf, "%.3f fail 10.88.%d.%d 7", ts, s / 250, s % 250 + 1);
+            lines.push_back({ts, buf});
+        }
+    }
+    for (int k = 0; k < 400; ++k) {
+        double ts = start + 2400 + k * 4.0;
+        snprintf(buf, sizeof buf, "%.3f conn 10.77.0.1 %d %d", ts, k % 200, 1024 + k * 37 % 60000);
+        lines.push_back({ts, buf});
+    }
+    sort(lines.begin(), lines.end(), [](const Line &a, const Line &b) { return a.ts < b.ts; });
+    for (const auto &l : lines) out << l.text << "\n";
+    cout << "wrote " << lines.size() << " events over " << hours << " h to " << path << "\n";
+    return 0;
+}
+
+bool parseIp(const char *&p, uint32_t &ip) {
+    ip = 0;
+    for (int k = 0; k < 4; ++k) {
+        char *end;
+        unsigned long v = strtoul(p, &end, 10);
+        if (end == p || v > 255 || (k < 3 && *end != '.')) return false;
+        ip = ip << 8 | (uint32_t)v;
+        p = end + (k < 3);
+    }
+    return true;
+}
+
+int replay(const string &path) {
+    ifstream in(path);
+    if (!in.is_open()) {
+        cerr << "Cannot open " << path << "\n";
+        return 1;
+    }
+    vector<DetectorEvent> events;
+    string line;
+    size_t bad = 0;
+    auto p0 = chrono::steady_clock::now();
+    while (getline(in, line)) {
+        const char *p = line.c_str();
+        char *end;
+        DetectorEvent ev{};
+        ev.timestamp = strtod(p, &end);
+        p = end;
+        while (*p == ' ') ++p;
+        if (!strncmp(p, "fail ", 5)) ev.kind = EVENT_LOGIN_FAILURE;
+        else if (!strncmp(p, "conn ", 5)) ev.kind = EVENT_CONNECTION;
+        else {
+            bad++;
+            continue;
+        }
+        p += 5;
+        if (!parseIp(p, ev.source)) {
+            bad++;
+            continue;
+        }
+        ev.device = (uint32_t)strtoul(p, &end, 10);
+        p = end;
+        if (ev.kind == EVENT_CONNECTION) ev.port = (uint16_t)strtoul(p, &end, 10);
+        events.push_back(ev);
+    }
+    double parse_s = chrono::duration<double>(chrono::steady_clock::now() - p0).count();
+
+    void *det = detector_create(nullptr);
+    vector<DetectorAlert> alerts(1 << 16);
+    auto t0 = chrono::steady_clock::now();
+    size_t raised = detector_ingest(det, events.data(), events.size(), alerts.data(), alerts.size());
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+    cout << fixed << setprecision(2) << events.size() << " events (" << bad << " malformed), parsed in " << parse_s
+         << " s\n"
+         << "ingest: " << events.size() / secs / 1e6 << " M events/s, " << secs * 1e9 / max<size_t>(events.size(), 1)
+         << " ns/event, sketch memory " << detector_memory_bytes(det) / 1048576.0 << " MiB\n"
+         << raised << " alerts\n";
+    for (size_t i = 0; i < min(raised, alerts.size()) && i < 20; ++i) {
+        const DetectorAlert &a = alerts[i];
+        cout << "  " << setprecision(0) << a.timestamp << " " << attack_names[a.type];
+        if (a.source) cout << " src " << ipString(a.source);
+        if (a.type != ATTACK_PORT_SCAN) cout << " device " << a.device;
+        cout << " estimate " << a.estimate << "\n";
+    }
+    detector_destroy(det);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    string mode = argc > 2 ? argv[1] : "";
+    if (mode == "gen") return generate(argv[2], argc > 3 ? strtoull(argv[3], nullptr, 10) : 5000000);
+    if (mode == "replay") return replay(argv[2]);
+    cerr << "Usage: " << argv[0] << " gen <events file> [events] | replay <events file>\n";
+    return 1;
+}
+#endif
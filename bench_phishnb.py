@@ -0,0 +1,127 @@
+"""Benchmark the phishnb extension against a pure-Python Naive Bayes.
+
+Build the extension first (see phishnb_ext.cpp), then:
+
+    python bench_phishnb.py train.txt emails.txt [--threads 4] [--repeat 5]
+
+train.txt holds "label<TAB>text" lines, emails.txt one email per line
+(a labelled file works too; the label column is dropped). Both
+classifiers train on the same file with the same smoothing, so besides
+throughput the script reports how often their verdicts agree; the native
+tokenizer also adds URL domain features, so a few verdicts may differ.
+"""
+import argparse
+import math
+import re
+import threading
+import time
+from collections import Counter
+
+import phishnb
+
+TOKEN = re.compile(r"[a-z0-9]+", re.ASCII)
+PHISHING_LABELS = {"phishing", "spam", "malicious"}
+
+
+class PythonNaiveBayes:
+    """Multinomial NB with Laplace smoothing, the textbook way."""
+
+    def __init__(self, path, alpha=1.0):
+        self.alpha = alpha
+        counts = [Counter(), Counter()]
+        docs = [0, 0]
+        with open(path, encoding="utf-8", errors="replace") as f:
+            for line in f:
+                label, sep, text = line.rstrip("\n").partition("\t")
+                if not sep or not text:
+                    continue
+                cls = 0 if label.strip().lower() in PHISHING_LABELS else 1
+                docs[cls] += 1
+                counts[cls].update(TOKEN.findall(text.lower()))
+        vocab = set(counts[0]) | set(counts[1])
+        total = sum(docs)
+        self.prior = [math.log(d / total) if d else float("-inf") for d in docs]
+        self.loglik = []
+        for c in range(2):
+            denom = math.log(sum(counts[c].values()) + alpha * len(vocab))
+            self.loglik.append({w: math.log(counts[c][w] + alpha) - denom for w in vocab})
+
+    def classify(self, text):
+        score = list(self.prior)
+        for w in TOKEN.findall(text.lower()):
+            if w in self.loglik[0]:
+                score[0] += self.loglik[0][w]
+                score[1] += self.loglik[1][w]
+        top = max(score)
+        p0 = math.exp(score[0] - top)
+        p1 = math.exp(score[1] - top)
+        return (0 if score[0] > score[1] else 1), p0 / (p0 + p1)
+
+
+def read_emails(path):
+    emails = []
+    with open(path, encoding="utf-8", errors="replace") as f:
+        for line in f:
+            line = line.rstrip("\n")
+            if "\t" in line:
+                line = line.split("\t", 1)[1]
+            if line:
+                emails.append(line)
+    return emails
+
+
+def timed(fn, repeat):
+    best = float("inf")
+    result = None
+    for _ in range(repeat):
+        start = time.perf_counter()
+        result = fn()
+        best = min(best, time.perf_counter() - start)
+    return best, result
+
+
+def concurrent(fn, workers):
+    threads = [threading.Thread(target=fn) for _ in range(workers)]
+    start = time.perf_counter()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    return time.perf_counter() - start
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("train")
+    parser.add_argument("emails")
+    parser.add_argument("--threads", type=int, default=4)
+    parser.add_argument("--repeat", type=int, default=3)
+    args = parser.parse_args()
+
+    emails = read_emails(args.emails)
+    n = len(emails)
+    py = PythonNaiveBayes(args.train)
+    native = phishnb.Classifier(args.train, threads=args.threads)
+
+    py_secs, py_out = timed(lambda: [py.classify(e) for e in emails], args.repeat)
+    one_secs, _ = timed(lambda: [native.classify(e) for e in emails], args.repeat)
+    batch_secs, (labels, probs) = timed(lambda: native.classify_batch(emails), args.repeat)
+
+    agree = sum(1 for (label, _), native_label in zip(py_out, labels) if label == native_label)
+    print(f"emails: {n}, native threads: {args.threads}")
+    print(f"{'pure python':<28}{n / py_secs:>14,.0f} emails/sec")
+    print(f"{'phishnb classify() loop':<28}{n / one_secs:>14,.0f} emails/sec")
+    print(f"{'phishnb classify_batch()':<28}{n / batch_secs:>14,.0f} emails/sec"
+          f"  ({py_secs / batch_secs:.1f}x pure python)")
+    print(f"verdict agreement: {agree / n:.2%}")
+
+    # Flask-style concurrency: several request threads score at once.
+    workers = args.threads
+    py_wall = concurrent(lambda: [py.classify(e) for e in emails], workers)
+    native_wall = concurrent(lambda: native.classify_batch(emails), workers)
+    print(f"{workers} concurrent callers: pure python {workers * n / py_wall:,.0f} emails/sec, "
+          f"phishnb {workers * n / native_wall:,.0f} emails/sec")
+
+
+if __name__ == "__main__":
+    main()
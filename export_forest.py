@@ -0,0 +1,162 @@
+"""Flatten a trained scikit-learn tree ensemble into a .forest file.
+
+    python export_forest.py model_2017.sav model_2017.forest [--verify 10000]
+
+Supports DecisionTreeClassifier, RandomForestClassifier,
+ExtraTreesClassifier and binary GradientBoostingClassifier. The file is
+read by forest_engine.cpp (layout documented there): nodes are renumbered
+breadth-first so every internal node's children are adjacent, leaves point
+at themselves, and thresholds are rounded down to float32 so float32 rows
+compare exactly as they do in scikit-learn. --verify scores random rows
+with both the original model and a NumPy walk over the exported arrays.
+"""
+import argparse
+import struct
+import sys
+
+import joblib
+import numpy as np
+
+MAGIC = b"FOREST01"
+KIND_MEAN_PROBA, KIND_SIGMOID_SUM = 0, 1
+NODE = np.dtype([("threshold", "<f4"), ("feature", "<u4"), ("left", "<u4"), ("value", "<f4")])
+
+
+def float32_floor(thresholds):
+    """Largest float32 t with x <= t exactly when x <= threshold, for float32 x."""
+    t = thresholds.astype(np.float32)
+    over = t.astype(np.float64) > thresholds
+    t[over] = np.nextafter(t[over], np.float32(-np.inf))
+    return t
+
+
+def flatten_tree(tree, leaf_values, offset):
+    """Breadth-first copy of one sklearn tree_ into NODE records."""
+    left, right = tree.children_left, tree.children_right
+    order = [0]
+    new_index = {0: 0}
+    i = 0
+    while i < len(order):
+        old = order[i]
+        i += 1
+        if left[old] != -1:
+            new_index[left[old]] = len(order)
+            order.append(left[old])
+            new_index[right[old]] = len(order)
+            order.append(right[old])
+    thresholds = float32_floor(tree.threshold)
+    nodes = np.zeros(len(order), dtype=NODE)
+    for new, old in enumerate(order):
+        if left[old] == -1:
+            nodes[new] = (np.nan, 0, offset + new, leaf_values[old])
+        else:
+            nodes[new] = (thresholds[old], tree.feature[old], offset + new_index[left[old]], 0.0)
+    return nodes
+
+
+def class_one_fraction(tree):
+    value = tree.value[:, 0, :]
+    return value[:, 1] / np.maximum(value.sum(axis=1), 1e-300)
+
+
+def integer_labels(classes):
+    """The labels as Python ints, or None when any is not integer-valued."""
+    try:
+        labels = [int(c) for c in classes]
+    except (TypeError, ValueError):
+        return None
+    return labels if all(l == c for l, c in zip(labels, classes)) else None
+
+
+def collect(model):
+    """(kind, base, classes, [(tree_, leaf values)]) for a supported model."""
+    name = type(model).__name__
+    classes = getattr(model, "classes_", None)
+    if classes is None or len(classes) != 2:
+        sys.exit(f"{name}: only binary classifiers are supported")
+    if integer_labels(classes) is None:
+        sys.exit(f"{name}: class labels must be integers, got {classes.tolist()!r} (encode them before training)")
+    if name == "DecisionTreeClassifier":
+        return KIND_MEAN_PROBA, 0.0, classes, [(model.tree_, class_one_fraction(model.tree_))]
+    if name in ("RandomForestClassifier", "ExtraTreesClassifier"):
+        trees = [(est.tree_, class_one_fraction(est.tree_)) for est in model.estimators_]
+        return KIND_MEAN_PROBA, 0.0, classes, trees
+    if name == "GradientBoostingClassifier":
+        rate = model.learning_rate
+        trees = [(est.tree_, est.tree_.value[:, 0, 0] * rate) for est in model.estimators_[:, 0]]
+        base = float(model._raw_predict_init(np.zeros((1, model.n_features_in_)))[0, 0])
+        return KIND_SIGMOID_SUM, base, classes, trees
+    sys.exit(f"{name}: unsupported model type (export the fitted tree ensemble itself, not a pipeline)")
+
+
+def export(model, path):
+    kind, base, classes, trees = collect(model)
+    infos, chunks, offset = [], [], 0
+    for tree, values in trees:
+        nodes = flatten_tree(tree, values, offset)
+        infos.append((offset, tree.max_depth))
+        chunks.append(nodes)
+        offset += len(nodes)
+    nodes = np.concatenate(chunks)
+    n_features = model.n_features_in_
+    header = MAGIC + struct.pack("<4Id2q", n_features, len(infos), len(nodes), kind, base,
+                                 *integer_labels(classes))
+    with open(path, "wb") as f:
+        f.write(header.ljust(64, b"\0"))
+        f.write(np.array(infos, dtype="<u4").tobytes())
+        f.write(nodes.tobytes())
+    return kind, base, classes, np.array(infos), nodes
+
+
+def walk(kind, base, infos, nodes, rows):
+    """Reference traversal of the flat arrays, mirroring forest_engine.cpp."""
+    x = rows.astype(np.float32)
+    total = np.zeros(len(x))
+    for root, depth in infos:
+        idx = np.full(len(x), root, dtype=np.int64)
+        for _ in range(depth):
+            n = nodes[idx]
+            go_right = x[np.arange(len(x)), n["feature"]] > n["threshold"]
+            idx = n["left"].astype(np.int64) + go_right
+        total += nodes[idx]["value"]
+    if kind == KIND_MEAN_PROBA:
+        return total / len(infos)
+    return 1.0 / (1.0 + np.exp(-(base + total)))
+
+
+def verify(model, exported, count):
+    kind, base, classes, infos, nodes = exported
+    rng = np.random.default_rng(0)
+    n_features = model.n_features_in_
+    internal = nodes["left"] != np.arange(len(nodes))
+    rows = rng.normal(size=(count, n_features))
+    for k in range(n_features):
+        cuts = nodes["threshold"][internal & (nodes["feature"] == k)]
+        if len(cuts):
+            picks = rng.choice(cuts, size=count).astype(np.float64)
+            rows[:, k] = picks + rng.uniform(-1, 1, size=count) * (np.abs(picks) * 0.01 + 1e-3)
+    ours = walk(kind, base, infos, nodes, rows)
+    theirs = model.predict_proba(rows)[:, 1]
+    labels = np.where(ours > 0.5, classes[1], classes[0])
+    agree = np.mean(labels == model.predict(rows))
+    print(f"verify: {count} rows, label agreement {agree:.4%}, max |dp| {np.max(np.abs(ours - theirs)):.2e}")
+    return agree == 1.0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("model", help="joblib/pickle file, e.g. model_2017.sav")
+    parser.add_argument("output", help="destination .forest file")
+    parser.add_argument("--verify", type=int, default=0, metavar="N", help="check N random rows after export")
+    args = parser.parse_args()
+
+    model = joblib.load(args.model)
+    exported = export(model, args.output)
+    _, _, _, infos, nodes = exported
+    print(f"{args.output}: {len(infos)} trees, {len(nodes)} nodes, max depth {infos[:, 1].max()}")
+    if args.verify and not verify(model, exported, args.verify):
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,314 @@
+// Tree-ensemble inference for the DDoS predictor (ape.py).
+//
+// export_forest.py flattens a trained scikit-learn tree ensemble
+// (DecisionTree, RandomForest, ExtraTrees or binary GradientBoosting
+// classifier) into a .forest file; this engine maps that file once and
+// scores flow-feature rows without Python in the loop.
+//
+// File layout (little-endian):
+//   0   char magic[8] = "FOREST01"
+//   8   u32 n_features, u32 n_trees, u32 n_nodes, u32 kind
+//   24  f64 base
+//   32  i64 class0, i64 class1  (labels reported for each side)
+//   48  padding to 64
+//   64  TreeInfo[n_trees] {u32 root, u32 depth}
+//       Node[n_nodes]     {f32 threshold, u32 feature, u32 left, f32 value}
+// kind 0 averages the leaf values (P(class1) per tree), kind 1 sums them
+// onto base and applies the logistic function (gradient boosting).
+//
+// Children are stored next to each other (right = left + 1), so a step is
+// idx = left + (x[feature] > threshold) with no branch. Leaves point at
+// themselves with a NaN threshold, so rows that reach a leaf early simply
+// stay put; batches walk eight rows through a tree in lockstep, so their
+// independent node loads overlap, and stop once none of them moved.
+// Thresholds were rounded down to float32 by the exporter and rows are
+// converted to float32 here, which reproduces scikit-learn's float32
+// comparisons exactly.
+//
+// Build the shared library loaded by ape.py through ctypes:
+//   g++ -O2 -std=c++17 -shared -fPIC forest_engine.cpp -o libforest_engine.so
+//   (forest_engine.dll on Windows)
+// or the benchmark:
+//   g++ -O2 -std=c++17 -DFOREST_ENGINE_MAIN forest_engine.cpp -o forest_engine
+//   ./forest_engine model.forest [rows]
+
+#include <bits/stdc++.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+#ifdef _WIN32
+#define FOREST_API extern "C" __declspec(dllexport)
+#else
+#define FOREST_API extern "C" __attribute__((visibility("default")))
+#endif
+
+constexpr char forest_magic[8] = {'F', 'O', 'R', 'E', 'S', 'T', '0', '1'};
+constexpr size_t forest_header = 64;
+
+enum ForestKind : uint32_t { KIND_MEAN_PROBA = 0, KIND_SIGMOID_SUM = 1 };
+
+struct TreeInfo {
+    uint32_t root;
+    uint32_t depth;
+};
+
+struct Node {
+    float threshold; // NaN at leaves
+    uint32_t feature;
+    uint32_t left; // right child is left + 1; leaves point at themselves
+    float value;
+};
+static_assert(sizeof(Node) == 16, "Node layout is part of the file format");
+
+// ---------- Model file ----------
+struct Forest {
+    const char *data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    string buffer;
+#endif
+    uint32_t n_features = 0, n_trees = 0, n_nodes = 0, kind = 0;
+    double base = 0;
+    int64_t classes[2] = {0, 1};
+    const TreeInfo *trees = nullptr;
+    const Node *nodes = nullptr;
+
+    Forest() = default;
+    Forest(const Forest &) = delete;
+    Forest &operator=(const Forest &) = delete;
+
+    ~Forest() {
+#ifndef _WIN32
+        if (data && size) munmap(const_cast<char *>(data), size);
+#endif
+    }
+
+    bool map(const string &path) {
+#ifdef _WIN32
+        ifstream in(path, ios::binary);
+        if (!in.is_open()) return false;
+        buffer.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        data = buffer.data();
+        size = buffer.size();
+        return true;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        size = static_cast<size_t>(st.st_size);
+        void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            size = 0;
+            return false;
+        }
+        data = static_cast<const char *>(p);
+        return true;
+#endif
+    }
+
+    // Checks the header and every index once, so scoring needs no bounds checks.
+    bool load(const string &path) {
+        if (!map(path) || size < forest_header || memcmp(data, forest_magic, sizeof forest_magic) != 0) {
+            return false;
+        }
+        memcpy(&n_features, data + 8, 4);
+        memcpy(&n_trees, data + 12, 4);
+        memcpy(&n_nodes, data + 16, 4);
+        memcpy(&kind, data + 20, 4);
+        memcpy(&base, data + 24, 8);
+        memcpy(classes, data + 32, 16);
+        size_t need = forest_header + (size_t)n_trees * sizeof(TreeInfo) + (size_t)n_nodes * sizeof(Node);
+        if (n_features == 0 || n_trees == 0 || kind > KIND_SIGMOID_SUM || size < need) return false;
+        trees = reinterpret_cast<const TreeInfo *>(data + forest_header);
+        nodes = reinterpret_cast<const Node *>(data + forest_header + (size_t)n_trees * sizeof(TreeInfo));
+        for (uint32_t t = 0; t < n_trees; ++t) {
+            if (trees[t].root >= n_nodes) return false;
+        }
+        for (uint32_t i = 0; i < n_nodes; ++i) {
+            const Node &n = nodes[i];
+            if (n.feature >= n_features) return false;
+            if (n.left == i) { // leaf: only a NaN threshold keeps rows on it
+                if (!isnan(n.threshold)) return false;
+                continue;
+            }
+            if (n.left + 1ull >= n_nodes) return false;
+        }
+        return true;
+    }
+
+    double finish(double sum) const {
+        if (kind == KIND_MEAN_PROBA) return sum / n_trees;
+        return 1.0 / (1.0 + exp(-(base + sum)));
+    }
+
+    // scikit-learn breaks a 0.5 tie towards the first class.
+    int64_t label(double p) const { return p > 0.5 ? classes[1] : classes[0]; }
+
+    double scoreRow(const float *x) const {
+        double sum = 0;
+        for (uint32_t t = 0; t < n_trees; ++t) {
+            uint32_t idx = trees[t].root;
+            for (uint32_t d = 0; d < trees[t].depth; ++d) {
+                const Node &n = nodes[idx];
+                if (n.left == idx) break; // leaf above the tree's full depth
+                idx = n.left + (x[n.feature] > n.threshold);
+            }
+            sum += nodes[idx].value;
+        }
+        return finish(sum);
+    }
+
+    // Eight rows (row-major float32, n_features apart) through every tree.
+    static constexpr int block = 8;
+    void scoreBlock(const float *x, double *p) const {
+        double sum[block] = {};
+        uint32_t idx[block];
+        for (uint32_t t = 0; t < n_trees; ++t) {
+            for (int r = 0; r < block; ++r) idx[r] = trees[t].root;
+            for (uint32_t d = 0; d < trees[t].depth; ++d) {
+                uint32_t moved = 0;
+                for (int r = 0; r < block; ++r) {
+                    const Node &n = nodes[idx[r]];
+                    uint32_t next = n.left + (x[(size_t)r * n_features + n.feature] > n.threshold);
+                    moved |= next ^ idx[r];
+                    idx[r] = next;
+                }
+                if (!moved) break; // all eight rows sit at leaves
+            }
+            for (int r = 0; r < block; ++r) sum[r] += nodes[idx[r]].value;
+        }
+        for (int r = 0; r < block; ++r) p[r] = finish(sum[r]);
+    }
+
+    void scoreBatch(const double *rows, size_t n, int64_t *labels, double *proba) const {
+        vector<float> x((size_t)block * n_features);
+        double p[block];
+        size_t i = 0;
+        for (; i + block <= n; i += block) {
+            const double *src = rows + i * n_features;
+            for (size_t k = 0; k < x.size(); ++k) x[k] = (float)src[k];
+            scoreBlock(x.data(), p);
+            for (int r = 0; r < block; ++r) {
+                if (labels) labels[i + r] = label(p[r]);
+                if (proba) proba[i + r] = p[r];
+            }
+        }
+        for (; i < n; ++i) {
+            const double *src = rows + i * n_features;
+            for (uint32_t k = 0; k < n_features; ++k) x[k] = (float)src[k];
+            double q = scoreRow(x.data());
+            if (labels) labels[i] = label(q);
+            if (proba) proba[i] = q;
+        }
+    }
+};
+
+// ---------- C API ----------
+// A loaded forest is read-only, so any number of threads may score with it.
+
+FOREST_API void *forest_load(const char *path) {
+    auto *f = new Forest;
+    if (!f->load(path)) {
+        delete f;
+        return nullptr;
+    }
+    return f;
+}
+
+FOREST_API void forest_free(void *forest) { delete static_cast<Forest *>(forest); }
+
+FOREST_API uint32_t forest_num_features(void *forest) { return static_cast<Forest *>(forest)->n_features; }
+
+FOREST_API uint32_t forest_num_trees(void *forest) { return static_cast<Forest *>(forest)->n_trees; }
+
+// Scores one row of n_features doubles; returns the predicted class label
+// and stores P(class1) in *proba when non-null.
+FOREST_API int64_t forest_predict(void *forest, const double *row, double *proba) {
+    const Forest &f = *static_cast<Forest *>(forest);
+    float stack_x[64];
+    vector<float> heap_x;
+    float *x = stack_x;
+    if (f.n_features > 64) {
+        heap_x.resize(f.n_features);
+        x = heap_x.data();
+    }
+    for (uint32_t k = 0; k < f.n_features; ++k) x[k] = (float)row[k];
+    double p = f.scoreRow(x);
+    if (proba) *proba = p;
+    return f.label(p);
+}
+
+// n rows, row-major, n_features doubles each. Either output may be null.
+FOREST_API void forest_predict_batch(void *forest, const double *rows, size_t n, int64_t *labels, double *proba) {
+    static_cast<Forest *>(forest)->scoreBatch(rows, n, labels, proba);
+}
+
+#ifdef FOREST_ENGINE_MAIN
+// Random rows drawn from each feature's split thresholds, so traversals
+// reach realistic depths without a dataset at hand.
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " model.forest [rows]\n";
+        return 1;
+    }
+    void *handle = forest_load(argv[1]);
+    if (!handle) {
+        cerr << "Cannot load forest: " << argv[1] << "\n";
+        return 1;
+    }
+    const Forest &f = *static_cast<Forest *>(handle);
+    size_t rows = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1000000;
+
+    vector<vector<float>> cuts(f.n_features);
+    for (uint32_t i = 0; i < f.n_nodes; ++i) {
+        if (f.nodes[i].left != i) cuts[f.nodes[i].feature].push_back(f.nodes[i].threshold);
+    }
+    mt19937 rng(7);
+    vector<double> data(rows * f.n_features);
+    for (size_t r = 0; r < rows; ++r) {
+        for (uint32_t k = 0; k < f.n_features; ++k) {
+            const auto &c = cuts[k];
+            double v = c.empty() ? 0.0 : c[rng() % c.size()];
+            data[r * f.n_features + k] = v + uniform_real_distribution<double>(-1, 1)(rng) * (fabs(v) * 0.01 + 1e-3);
+        }
+    }
+
+    size_t singles = min<size_t>(rows, 100000);
+    volatile int64_t sink = 0;
+    auto t0 = chrono::steady_clock::now();
+    for (size_t r = 0; r < singles; ++r) sink = sink + forest_predict(handle, &data[r * f.n_features], nullptr);
+    auto t1 = chrono::steady_clock::now();
+    vector<int64_t> labels(rows);
+    vector<double> proba(rows);
+    forest_predict_batch(handle, data.data(), rows, labels.data(), proba.data());
+    auto t2 = chrono::steady_clock::now();
+
+    size_t mismatched = 0;
+    for (size_t r = 0; r < singles; ++r) {
+        double p;
+        forest_predict(handle, &data[r * f.n_features], &p);
+        mismatched += p != proba[r];
+    }
+    double single_us = chrono::duration<double, micro>(t1 - t0).count() / singles;
+    double batch_s = chrono::duration<double>(t2 - t1).count();
+    size_t positive = (size_t)count(labels.begin(), labels.end(), f.classes[1]);
+    cout << fixed << setprecision(2) << f.n_trees << " trees, " << f.n_nodes << " nodes, " << f.n_features
+         << " features\n"
+         << "single row: " << single_us << " us/prediction\n"
+         << "batch:      " << rows / batch_s / 1e6 << " M rows/s (" << rows << " rows, " << positive
+         << " predicted " << f.classes[1] << ")\n"
+         << "single/batch mismatches: " << mismatched << "\n";
+    forest_free(handle);
+    return 0;
+}
+#endif
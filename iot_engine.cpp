@@ -0,0 +1,420 @@
+// Native fleet engine for the IoT security monitor (app.py).
+//
+// Device metrics live in structure-of-arrays columns. A single writer (the
+// simulation / ingestion thread, or an admin action) applies metric updates
+// in batches, evaluates risk scores and threat flags over whole columns with
+// an AVX2 kernel (scalar fallback), and publishes an immutable snapshot with
+// one shared_ptr swap. Readers pin a snapshot and read its columns without
+// ever taking the writer's lock, so dashboard reads never wait for a batch
+// update or evaluation; a snapshot is freed (or recycled) once its last
+// reader lets go. The swap and pin use std::atomic_load/atomic_exchange on
+// shared_ptr, which libstdc++ implements with a small pool of mutexes held
+// only for the pointer copy, so the pin is short-blocking, not lock-free.
+//
+// Rules, as in app.py:
+//   risk  = min(100, cpu*0.4 + memory*0.3 + ports/50*20
+//                    + failed_logins/10*15 + connections/100*10)
+//   flags = high_cpu (cpu > 95) | high_memory (memory > 90)
+//         | port_scan (ports > 45) | bruteforce (failed_logins > 8)
+//
+// Build the shared library loaded by app.py through ctypes:
+//   g++ -O2 -std=c++17 -shared -fPIC -pthread iot_engine.cpp -o libiot_engine.so
+//   (iot_engine.dll on Windows)
+// or a standalone benchmark:
+//   g++ -O2 -std=c++17 -pthread -DIOT_ENGINE_MAIN iot_engine.cpp -o iot_engine
+//   ./iot_engine [devices] [rounds]
+
+#include <bits/stdc++.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+using namespace std;
+
+#ifdef _WIN32
+#define IOT_API extern "C" __declspec(dllexport)
+#else
+#define IOT_API extern "C" __attribute__((visibility("default")))
+#endif
+
+enum ThreatFlag : uint8_t {
+    FLAG_HIGH_CPU = 1,
+    FLAG_HIGH_MEMORY = 2,
+    FLAG_PORT_SCAN = 4,
+    FLAG_BRUTEFORCE = 8,
+};
+
+enum DeviceStatus : uint8_t {
+    STATUS_ONLINE = 0,
+    STATUS_SUSPICIOUS = 1,
+    STATUS_COMPROMISED = 2,
+    STATUS_OFFLINE = 3,
+    STATUS_QUARANTINED = 4,
+    STATUS_COUNT = 5,
+};
+
+// Column ids for iot_snapshot_column().
+enum Column : int {
+    COL_CPU = 0,         // float
+    COL_MEMORY = 1,      // float
+    COL_DISK = 2,        // float
+    COL_PORTS = 3,       // int32
+    COL_CONNECTIONS = 4, // int32
+    COL_FAILED = 5,      // int32
+    COL_LAST_SEEN = 6,   // double, seconds since the epoch
+    COL_RISK = 7,        // float
+    COL_FLAGS = 8,       // uint8 ThreatFlag bits
+    COL_STATUS = 9,      // uint8 DeviceStatus
+};
+
+constexpr float high_risk_threshold = 70.0f;
+
+// ---------- Columns ----------
+struct FleetColumns {
+    vector<float> cpu, memory, disk, risk;
+    vector<int32_t> ports, connections, failed_logins;
+    vector<double> last_seen;
+    vector<uint8_t> flags, status;
+
+    size_t size() const { return cpu.size(); }
+
+    void resize(size_t n) {
+        cpu.resize(n);
+        memory.resize(n);
+        disk.resize(n);
+        risk.resize(n);
+        ports.resize(n);
+        connections.resize(n);
+        failed_logins.resize(n);
+        last_seen.resize(n);
+        flags.resize(n);
+        status.resize(n);
+    }
+
+    // Copies every column; vectors keep their capacity when reused.
+    void assign(const FleetColumns &o) {
+        cpu.assign(o.cpu.begin(), o.cpu.end());
+        memory.assign(o.memory.begin(), o.memory.end());
+        disk.assign(o.disk.begin(), o.disk.end());
+        risk.assign(o.risk.begin(), o.risk.end());
+        ports.assign(o.ports.begin(), o.ports.end());
+        connections.assign(o.connections.begin(), o.connections.end());
+        failed_logins.assign(o.failed_logins.begin(), o.failed_logins.end());
+        last_seen.assign(o.last_seen.begin(), o.last_seen.end());
+        flags.assign(o.flags.begin(), o.flags.end());
+        status.assign(o.status.begin(), o.status.end());
+    }
+};
+
+// ---------- Risk kernels ----------
+// Both kernels compute exactly the same float expression in the same
+// order, so results do not depend on which one ran.
+void evaluateScalar(const FleetColumns &c, size_t begin, size_t end, float *risk, uint8_t *flags) {
+    for (size_t i = begin; i < end; ++i) {
+        float ports = (float)c.ports[i], failed = (float)c.failed_logins[i];
+        float conns = (float)c.connections[i];
+        float score = c.cpu[i] * 0.4f + c.memory[i] * 0.3f + ports * 0.4f + failed * 1.5f + conns * 0.1f;
+        risk[i] = min(score, 100.0f);
+        flags[i] = (c.cpu[i] > 95.0f ? FLAG_HIGH_CPU : 0) | (c.memory[i] > 90.0f ? FLAG_HIGH_MEMORY : 0) |
+                   (ports > 45.0f ? FLAG_PORT_SCAN : 0) | (failed > 8.0f ? FLAG_BRUTEFORCE : 0);
+    }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define IOT_HAVE_AVX2_KERNEL 1
+// Eight devices per step: the threshold compares become lane masks that
+// movemask packs into one bit per device for each rule.
+__attribute__((target("avx2")))
+void evaluateAvx2(const FleetColumns &c, size_t n, float *risk, uint8_t *flags) {
+    const __m256 w_cpu = _mm256_set1_ps(0.4f), w_mem = _mm256_set1_ps(0.3f);
+    const __m256 w_ports = _mm256_set1_ps(0.4f), w_failed = _mm256_set1_ps(1.5f);
+    const __m256 w_conns = _mm256_set1_ps(0.1f), cap = _mm256_set1_ps(100.0f);
+    const __m256 t_cpu = _mm256_set1_ps(95.0f), t_mem = _mm256_set1_ps(90.0f);
+    const __m256 t_ports = _mm256_set1_ps(45.0f), t_failed = _mm256_set1_ps(8.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 cpu = _mm256_loadu_ps(&c.cpu[i]);
+        __m256 mem = _mm256_loadu_ps(&c.memory[i]);
+        __m256 ports = _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(&c.ports[i])));
+        __m256 failed =
+            _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(&c.failed_logins[i])));
+        __m256 conns =
+            _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(&c.connections[i])));
+        // Same association order as the scalar kernel, and no FMA, so the
+        // sums round identically.
+        __m256 score = _mm256_mul_ps(cpu, w_cpu);
+        score = _mm256_add_ps(score, _mm256_mul_ps(mem, w_mem));
+        score = _mm256_add_ps(score, _mm256_mul_ps(ports, w_ports));
+        score = _mm256_add_ps(score, _mm256_mul_ps(failed, w_failed));
+        score = _mm256_add_ps(score, _mm256_mul_ps(conns, w_conns));
+        _mm256_storeu_ps(&risk[i], _mm256_min_ps(score, cap));
+        int m_cpu = _mm256_movemask_ps(_mm256_cmp_ps(cpu, t_cpu, _CMP_GT_OQ));
+        int m_mem = _mm256_movemask_ps(_mm256_cmp_ps(mem, t_mem, _CMP_GT_OQ));
+        int m_ports = _mm256_movemask_ps(_mm256_cmp_ps(ports, t_ports, _CMP_GT_OQ));
+        int m_failed = _mm256_movemask_ps(_mm256_cmp_ps(failed, t_failed, _CMP_GT_OQ));
+        for (int k = 0; k < 8; ++k) {
+            flags[i + k] = (uint8_t)(((m_cpu >> k) & 1) * FLAG_HIGH_CPU | ((m_mem >> k) & 1) * FLAG_HIGH_MEMORY |
+                                     ((m_ports >> k) & 1) * FLAG_PORT_SCAN |
+                                     ((m_failed >> k) & 1) * FLAG_BRUTEFORCE);
+        }
+    }
+    evaluateScalar(c, i, n, risk, flags);
+}
+#endif
+
+// Picks the widest kernel the running CPU supports, once.
+void evaluateColumns(FleetColumns &c) {
+    size_t n = c.size();
+#ifdef IOT_HAVE_AVX2_KERNEL
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2) {
+        evaluateAvx2(c, n, c.risk.data(), c.flags.data());
+        return;
+    }
+#endif
+    evaluateScalar(c, 0, n, c.risk.data(), c.flags.data());
+}
+
+// ---------- Snapshots ----------
+// Immutable once published; summary counters are precomputed so the
+// dashboard's /api/stats is O(1).
+struct FleetSnapshot {
+    uint64_t version = 0;
+    FleetColumns columns;
+    uint32_t status_count[STATUS_COUNT] = {0, 0, 0, 0, 0};
+    uint32_t high_risk = 0;
+    uint32_t flagged = 0;
+};
+
+struct FleetEngine {
+    mutex writer_mtx; // serializes writers only; readers never take it
+    FleetColumns working;
+    bool dirty = true; // metrics changed since the last evaluation
+    uint64_t version = 0;
+    shared_ptr<FleetSnapshot> current;
+    shared_ptr<FleetSnapshot> spare; // previous snapshot, reused when unpinned
+
+    FleetEngine() { current = make_shared<FleetSnapshot>(); }
+
+    void evaluate() {
+        if (!dirty) return;
+        evaluateColumns(working);
+        dirty = false;
+    }
+
+    uint64_t publish() {
+        evaluate();
+        shared_ptr<FleetSnapshot> next;
+        if (spare && spare.use_count() == 1) {
+            // use_count() is a relaxed load; pair it with the last reader's
+            // release so its reads of the columns happen before we rewrite them.
+            atomic_thread_fence(memory_order_acquire);
+            next = move(spare);
+        } else {
+            next = make_shared<FleetSnapshot>();
+        }
+        spare.reset();
+        next->columns.assign(working);
+        next->version = ++version;
+        fill(begin(next->status_count), end(next->status_count), 0);
+        uint32_t high = 0, flagged = 0;
+        const FleetColumns &c = next->columns;
+        for (size_t i = 0; i < c.size(); ++i) {
+            next->status_count[min<uint8_t>(c.status[i], STATUS_COUNT - 1)]++;
+            high += c.risk[i] > high_risk_threshold;
+            flagged += c.flags[i] != 0;
+        }
+        next->high_risk = high;
+        next->flagged = flagged;
+        spare = atomic_exchange(&current, shared_ptr<FleetSnapshot>(next));
+        return next->version;
+    }
+};
+
+using SnapshotHandle = shared_ptr<const FleetSnapshot>;
+
+// ---------- C API ----------
+// Writer calls (iot_add_device ... iot_publish) may come from any thread;
+// they serialize on the engine's writer lock. Snapshot calls never take
+// that lock; acquiring one only copies the current pointer (see above).
+
+IOT_API void *iot_create(uint32_t reserve) {
+    auto *e = new FleetEngine;
+    e->working.cpu.reserve(reserve);
+    return e;
+}
+
+IOT_API void iot_destroy(void *engine) { delete static_cast<FleetEngine *>(engine); }
+
+// Adds a device with idle metrics and returns its index.
+IOT_API int32_t iot_add_device(void *engine, double now) {
+    auto *e = static_cast<FleetEngine *>(engine);
+    lock_guard<mutex> lk(e->writer_mtx);
+    size_t i = e->working.size();
+    e->working.resize(i + 1);
+    e->working.last_seen[i] = now;
+    e->working.status[i] = STATUS_ONLINE;
+    e->dirty = true;
+    return (int32_t)i;
+}
+
+// Scatters n metric rows into the columns. Returns the number of rows
+// skipped for an out-of-range index.
+IOT_API size_t iot_update_batch(void *engine, size_t n, const int32_t *index, const float *cpu,
+                                const float *memory, const float *disk, const int32_t *ports,
+                                const int32_t *connections, const int32_t *failed_logins, double now) {
+    auto *e = static_cast<FleetEngine *>(engine);
+    lock_guard<mutex> lk(e->writer_mtx);
+    FleetColumns &c = e->working;
+    size_t skipped = 0;
+    for (size_t k = 0; k < n; ++k) {
+        size_t i = (size_t)index[k];
+        if (index[k] < 0 || i >= c.size()) {
+            skipped++;
+            continue;
+        }
+        c.cpu[i] = cpu[k];
+        c.memory[i] = memory[k];
+        c.disk[i] = disk[k];
+        c.ports[i] = ports[k];
+        c.connections[i] = connections[k];
+        c.failed_logins[i] = failed_logins[k];
+        c.last_seen[i] = now;
+    }
+    e->dirty = true;
+    return skipped;
+}
+
+IOT_API void iot_set_status_batch(void *engine, size_t n, const int32_t *index, const uint8_t *status) {
+    auto *e = static_cast<FleetEngine *>(engine);
+    lock_guard<mutex> lk(e->writer_mtx);
+    FleetColumns &c = e->working;
+    for (size_t k = 0; k < n; ++k) {
+        if (index[k] >= 0 && (size_t)index[k] < c.size()) c.status[index[k]] = min<uint8_t>(status[k], STATUS_COUNT - 1);
+    }
+}
+
+// Runs the risk kernel over the working columns and copies the threat
+// flags into out (capacity entries at most). Returns the device count.
+IOT_API size_t iot_evaluate(void *engine, uint8_t *out, size_t capacity) {
+    auto *e = static_cast<FleetEngine *>(engine);
+    lock_guard<mutex> lk(e->writer_mtx);
+    e->evaluate();
+    size_t n = e->working.size();
+    if (out) memcpy(out, e->working.flags.data(), min(n, capacity));
+    return n;
+}
+
+// Publishes the working columns as a new snapshot; returns its version.
+IOT_API uint64_t iot_publish(void *engine) {
+    auto *e = static_cast<FleetEngine *>(engine);
+    lock_guard<mutex> lk(e->writer_mtx);
+    return e->publish();
+}
+
+// Pins the current snapshot until iot_snapshot_release().
+IOT_API void *iot_snapshot_acquire(void *engine) {
+    auto *e = static_cast<FleetEngine *>(engine);
+    return new SnapshotHandle(atomic_load(&e->current));
+}
+
+IOT_API void iot_snapshot_release(void *snapshot) { delete static_cast<SnapshotHandle *>(snapshot); }
+
+IOT_API size_t iot_snapshot_size(void *snapshot) {
+    return (*static_cast<SnapshotHandle *>(snapshot))->columns.size();
+}
+
+IOT_API uint64_t iot_snapshot_version(void *snapshot) {
+    return (*static_cast<SnapshotHandle *>(snapshot))->version;
+}
+
+// Base address of one column (see Column), nullptr for an unknown id.
+IOT_API const void *iot_snapshot_column(void *snapshot, int column) {
+    const FleetColumns &c = (*static_cast<SnapshotHandle *>(snapshot))->columns;
+    switch (column) {
+        case COL_CPU: return c.cpu.data();
+        case COL_MEMORY: return c.memory.data();
+        case COL_DISK: return c.disk.data();
+        case COL_PORTS: return c.ports.data();
+        case COL_CONNECTIONS: return c.connections.data();
+        case COL_FAILED: return c.failed_logins.data();
+        case COL_LAST_SEEN: return c.last_seen.data();
+        case COL_RISK: return c.risk.data();
+        case COL_FLAGS: return c.flags.data();
+        case COL_STATUS: return c.status.data();
+    }
+    return nullptr;
+}
+
+// out[0..4] = devices per DeviceStatus, out[5] = high risk (> 70),
+// out[6] = devices with any threat flag.
+IOT_API void iot_snapshot_summary(void *snapshot, uint32_t out[STATUS_COUNT + 2]) {
+    const FleetSnapshot &s = **static_cast<SnapshotHandle *>(snapshot);
+    for (int i = 0; i < STATUS_COUNT; ++i) out[i] = s.status_count[i];
+    out[STATUS_COUNT] = s.high_risk;
+    out[STATUS_COUNT + 1] = s.flagged;
+}
+
+#ifdef IOT_ENGINE_MAIN
+// Ingestion benchmark: random metrics for every device each round, then
+// evaluate + publish, while a reader thread keeps pinning snapshots.
+int main(int argc, char **argv) {
+    size_t devices = argc > 1 ? strtoull(argv[1], nullptr, 10) : 100000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 50;
+    void *e = iot_create((uint32_t)devices);
+    for (size_t i = 0; i < devices; ++i) iot_add_device(e, 0.0);
+
+    mt19937 rng(42);
+    vector<int32_t> index(devices), ports(devices), conns(devices), failed(devices);
+    vector<float> cpu(devices), mem(devices), disk(devices);
+    iota(index.begin(), index.end(), 0);
+
+    atomic<bool> stop{false};
+    atomic<uint64_t> reads{0};
+    thread reader([&] {
+        uint32_t summary[STATUS_COUNT + 2];
+        while (!stop) {
+            void *s = iot_snapshot_acquire(e);
+            iot_snapshot_summary(s, summary);
+            iot_snapshot_release(s);
+            reads++;
+        }
+    });
+
+    double update_s = 0, publish_s = 0;
+    for (int r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < devices; ++i) {
+            cpu[i] = uniform_real_distribution<float>(5, 100)(rng);
+            mem[i] = uniform_real_distribution<float>(10, 95)(rng);
+            disk[i] = uniform_real_distribution<float>(20, 85)(rng);
+            ports[i] = uniform_int_distribution<int>(2, 65)(rng);
+            conns[i] = uniform_int_distribution<int>(5, 150)(rng);
+            failed[i] = uniform_int_distribution<int>(0, 15)(rng);
+        }
+        auto t0 = chrono::steady_clock::now();
+        iot_update_batch(e, devices, index.data(), cpu.data(), mem.data(), disk.data(), ports.data(),
+                         conns.data(), failed.data(), r);
+        auto t1 = chrono::steady_clock::now();
+        iot_publish(e);
+        auto t2 = chrono::steady_clock::now();
+        update_s += chrono::duration<double>(t1 - t0).count();
+        publish_s += chrono::duration<double>(t2 - t1).count();
+    }
+    stop = true;
+    reader.join();
+
+    void *s = iot_snapshot_acquire(e);
+    uint32_t summary[STATUS_COUNT + 2];
+    iot_snapshot_summary(s, summary);
+    cout << fixed << setprecision(2) << devices << " devices, " << rounds << " rounds\n"
+         << "update batch:      " << update_s / rounds * 1e3 << " ms/round ("
+         << devices * rounds / update_s / 1e6 << " M rows/s)\n"
+         << "evaluate+publish:  " << publish_s / rounds * 1e3 << " ms/round ("
+         << devices * rounds / publish_s / 1e6 << " M devices/s)\n"
+         << "snapshot reads:    " << reads.load() << " during the run\n"
+         << "last snapshot:     v" << iot_snapshot_version(s) << ", " << summary[STATUS_COUNT]
+         << " high risk, " << summary[STATUS_COUNT + 1] << " flagged\n";
+    iot_snapshot_release(s);
+    iot_destroy(e);
+    return 0;
+}
+#endif
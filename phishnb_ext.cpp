@@ -0,0 +1,301 @@
+// Python extension module around the r1p1 phishing classifier, so the
+// Flask services can score emails in-process instead of shelling out.
+//
+// Build (from the repository root):
+//   g++ -O2 -std=c++17 -shared -fPIC -pthread $(python3-config --includes)
+//       phishnb_ext.cpp -o phishnb$(python3-config --extension-suffix)
+//
+// Usage:
+//   import phishnb
+//   clf = phishnb.Classifier("model.bin", threads=4)   # model or training file
+//   labels, p_phishing = clf.classify_batch(["verify your account", ...])
+//   label, p = clf.classify("meeting at noon")
+//
+// quantize=True scores with int16 likelihood tables and frees the double
+// ones; a model saved with `r1p1 --train ... --quantize` is int16 already.
+//
+// Labels follow the classifier: 0 = phishing, 1 = legit. classify_batch
+// returns NumPy arrays (uint8 labels, float64 probabilities) when NumPy is
+// importable and array.array otherwise. Scoring runs with the GIL
+// released; a call spreads its batch over the classifier's thread pool,
+// or scores on the calling thread while another call holds the pool, so
+// concurrent Flask workers each make progress.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#define R1P1_NO_MAIN
+#include "r1p1.cpp"
+
+namespace {
+
+struct ClassifierState {
+    shared_ptr<NaiveBayesEmailClassifier> model; // swapped with atomic_store
+    unique_ptr<ThreadPool> pool;
+    mutex pool_mtx;
+    string path;
+    bool quantize = false; // reapplied by reload()
+};
+
+struct ClassifierObject {
+    PyObject_HEAD
+    ClassifierState *state;
+};
+
+shared_ptr<NaiveBayesEmailClassifier> loadClassifier(const string &path, bool quantize, bool &ok) {
+    auto clf = make_shared<NaiveBayesEmailClassifier>();
+    ok = clf->loadOrTrain(path);
+    if (ok && quantize) clf->quantize(true);
+    return clf;
+}
+
+int Classifier_init(ClassifierObject *self, PyObject *args, PyObject *kwargs) {
+    static const char *keywords[] = {"path", "threads", "quantize", nullptr};
+    const char *path;
+    int threads = 0, quantize = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|ip", const_cast<char **>(keywords), &path,
+                                     &threads, &quantize)) {
+        return -1;
+    }
+    // GIL-released calls hold the raw state pointer, so it must live as
+    // long as the object.
+    if (self->state) {
+        PyErr_SetString(PyExc_RuntimeError, "Classifier already initialized");
+        return -1;
+    }
+    if (threads <= 0) threads = (int)max(1u, thread::hardware_concurrency());
+    bool ok;
+    shared_ptr<NaiveBayesEmailClassifier> clf;
+    Py_BEGIN_ALLOW_THREADS
+    clf = loadClassifier(path, quantize, ok);
+    Py_END_ALLOW_THREADS
+    if (!ok) {
+        PyErr_Format(PyExc_ValueError, "cannot load model or training file: %s", path);
+        return -1;
+    }
+    self->state = new ClassifierState;
+    self->state->model = clf;
+    self->state->pool.reset(new ThreadPool(threads - 1));
+    self->state->path = path;
+    self->state->quantize = quantize;
+    return 0;
+}
+
+void Classifier_dealloc(ClassifierObject *self) {
+    PyTypeObject *type = Py_TYPE(self);
+    delete self->state;
+    type->tp_free(reinterpret_cast<PyObject *>(self));
+    Py_DECREF(type); // instances of heap types own a reference to it
+}
+
+bool checkState(ClassifierObject *self) {
+    if (self->state) return true;
+    PyErr_SetString(PyExc_RuntimeError, "Classifier not initialized");
+    return false;
+}
+
+// UTF-8 view of a str or bytes object; valid while the object lives.
+bool textView(PyObject *obj, string_view &out) {
+    if (PyUnicode_Check(obj)) {
+        Py_ssize_t n;
+        const char *data = PyUnicode_AsUTF8AndSize(obj, &n);
+        if (!data) return false;
+        out = string_view(data, n);
+        return true;
+    }
+    if (PyBytes_Check(obj)) {
+        out = string_view(PyBytes_AS_STRING(obj), PyBytes_GET_SIZE(obj));
+        return true;
+    }
+    PyErr_SetString(PyExc_TypeError, "emails must be str or bytes");
+    return false;
+}
+
+// Wraps a filled bytearray as numpy.frombuffer(buf, dtype), falling back
+// to array.array(typecode, buf). Steals the reference to buf.
+PyObject *wrapColumn(PyObject *buf, const char *dtype, const char *typecode) {
+    PyObject *result = nullptr;
+    if (PyObject *numpy = PyImport_ImportModule("numpy")) {
+        result = PyObject_CallMethod(numpy, "frombuffer", "Os", buf, dtype);
+        Py_DECREF(numpy);
+    } else {
+        PyErr_Clear();
+        if (PyObject *array = PyImport_ImportModule("array")) {
+            result = PyObject_CallMethod(array, "array", "sO", typecode, buf);
+            Py_DECREF(array);
+        }
+    }
+    Py_DECREF(buf);
+    return result;
+}
+
+PyObject *Classifier_classify_batch(ClassifierObject *self, PyObject *args, PyObject *kwargs) {
+    static const char *keywords[] = {"emails", "raw", nullptr};
+    PyObject *seq;
+    int raw = 0;
+    if (!checkState(self) ||
+        !PyArg_ParseTupleAndKeywords(args, kwargs, "O|p", const_cast<char **>(keywords), &seq, &raw)) {
+        return nullptr;
+    }
+    PyObject *fast = PySequence_Fast(seq, "emails must be a sequence of str");
+    if (!fast) return nullptr;
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(fast);
+    // Items are held by reference so another thread mutating the list
+    // while the GIL is released cannot free the text being scored.
+    vector<PyObject *> held;
+    vector<string_view> emails;
+    held.reserve(n);
+    emails.reserve(n);
+    bool ok = true;
+    for (Py_ssize_t i = 0; i < n && ok; ++i) {
+        PyObject *item = PySequence_Fast_GET_ITEM(fast, i);
+        string_view text;
+        ok = textView(item, text);
+        if (ok) {
+            Py_INCREF(item);
+            held.push_back(item);
+            emails.push_back(text);
+        }
+    }
+    Py_DECREF(fast);
+    PyObject *labels = ok ? PyByteArray_FromStringAndSize(nullptr, n) : nullptr;
+    PyObject *probs = labels ? PyByteArray_FromStringAndSize(nullptr, n * sizeof(double)) : nullptr;
+    if (!probs) {
+        Py_XDECREF(labels);
+        for (PyObject *item : held) Py_DECREF(item);
+        return nullptr;
+    }
+    auto *label_out = reinterpret_cast<uint8_t *>(PyByteArray_AS_STRING(labels));
+    auto *prob_out = reinterpret_cast<double *>(PyByteArray_AS_STRING(probs));
+
+    ClassifierState *state = self->state;
+    Py_BEGIN_ALLOW_THREADS
+    auto clf = atomic_load(&state->model);
+    vector<NaiveBayesEmailClassifier::BatchResult> results;
+    unique_lock<mutex> lk(state->pool_mtx, try_to_lock);
+    if (lk.owns_lock()) {
+        clf->classifyBatch(emails, results, *state->pool, raw);
+        for (Py_ssize_t i = 0; i < n; ++i) {
+            label_out[i] = static_cast<uint8_t>(results[i].label);
+            prob_out[i] = results[i].p_phishing;
+        }
+    } else {
+        for (Py_ssize_t i = 0; i < n; ++i) {
+            auto p = raw ? clf->classifyRaw(emails[i]) : clf->classify(emails[i]);
+            label_out[i] = static_cast<uint8_t>(p.label);
+            prob_out[i] = p.p_phishing;
+        }
+    }
+    Py_END_ALLOW_THREADS
+    for (PyObject *item : held) Py_DECREF(item);
+
+    PyObject *label_col = wrapColumn(labels, "uint8", "B");
+    if (!label_col) {
+        Py_DECREF(probs);
+        return nullptr;
+    }
+    PyObject *prob_col = wrapColumn(probs, "float64", "d");
+    if (!prob_col) {
+        Py_DECREF(label_col);
+        return nullptr;
+    }
+    return Py_BuildValue("(NN)", label_col, prob_col);
+}
+
+PyObject *Classifier_classify(ClassifierObject *self, PyObject *args, PyObject *kwargs) {
+    static const char *keywords[] = {"email", "raw", nullptr};
+    PyObject *obj;
+    int raw = 0;
+    string_view text;
+    if (!checkState(self) ||
+        !PyArg_ParseTupleAndKeywords(args, kwargs, "O|p", const_cast<char **>(keywords), &obj, &raw) ||
+        !textView(obj, text)) {
+        return nullptr;
+    }
+    Py_INCREF(obj);
+    NaiveBayesEmailClassifier::Prediction p;
+    ClassifierState *state = self->state;
+    Py_BEGIN_ALLOW_THREADS
+    auto clf = atomic_load(&state->model);
+    p = raw ? clf->classifyRaw(text) : clf->classify(text);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(obj);
+    return Py_BuildValue("(id)", static_cast<int>(p.label), p.p_phishing);
+}
+
+// reload([path]) swaps in a freshly loaded model, quantized if the
+// classifier was created with quantize=True; calls in flight finish on
+// the old one.
+PyObject *Classifier_reload(ClassifierObject *self, PyObject *args) {
+    const char *path = nullptr;
+    if (!checkState(self) || !PyArg_ParseTuple(args, "|s", &path)) return nullptr;
+    ClassifierState *state = self->state;
+    string target = path ? path : state->path;
+    bool ok;
+    shared_ptr<NaiveBayesEmailClassifier> clf;
+    Py_BEGIN_ALLOW_THREADS
+    clf = loadClassifier(target, state->quantize, ok);
+    Py_END_ALLOW_THREADS
+    if (!ok) {
+        PyErr_Format(PyExc_ValueError, "cannot load model or training file: %s", target.c_str());
+        return nullptr;
+    }
+    atomic_store(&state->model, clf);
+    state->path = target;
+    Py_RETURN_NONE;
+}
+
+PyObject *Classifier_stats(ClassifierObject *, PyObject *) {
+    ostringstream os;
+    classifierStats().report(os);
+    return PyUnicode_FromString(os.str().c_str());
+}
+
+PyMethodDef classifier_methods[] = {
+    {"classify_batch", (PyCFunction)(void (*)(void))Classifier_classify_batch,
+     METH_VARARGS | METH_KEYWORDS,
+     "classify_batch(emails, raw=False) -> (labels, p_phishing)\n"
+     "Scores a sequence of str/bytes in parallel with the GIL released."},
+    {"classify", (PyCFunction)(void (*)(void))Classifier_classify, METH_VARARGS | METH_KEYWORDS,
+     "classify(email, raw=False) -> (label, p_phishing)"},
+    {"reload", (PyCFunction)(void (*)(void))Classifier_reload, METH_VARARGS,
+     "reload([path]) -> None; atomically swaps in a newly loaded model"},
+    {"stats", (PyCFunction)(void (*)(void))Classifier_stats, METH_NOARGS,
+     "stats() -> str; per-stage classification statistics"},
+    {nullptr, nullptr, 0, nullptr},
+};
+
+PyType_Slot classifier_slots[] = {
+    {Py_tp_doc, const_cast<char *>("Classifier(path, threads=0, quantize=False)\n"
+                                   "Loads a saved model (or trains on a labelled file) once.")},
+    {Py_tp_new, reinterpret_cast<void *>(PyType_GenericNew)},
+    {Py_tp_init, reinterpret_cast<void *>(Classifier_init)},
+    {Py_tp_dealloc, reinterpret_cast<void *>(Classifier_dealloc)},
+    {Py_tp_methods, classifier_methods},
+    {0, nullptr},
+};
+
+PyType_Spec classifier_spec = {
+    "phishnb.Classifier", sizeof(ClassifierObject), 0, Py_TPFLAGS_DEFAULT, classifier_slots,
+};
+
+PyModuleDef phishnb_module = {
+    PyModuleDef_HEAD_INIT, "phishnb", "Native phishing email classifier (r1p1).", -1,
+    nullptr, nullptr, nullptr, nullptr, nullptr,
+};
+
+} // namespace
+
+PyMODINIT_FUNC PyInit_phishnb() {
+    PyObject *module = PyModule_Create(&phishnb_module);
+    if (!module) return nullptr;
+    PyObject *classifier_type = PyType_FromSpec(&classifier_spec);
+    if (!classifier_type || PyModule_AddObject(module, "Classifier", classifier_type) < 0) {
+        Py_XDECREF(classifier_type);
+        Py_DECREF(module);
+        return nullptr;
+    }
+    PyModule_AddIntConstant(module, "PHISHING", NaiveBayesEmailClassifier::PHISHING);
+    PyModule_AddIntConstant(module, "LEGIT", NaiveBayesEmailClassifier::LEGIT);
+    return module;
+}
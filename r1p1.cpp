@@ -34,6 +34,23 @@
 
 
 #include <bits/stdc++.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <csignal>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
 using namespace std;
 
 /*
@@ -46,185 +63,5522 @@ using namespace std;
  phishing  Verify your account now by clicking this link
  legit     Meeting schedule for tomorrow
 
+ Usage:
+   r1p1                                   interactive mode; besides email
+                                          text it accepts
+                                            :learn <label> <text>
+                                            :unlearn <label> <text>
+                                          to update the model online
+   r1p1 --batch <train> [input|-] [opts]  bulk classification
+        --threads N   worker threads (default: hardware concurrency)
+        --chunk N     emails per parallel chunk (default: 4096)
+        --mbox        input is an mbox archive (or one .eml file) of raw
+                      RFC 822 messages instead of one email per line;
+                      files are mmap'd and MIME-decoded in place
+        --learn-mbox <label> <file>
+                      after training, also learn every message of a raw
+                      mbox/.eml file under the given label (repeatable)
+        --domains F   domain trie built by --build-trie; URL and sender
+                      hosts are checked against it during tokenization
+        --dedup N     front the model with a near-duplicate (SimHash/LSH)
+                      cache of the last N distinct emails; output gains
+                      campaign id and cache hit (H) / miss (M) columns
+        --dedup-distance D
+                      max differing SimHash bits for a hit (0-3, default 3)
+        --quantize    score with int16 likelihood tables (AVX2 when
+                      available) instead of doubles; the double tables
+                      are freed, so the model is read-only
+        --early-exit  stop scoring an email once its remaining tokens
+                      cannot change the label (same labels as full
+                      scoring); output gains a P(phishing) bound column,
+                      [low,high] when it stopped early and - otherwise
+        --ngrams N    also use word n-grams up to order N (2-3 useful)
+        --ngram-min C keep only n-grams seen at least C times in the
+                      training file, counted in a count-min sketch
+        --ngram-sketch-mb M
+                      sketch size in MiB (default 16)
+        --normalize   see through obfuscation: drop zero-width characters
+                      and add homoglyph/leetspeak skeleton tokens, so
+                      "p@yp4l" also counts as "paypal"
+        --slow-us U   log messages slower than U microseconds (default
+                      10000) with size and per-stage timings
+        --slow-sample K
+                      keep only every K-th slow message (default 1)
+                      The summary on stderr ends with per-stage timings
+                      (parse, tokenize, lookup, score), vocabulary hit
+                      rate, token/latency histograms and the slow log;
+                      build with -DR1P1_STATS=0 to compile them out.
+   r1p1 --models <input|-> <model|train>... [--threads N] [--chunk N]
+        [--mbox] [--domains F] [--compare]
+                      classify with several models at once (tenant, global,
+                      shadow, ...): each email is tokenized and each token
+                      hashed once against a vocabulary shared by all nb
+                      models, and one pass sums every model's score. Output
+                      is the index, then label and P(phishing) per model.
+                      The models must share n-gram order and --normalize.
+                      --compare also runs each model's own classify() and
+                      reports disagreements and the speedup
+   r1p1 --quantize-report <train> <heldout>
+                      compare int16 and double scoring on a labelled
+                      held-out file: accuracy delta, drift, speed, and
+                      resident and on-disk model size before and after
+   r1p1 --early-exit-report <train> <heldout> [--repeat R]
+                      score a labelled (ideally long-email) file fully and
+                      with --early-exit: label agreement, tokens skipped
+                      and per-email latency of both
+   r1p1 --train <train> <model> [--domains F] [--learn-mbox <label> <file>]...
+        [--engine nb|cnb|lr] [--threads N] [--epochs E] [--l2 X]
+        [--ngrams N] [--ngram-min C] [--ngram-sketch-mb M] [--normalize]
+        [--memory-mb M] [--spill-dir D] [--quantize]
+                      train once and save a model file; every mode that
+                      takes <train> also accepts a saved model. Engines:
+                      nb  multinomial Naive Bayes (default, updatable)
+                      cnb complement Naive Bayes
+                      lr  L2-regularized logistic regression, Hogwild SGD
+                      N-gram order and --normalize are stored in the
+                      model file.
+                      --memory-mb bounds nb training memory: counts are
+                      spilled as sorted runs to --spill-dir (default: the
+                      system temp dir) and k-way merged into the model
+   r1p1 --bench-engines <train> <heldout> [--threads N]
+                      compare training time, scoring throughput and
+                      accuracy of all engines on one tokenized corpus
+   r1p1 --eval <labelled> [--folds K] [--threads N] [--seed S] [--domains F]
+        [--ngrams N] [--ngram-min C] [--ngram-sketch-mb M] [--normalize]
+                      stratified k-fold cross-validation of the nb model
+                      (default 5 folds, run in parallel over one shared
+                      tokenized corpus); prints JSON with per-fold and
+                      pooled confusion matrices, precision/recall/F1,
+                      ROC-AUC (null when a fold has one class),
+                      tokenize/train/score ns per token and emails/sec,
+                      and peak RSS. With --ngram-min each fold prunes
+                      n-grams with a sketch of its own training documents
+   r1p1 --daemon <socket> <model> [--threads N] [--domains F] [--quantize]
+        [--early-exit] [--slow-us U] [--slow-sample K]
+                      (Linux) serve classification requests on a Unix
+                      socket with epoll and a worker pool; SIGHUP or an
+                      'L' request swaps in a reloaded model without
+                      dropping requests in flight; an 'S' request returns
+                      server and classifier statistics
+   r1p1 --bench-client <socket> <emails> [--concurrency C] [--requests N] [--raw]
+        [--stats]
+                      (Linux) load the daemon and report p50/p99/p999;
+                      <emails> has one email per line, or with --raw is
+                      an mbox/.eml archive sent one message at a time;
+                      --stats also prints the daemon's statistics
+   r1p1 --build-trie <out> [--brands F] [--allow F]
+                      compile brand and allowlist domain files (one domain
+                      per line) into a flat, mmap-able trie file
+
  This is a teaching/demo implementation, not production-grade.
 */
 
-struct NaiveBayesEmailClassifier {
-    // Vocabulary: word -> index
-    unordered_map<string, int> vocab;
-    // Class labels
-    enum ClassLabel { PHISHING = 0, LEGIT = 1 };
-    // Prior probabilities P(class)
-    double prior[2] = {0.0, 0.0};
-    // Likelihoods: P(word | class) stored as log-probabilities
-    vector<vector<double>> log_likelihood; // [class][wordIndex]
-    // Total word counts per class (for smoothing)
-    int total_words[2] = {0, 0};
-    // Class document counts
-    int doc_count[2] = {0, 0};
-    bool trained = false;
+// ---------- Thread pool ----------
+// Fixed set of workers that run parallelFor() jobs. The calling thread
+// joins in, so a pool of N threads uses N + 1 cores while a job runs.
+// Each job is its own immutable object that workers take a reference to
+// under the lock, so a worker waking after its job finished only drains
+// an exhausted index range and never sees the next job half-published.
+struct ThreadPool {
+    struct Job {
+        function<void(size_t)> fn;
+        size_t size = 0;
+        atomic<size_t> next_index{0};
+    };
+
+    vector<thread> workers;
+    mutex mtx;
+    condition_variable cv_job, cv_done;
+    shared_ptr<Job> job;
+    int active = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    explicit ThreadPool(unsigned n) {
+        for (unsigned i = 0; i < n; ++i) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> lk(mtx);
+            stopping = true;
+        }
+        cv_job.notify_all();
+        for (thread &t : workers) t.join();
+    }
+
+    static void drain(Job &j) {
+        size_t i;
+        while ((i = j.next_index.fetch_add(1)) < j.size) j.fn(i);
+    }
+
+    void workerLoop() {
+        uint64_t seen = 0;
+        while (true) {
+            unique_lock<mutex> lk(mtx);
+            cv_job.wait(lk, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            shared_ptr<Job> current = job;
+            if (!current) continue;
+            ++active;
+            lk.unlock();
+            drain(*current);
+            lk.lock();
+            if (--active == 0) cv_done.notify_all();
+        }
+    }
+
+    // Runs fn(0..n-1) across the pool and returns when all calls finished.
+    void parallelFor(size_t n, function<void(size_t)> fn) {
+        if (n == 0) return;
+        auto current = make_shared<Job>();
+        current->fn = std::move(fn);
+        current->size = n;
+        {
+            lock_guard<mutex> lk(mtx);
+            job = current;
+            ++generation;
+        }
+        cv_job.notify_all();
+        drain(*current);
+        unique_lock<mutex> lk(mtx);
+        cv_done.wait(lk, [&] { return active == 0; });
+        job.reset(); // fn may capture the caller's locals
+    }
+};
+
+// ---------- File mapping ----------
+// Read-only view of a whole file. On POSIX systems the file is mmap'd so
+// messages can be scanned in place; elsewhere it is read into memory.
+struct MappedFile {
+    const char *data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    string buffer;
+#endif
+
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (data && size) munmap(const_cast<char *>(data), size);
+#endif
+    }
+
+    bool open(const string &path) {
+#ifdef _WIN32
+        ifstream in(path, ios::binary);
+        if (!in.is_open()) return false;
+        buffer.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        data = buffer.data();
+        size = buffer.size();
+        return true;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            return false;
+        }
+        size = static_cast<size_t>(st.st_size);
+        if (size > 0) {
+            void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                close(fd);
+                size = 0;
+                return false;
+            }
+            madvise(p, size, MADV_SEQUENTIAL);
+            data = static_cast<const char *>(p);
+        } else {
+            data = "";
+        }
+        close(fd);
+        return true;
+#endif
+    }
+
+    // Lets the kernel drop pages before offset `upto` from our resident
+    // set; they stay in the page cache. Keeps RSS flat on huge archives.
+    void release(size_t upto) {
+#ifndef _WIN32
+        static const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        upto -= upto % page;
+        if (data && upto > 0) madvise(const_cast<char *>(data), upto, MADV_DONTNEED);
+#else
+        (void)upto;
+#endif
+    }
+
+    string_view view() const { return string_view(data, size); }
+};
+
+// ---------- MIME parsing ----------
+// Decoded view of one RFC 822 / MIME message: the header fields we use as
+// features plus the text of every text/plain and text/html part, with
+// transfer encodings undone and HTML tags stripped.
+struct MimeMessage {
+    string subject, from, reply_to;
+    string body;
+    // HTML anchors as (href, visible text)
+    vector<pair<string, string>> links;
+
+    void clear() {
+        subject.clear();
+        from.clear();
+        reply_to.clear();
+        body.clear();
+        links.clear();
+    }
+};
+
+bool startsWithNoCase(string_view s, string_view prefix) {
+    if (s.size() < prefix.size()) return false;
+    for (size_t i = 0; i < prefix.size(); ++i) {
+        if (tolower(static_cast<unsigned char>(s[i])) !=
+            tolower(static_cast<unsigned char>(prefix[i]))) return false;
+    }
+    return true;
+}
+
+string_view trimView(string_view s) {
+    while (!s.empty() && isspace(static_cast<unsigned char>(s.front()))) s.remove_prefix(1);
+    while (!s.empty() && isspace(static_cast<unsigned char>(s.back()))) s.remove_suffix(1);
+    return s;
+}
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Appends the base64 decoding of in to out, skipping line breaks and junk.
+void decodeBase64(string_view in, string &out) {
+    static const auto table = [] {
+        array<int8_t, 256> t{};
+        t.fill(-1);
+        const char *alphabet =
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        for (int i = 0; i < 64; ++i) t[static_cast<unsigned char>(alphabet[i])] = i;
+        return t;
+    }();
+    uint32_t acc = 0;
+    int bits = 0;
+    for (char ch : in) {
+        int v = table[static_cast<unsigned char>(ch)];
+        if (v < 0) {
+            if (ch == '=') break;
+            continue;
+        }
+        acc = (acc << 6) | v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out.push_back(static_cast<char>((acc >> bits) & 0xFF));
+        }
+    }
+}
+
+// Appends the quoted-printable decoding of in to out. In headers
+// (RFC 2047 "Q" encoding) an underscore stands for a space.
+void decodeQuotedPrintable(string_view in, string &out, bool header = false) {
+    for (size_t i = 0; i < in.size(); ++i) {
+        char c = in[i];
+        if (c == '=' && i + 1 < in.size()) {
+            if (in[i + 1] == '\n') { i += 1; continue; }                     // soft break
+            if (in[i + 1] == '\r' && i + 2 < in.size() && in[i + 2] == '\n') { i += 2; continue; }
+            int hi = i + 2 < in.size() ? hexValue(in[i + 1]) : -1;
+            int lo = hi >= 0 ? hexValue(in[i + 2]) : -1;
+            if (lo >= 0) {
+                out.push_back(static_cast<char>(hi * 16 + lo));
+                i += 2;
+                continue;
+            }
+        }
+        out.push_back(header && c == '_' ? ' ' : c);
+    }
+}
+
+// Value of an attribute such as href="..." inside one HTML tag.
+string_view htmlAttribute(string_view tag, string_view name) {
+    size_t pos = 0;
+    while ((pos = tag.find('=', pos)) != string_view::npos) {
+        string_view before = trimView(tag.substr(0, pos));
+        size_t eq = pos++;
+        if (before.size() < name.size() ||
+            !startsWithNoCase(before.substr(before.size() - name.size()), name)) continue;
+        string_view rest = trimView(tag.substr(eq + 1));
+        if (rest.empty()) return rest;
+        if (rest[0] == '"' || rest[0] == '\'') {
+            size_t close = rest.find(rest[0], 1);
+            return rest.substr(1, close == string_view::npos ? string_view::npos : close - 1);
+        }
+        return rest.substr(0, rest.find_first_of(" \t\r\n>"));
+    }
+    return string_view();
+}
+
+// Appends the visible text of an HTML fragment to out: tags become
+// spaces, <script>/<style> contents are dropped and the common entities
+// are decoded. Anchors are collected into links when it is given.
+void appendHtmlText(string_view html, string &out,
+                    vector<pair<string, string>> *links = nullptr) {
+    size_t i = 0;
+    size_t anchor_start = string::npos; // out offset where the open <a> text began
+    while (i < html.size()) {
+        char c = html[i];
+        if (c == '<') {
+            string_view rest = html.substr(i + 1);
+            size_t close = html.find('>', i);
+            if (close == string_view::npos) break;
+            if (links && rest.size() > 1 && (rest[0] == 'a' || rest[0] == 'A') &&
+                isspace(static_cast<unsigned char>(rest[1]))) {
+                string_view href = htmlAttribute(html.substr(i + 2, close - i - 2), "href");
+                links->emplace_back(string(href), string());
+                anchor_start = out.size();
+            } else if (links && startsWithNoCase(rest, "/a>") && anchor_start != string::npos &&
+                       !links->empty()) {
+                links->back().second = out.substr(anchor_start);
+                anchor_start = string::npos;
+            }
+            for (string_view skip : {string_view("script"), string_view("style")}) {
+                if (startsWithNoCase(rest, skip)) {
+                    // Jump past the matching closing tag
+                    size_t j = close;
+                    while ((j = html.find("</", j)) != string_view::npos &&
+                           !startsWithNoCase(html.substr(j + 2), skip)) j += 2;
+                    close = j == string_view::npos ? html.size() - 1 : html.find('>', j);
+                    if (close == string_view::npos) close = html.size() - 1;
+                    break;
+                }
+            }
+            out.push_back(' ');
+            i = close + 1;
+        } else if (c == '&') {
+            size_t semi = html.find(';', i);
+            string_view ent = semi != string_view::npos && semi - i <= 8
+                ? html.substr(i + 1, semi - i - 1) : string_view();
+            char decoded = 0;
+            if (ent == "amp") decoded = '&';
+            else if (ent == "lt") decoded = '<';
+            else if (ent == "gt") decoded = '>';
+            else if (ent == "quot") decoded = '"';
+            else if (ent == "apos") decoded = '\'';
+            else if (ent == "nbsp") decoded = ' ';
+            else if (ent.size() > 1 && ent[0] == '#') {
+                long code = ent[1] == 'x' || ent[1] == 'X'
+                    ? strtol(string(ent.substr(2)).c_str(), nullptr, 16)
+                    : strtol(string(ent.substr(1)).c_str(), nullptr, 10);
+                decoded = code > 0 && code < 128 ? static_cast<char>(code) : ' ';
+            }
+            if (decoded) {
+                out.push_back(decoded);
+                i = semi + 1;
+            } else {
+                out.push_back(c);
+                ++i;
+            }
+        } else {
+            out.push_back(c);
+            ++i;
+        }
+    }
+}
+
+// Decodes RFC 2047 encoded words ("=?utf-8?B?...?=") in a header value.
+void decodeHeaderValue(string_view in, string &out) {
+    out.clear();
+    size_t i = 0;
+    while (i < in.size()) {
+        size_t start = in.find("=?", i);
+        if (start == string_view::npos) break;
+        size_t q1 = in.find('?', start + 2);
+        size_t q2 = q1 == string_view::npos ? q1 : in.find('?', q1 + 1);
+        size_t end = q2 == string_view::npos ? q2 : in.find("?=", q2 + 1);
+        if (end == string_view::npos) break;
+        // Whitespace between two adjacent encoded words is not displayed
+        string_view gap = in.substr(i, start - i);
+        if (i == 0 || !trimView(gap).empty()) out.append(gap);
+        char enc = static_cast<char>(toupper(static_cast<unsigned char>(in[q1 + 1])));
+        string_view payload = in.substr(q2 + 1, end - q2 - 1);
+        if (enc == 'B') decodeBase64(payload, out);
+        else decodeQuotedPrintable(payload, out, true);
+        i = end + 2;
+    }
+    out.append(in.substr(min(i, in.size())));
+}
+
+// Streaming MIME decoder. Structure is walked with string_views into the
+// raw message, so nothing is copied until a text part is decoded, and the
+// scratch buffers are reused from one message to the next.
+struct MimeParser {
+    static constexpr int max_depth = 8;
+    string decoded; // transfer-decoding scratch
+    string header;  // unfolded header value scratch
+
+    void parse(string_view raw, MimeMessage &msg) {
+        msg.clear();
+        parseEntity(raw, msg, 0);
+    }
+
+private:
+    struct EntityInfo {
+        string_view content_type, encoding;
+    };
+
+    // Splits an entity into headers and body at the first blank line.
+    static void splitHeaders(string_view entity, string_view &headers, string_view &body) {
+        size_t pos = 0;
+        while (pos < entity.size()) {
+            size_t eol = entity.find('\n', pos);
+            if (eol == string_view::npos) break;
+            string_view line = entity.substr(pos, eol - pos);
+            if (line.empty() || line == "\r") {
+                headers = entity.substr(0, pos);
+                body = entity.substr(eol + 1);
+                return;
+            }
+            pos = eol + 1;
+        }
+        headers = entity;
+        body = string_view();
+    }
+
+    // Walks the header block, calling f(name, raw value) per field. Folded
+    // continuation lines stay inside the raw value.
+    template <class F>
+    static void forEachHeader(string_view headers, F f) {
+        size_t pos = 0;
+        while (pos < headers.size()) {
+            size_t end = pos;
+            do {
+                end = headers.find('\n', end);
+                if (end == string_view::npos) end = headers.size();
+                else ++end;
+            } while (end < headers.size() && (headers[end] == ' ' || headers[end] == '\t'));
+            string_view field = headers.substr(pos, end - pos);
+            size_t colon = field.find(':');
+            if (colon != string_view::npos) {
+                f(trimView(field.substr(0, colon)), trimView(field.substr(colon + 1)));
+            }
+            pos = end;
+        }
+    }
+
+    void unfold(string_view value, string &out) {
+        out.clear();
+        for (char c : value) out.push_back(c == '\r' || c == '\n' || c == '\t' ? ' ' : c);
+    }
+
+    // Value of a Content-Type parameter such as boundary="abc".
+    static string_view param(string_view content_type, string_view name) {
+        size_t pos = 0;
+        while ((pos = content_type.find(';', pos)) != string_view::npos) {
+            string_view rest = trimView(content_type.substr(++pos));
+            if (!startsWithNoCase(rest, name)) continue;
+            rest = trimView(rest.substr(name.size()));
+            if (rest.empty() || rest[0] != '=') continue;
+            rest = trimView(rest.substr(1));
+            if (!rest.empty() && rest[0] == '"') {
+                size_t close = rest.find('"', 1);
+                return rest.substr(1, close == string_view::npos ? string_view::npos : close - 1);
+            }
+            size_t stop = rest.find_first_of("; \t\r\n");
+            return rest.substr(0, stop);
+        }
+        return string_view();
+    }
+
+    void parseEntity(string_view entity, MimeMessage &msg, int depth) {
+        string_view headers, body;
+        splitHeaders(entity, headers, body);
+        EntityInfo info;
+        forEachHeader(headers, [&](string_view name, string_view value) {
+            auto keep = [&](string &dst) {
+                if (!dst.empty() || depth > 0) return;
+                unfold(value, header);
+                decodeHeaderValue(header, dst);
+            };
+            if (startsWithNoCase(name, "content-type") && name.size() == 12) info.content_type = value;
+            else if (startsWithNoCase(name, "content-transfer-encoding")) info.encoding = value;
+            else if (startsWithNoCase(name, "subject") && name.size() == 7) keep(msg.subject);
+            else if (startsWithNoCase(name, "from") && name.size() == 4) keep(msg.from);
+            else if (startsWithNoCase(name, "reply-to") && name.size() == 8) keep(msg.reply_to);
+        });
+
+        string_view type = trimView(info.content_type.substr(0, info.content_type.find(';')));
+        if (startsWithNoCase(type, "multipart/")) {
+            if (depth >= max_depth) return;
+            string_view boundary = param(info.content_type, "boundary");
+            if (!boundary.empty()) parseMultipart(body, boundary, msg, depth);
+            return;
+        }
+        if (startsWithNoCase(type, "message/rfc822")) {
+            if (depth < max_depth) parseEntity(body, msg, depth + 1);
+            return;
+        }
+        bool html = startsWithNoCase(type, "text/html");
+        if (!type.empty() && !html && !startsWithNoCase(type, "text/plain")) return; // attachment
+
+        string_view text = body;
+        string_view enc = trimView(info.encoding);
+        if (startsWithNoCase(enc, "base64") || startsWithNoCase(enc, "quoted-printable")) {
+            decoded.clear();
+            if (enc[0] == 'b' || enc[0] == 'B') decodeBase64(body, decoded);
+            else decodeQuotedPrintable(body, decoded);
+            text = decoded;
+        }
+        if (!msg.body.empty()) msg.body.push_back('\n');
+        if (html) appendHtmlText(text, msg.body, &msg.links);
+        else msg.body.append(text);
+    }
+
+    void parseMultipart(string_view body, string_view boundary, MimeMessage &msg, int depth) {
+        string delim = "--";
+        delim.append(boundary);
+        size_t pos = 0;
+        size_t part_start = string_view::npos;
+        while (pos < body.size()) {
+            size_t eol = body.find('\n', pos);
+            size_t next = eol == string_view::npos ? body.size() : eol + 1;
+            string_view line = body.substr(pos, next - pos);
+            if (line.compare(0, delim.size(), delim) == 0) {
+                if (part_start != string_view::npos) {
+                    // The line break before the delimiter belongs to it
+                    size_t end = pos > part_start ? pos - 1 : pos;
+                    if (end > part_start && body[end - 1] == '\r') --end;
+                    parseEntity(body.substr(part_start, end - part_start), msg, depth + 1);
+                }
+                if (line.compare(delim.size(), 2, "--") == 0) return; // closing delimiter
+                part_start = next;
+            }
+            pos = next;
+        }
+        if (part_start != string_view::npos && part_start < body.size()) {
+            parseEntity(body.substr(part_start), msg, depth + 1);
+        }
+    }
+};
+
+// ---------- URL and domain features ----------
+// Confusable code points folded to the ASCII letter they imitate, sorted
+// by code point for binary search.
+constexpr pair<uint32_t, char> confusables[] = {
+    {0x00E0, 'a'}, {0x00E1, 'a'}, {0x00E2, 'a'}, {0x00E3, 'a'}, {0x00E4, 'a'},
+    {0x00E5, 'a'}, {0x00E7, 'c'}, {0x00E8, 'e'}, {0x00E9, 'e'}, {0x00EA, 'e'},
+    {0x00EB, 'e'}, {0x00EC, 'i'}, {0x00ED, 'i'}, {0x00EE, 'i'}, {0x00EF, 'i'},
+    {0x00F1, 'n'}, {0x00F2, 'o'}, {0x00F3, 'o'}, {0x00F4, 'o'}, {0x00F5, 'o'},
+    {0x00F6, 'o'}, {0x00F8, 'o'}, {0x00F9, 'u'}, {0x00FA, 'u'}, {0x00FB, 'u'},
+    {0x00FC, 'u'}, {0x00FD, 'y'}, {0x00FF, 'y'}, {0x0131, 'i'}, {0x0261, 'g'},
+    {0x03B1, 'a'}, {0x03B5, 'e'}, {0x03B9, 'i'}, {0x03BA, 'k'}, {0x03BD, 'v'},
+    {0x03BF, 'o'}, {0x03C1, 'p'}, {0x03C4, 't'}, {0x03C5, 'u'}, {0x0410, 'a'},
+    {0x0412, 'b'}, {0x0415, 'e'}, {0x041A, 'k'}, {0x041C, 'm'}, {0x041D, 'h'},
+    {0x041E, 'o'}, {0x0420, 'p'}, {0x0421, 'c'}, {0x0422, 't'}, {0x0425, 'x'},
+    {0x0430, 'a'}, {0x0435, 'e'}, {0x043E, 'o'}, {0x0440, 'p'}, {0x0441, 'c'},
+    {0x0443, 'y'}, {0x0445, 'x'}, {0x0455, 's'}, {0x0456, 'i'}, {0x0458, 'j'},
+    {0x04BB, 'h'}, {0x04CF, 'l'}, {0x0501, 'd'}, {0x2113, 'l'},
+};
+
+// ASCII leetspeak digits and look-alike symbols folded to the letter they
+// stand for (0 = not folded), for host and word skeletons alike. '1'
+// maps to itself: it reads as both 'i' and 'l', and each skeleton
+// resolves that its own way.
+constexpr array<char, 128> makeLeetFold() {
+    array<char, 128> f{};
+    const char pairs[][2] = {{'0', 'o'}, {'1', '1'}, {'3', 'e'}, {'4', 'a'}, {'5', 's'}, {'7', 't'},
+                             {'8', 'b'}, {'@', 'a'}, {'$', 's'}, {'!', 'i'}, {'|', 'l'}};
+    for (const auto &p : pairs) f[static_cast<int>(p[0])] = p[1];
+    return f;
+}
+
+constexpr array<char, 128> leet_fold = makeLeetFold();
+
+// Decodes one UTF-8 sequence at s[i], advancing i. Invalid bytes decode
+// as U+FFFD so a malformed host still yields a stable skeleton.
+uint32_t decodeUtf8(string_view s, size_t &i) {
+    unsigned char c = static_cast<unsigned char>(s[i++]);
+    if (c < 0x80) return c;
+    int extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : -1;
+    if (extra < 0 || i + extra > s.size()) return 0xFFFD;
+    uint32_t cp = c & (0x3F >> extra);
+    for (int k = 0; k < extra; ++k) {
+        unsigned char cc = static_cast<unsigned char>(s[i]);
+        if ((cc & 0xC0) != 0x80) return 0xFFFD;
+        cp = (cp << 6) | (cc & 0x3F);
+        ++i;
+    }
+    return cp;
+}
+
+// RFC 3492 decoder for the part of an IDN label after "xn--".
+bool punycodeDecode(string_view in, vector<uint32_t> &out) {
+    const uint32_t base = 36, tmin = 1, tmax = 26, skew = 38, damp = 700;
+    out.clear();
+    size_t basic = in.rfind('-');
+    size_t pos = 0;
+    if (basic != string_view::npos) {
+        for (size_t k = 0; k < basic; ++k) out.push_back(static_cast<unsigned char>(in[k]));
+        pos = basic + 1;
+    }
+    auto adapt = [&](uint64_t delta, uint64_t points, bool first) {
+        delta = first ? delta / damp : delta / 2;
+        delta += delta / points;
+        uint64_t k = 0;
+        while (delta > ((base - tmin) * tmax) / 2) {
+            delta /= base - tmin;
+            k += base;
+        }
+        return k + (base - tmin + 1) * delta / (delta + skew);
+    };
+    uint64_t n = 128, i = 0, bias = 72;
+    while (pos < in.size()) {
+        uint64_t old_i = i, w = 1;
+        for (uint64_t k = base;; k += base) {
+            if (pos >= in.size()) return false;
+            char c = in[pos++];
+            uint64_t digit = isdigit(static_cast<unsigned char>(c)) ? c - '0' + 26
+                             : isalpha(static_cast<unsigned char>(c))
+                                 ? tolower(static_cast<unsigned char>(c)) - 'a' : base;
+            if (digit >= base) return false;
+            i += digit * w;
+            uint64_t t = k <= bias ? tmin : k >= bias + tmax ? tmax : k - bias;
+            if (digit < t) break;
+            w *= base - t;
+            if (w > 0xFFFFFFFFull || i > 0xFFFFFFFFull) return false;
+        }
+        uint64_t points = out.size() + 1;
+        bias = adapt(i - old_i, points, old_i == 0);
+        n += i / points;
+        i %= points;
+        if (n > 0x10FFFF) return false;
+        out.insert(out.begin() + i, static_cast<uint32_t>(n));
+        ++i;
+    }
+    return true;
+}
+
+// Visual skeleton of a host name: IDN labels are decoded, homoglyphs and
+// leetspeak (leet_fold) are folded to Latin letters, 'i' and '1' both
+// become 'l', hyphens are dropped and "rn"/"vv" become "m"/"w", so
+// "pаypa1-secure.com" and "paypalsecure.com" share a skeleton.
+string hostSkeleton(string_view host) {
+    string out;
+    out.reserve(host.size());
+    vector<uint32_t> cps;
+    size_t start = 0;
+    while (start <= host.size()) {
+        size_t dot = host.find('.', start);
+        if (dot == string_view::npos) dot = host.size();
+        string_view label = host.substr(start, dot - start);
+        cps.clear();
+        if (!(startsWithNoCase(label, "xn--") && punycodeDecode(label.substr(4), cps))) {
+            cps.clear();
+            for (size_t i = 0; i < label.size();) cps.push_back(decodeUtf8(label, i));
+        }
+        size_t label_start = out.size();
+        for (uint32_t cp : cps) {
+            char c;
+            if (cp < 0x80) {
+                c = static_cast<char>(tolower(static_cast<int>(cp)));
+                if (c == '-' || c == '_') continue;
+                if (leet_fold[cp]) c = leet_fold[cp];
+            } else {
+                auto it = lower_bound(begin(confusables), end(confusables), cp,
+                                      [](const pair<uint32_t, char> &e, uint32_t v) { return e.first < v; });
+                c = it != end(confusables) && it->first == cp ? it->second : '?';
+            }
+            if (c == 'i' || c == '1') c = 'l';
+            size_t n = out.size();
+            if (n > label_start && out[n - 1] == 'r' && c == 'n') out[n - 1] = 'm';
+            else if (n > label_start && out[n - 1] == 'v' && c == 'v') out[n - 1] = 'w';
+            else out.push_back(c);
+        }
+        if (dot == host.size()) break;
+        out.push_back('.');
+        start = dot + 1;
+    }
+    return out;
+}
+
+// Reversed-label trie over domain names in one flat, position-independent
+// buffer, so a compiled trie file can be mmap'd and used in place:
+//
+//   header { "DTRIE01\0", node_count, pool_size }
+//   node[node_count]   16 bytes each, breadth-first, children contiguous
+//                      and sorted by label for binary search
+//   pool[pool_size]    label bytes
+//
+// "www.paypal.com" is found by walking com -> paypal -> www, so the whole
+// lookup touches a few nodes near the root plus their label bytes.
+struct DomainTrie {
+    enum : uint32_t {
+        ALLOW = 1,       // domain (or parent) is on the allowlist or owned by a brand
+        BRAND = 2,       // skeleton of a brand domain
+        BRAND_LABEL = 4, // skeleton of a brand's main label, stored under "*"
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t node_count;
+        uint32_t pool_size;
+    };
+
+    struct Node {
+        uint32_t first_child;
+        uint32_t child_count;
+        uint32_t label_off;
+        uint32_t meta; // flags in the low 8 bits, label length above
+
+        uint32_t flags() const { return meta & 0xFF; }
+        uint32_t labelLen() const { return meta >> 8; }
+    };
+
+    const Node *nodes = nullptr;
+    const char *pool = nullptr;
+    uint32_t node_count = 0, pool_size = 0;
+    unique_ptr<MappedFile> file;
+    vector<char> owned;
+
+    bool empty() const { return node_count == 0; }
+
+    void clear() {
+        nodes = nullptr;
+        pool = nullptr;
+        node_count = pool_size = 0;
+    }
+
+    // Checks every node once here so lookups can index without bounds
+    // checks: children lie after their parent and inside the node array,
+    // and labels inside the pool. A buffer that fails leaves the trie empty.
+    bool attach(const char *data, size_t size) {
+        clear();
+        Header h;
+        if (size < sizeof(Header)) return false;
+        memcpy(&h, data, sizeof(Header));
+        if (memcmp(h.magic, "DTRIE01", 8) != 0 ||
+            size < sizeof(Header) + (size_t)h.node_count * sizeof(Node) + h.pool_size) return false;
+        auto *n = reinterpret_cast<const Node *>(data + sizeof(Header));
+        for (uint32_t i = 0; i < h.node_count; ++i) {
+            if (n[i].child_count &&
+                (n[i].first_child <= i || (uint64_t)n[i].first_child + n[i].child_count > h.node_count)) {
+                return false;
+            }
+            if ((uint64_t)n[i].label_off + n[i].labelLen() > h.pool_size) return false;
+        }
+        nodes = n;
+        pool = data + sizeof(Header) + (size_t)h.node_count * sizeof(Node);
+        node_count = h.node_count;
+        pool_size = h.pool_size;
+        return true;
+    }
+
+    bool load(const string &path) {
+        file.reset(new MappedFile);
+        if (!file->open(path) || !attach(file->data, file->size)) {
+            cerr << "Invalid domain trie file: " << path << endl;
+            clear();
+            file.reset();
+            return false;
+        }
+        return true;
+    }
+
+    bool adopt(vector<char> bytes) {
+        owned = std::move(bytes);
+        if (attach(owned.data(), owned.size())) return true;
+        owned.clear();
+        return false;
+    }
+
+    // Same nodes and labels, wherever each copy lives.
+    bool sameAs(const DomainTrie &o) const {
+        return node_count == o.node_count && pool_size == o.pool_size &&
+               (empty() || (memcmp(nodes, o.nodes, (size_t)node_count * sizeof(Node)) == 0 &&
+                            memcmp(pool, o.pool, pool_size) == 0));
+    }
+
+    int findChild(const Node &n, string_view label) const {
+        int lo = (int)n.first_child, hi = lo + n.child_count;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            string_view l(pool + nodes[mid].label_off, nodes[mid].labelLen());
+            int cmp = l.compare(label);
+            if (cmp == 0) return mid;
+            if (cmp < 0) lo = mid + 1;
+            else hi = mid;
+        }
+        return -1;
+    }
+
+    // Walks host from its last label and ORs the flags met on the way, so
+    // a flag on "paypal.com" also covers "login.paypal.com". matched is the
+    // leftmost label of the deepest flagged suffix (the brand label).
+    uint32_t lookup(string_view host, string_view *matched = nullptr) const {
+        if (empty()) return 0;
+        uint32_t flags = 0;
+        int node = 0;
+        size_t end = host.size();
+        while (end > 0) {
+            size_t dot = host.rfind('.', end - 1);
+            size_t start = dot == string_view::npos ? 0 : dot + 1;
+            string_view label = host.substr(start, end - start);
+            node = findChild(nodes[node], label);
+            if (node < 0) break;
+            if (nodes[node].flags()) {
+                flags |= nodes[node].flags();
+                if (matched) *matched = label;
+            }
+            if (dot == string_view::npos) break;
+            end = dot;
+        }
+        return flags;
+    }
+
+    // Flags of a brand main label ("paypal") stored under the "*" root.
+    uint32_t lookupLabel(string_view label) const {
+        if (empty()) return 0;
+        int star = findChild(nodes[0], "*");
+        if (star < 0) return 0;
+        int node = findChild(nodes[star], label);
+        return node < 0 ? 0 : nodes[node].flags();
+    }
+};
+
+struct DomainTrieBuilder {
+    struct Node {
+        map<string, int> children;
+        uint32_t flags = 0;
+    };
+    vector<Node> nodes = vector<Node>(1);
+
+    void insert(string_view domain, uint32_t flags) {
+        int node = 0;
+        size_t end = domain.size();
+        while (end > 0) {
+            size_t dot = domain.rfind('.', end - 1);
+            size_t start = dot == string_view::npos ? 0 : dot + 1;
+            string label(domain.substr(start, end - start));
+            auto it = nodes[node].children.find(label);
+            int child;
+            if (it == nodes[node].children.end()) {
+                child = (int)nodes.size();
+                nodes[node].children.emplace(label, child);
+                nodes.emplace_back();
+            } else {
+                child = it->second;
+            }
+            node = child;
+            if (dot == string_view::npos) break;
+            end = dot;
+        }
+        if (node != 0) nodes[node].flags |= flags;
+    }
+
+    // An allowlisted domain, or a brand domain: allowed as written, and its
+    // skeleton plus main label are remembered for lookalike detection.
+    void addAllowed(string_view domain) { insert(domain, DomainTrie::ALLOW); }
+
+    void addBrand(string_view domain) {
+        insert(domain, DomainTrie::ALLOW);
+        string skel = hostSkeleton(domain);
+        insert(skel, DomainTrie::BRAND);
+        size_t last = skel.rfind('.');
+        if (last != string::npos && last > 0) {
+            size_t prev = skel.rfind('.', last - 1);
+            string label = skel.substr(prev == string::npos ? 0 : prev + 1,
+                                       last - (prev == string::npos ? 0 : prev + 1));
+            insert(label + ".*", DomainTrie::BRAND_LABEL);
+        }
+    }
+
+    // Reads one domain per line; '#' starts a comment.
+    bool addFile(const string &path, bool brand) {
+        ifstream in(path);
+        if (!in.is_open()) {
+            cerr << "Cannot open domain list: " << path << endl;
+            return false;
+        }
+        string line;
+        while (getline(in, line)) {
+            line = line.substr(0, line.find('#'));
+            string_view d = trimView(line);
+            if (d.empty()) continue;
+            string lower(d);
+            for (char &c : lower) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+            if (brand) addBrand(lower);
+            else addAllowed(lower);
+        }
+        return true;
+    }
+
+    // Lays the tree out breadth-first into the flat format of DomainTrie.
+    vector<char> build() const {
+        vector<int> order{0};
+        vector<uint32_t> position(nodes.size(), 0);
+        for (size_t i = 0; i < order.size(); ++i) {
+            for (const auto &kv : nodes[order[i]].children) {
+                position[kv.second] = (uint32_t)order.size();
+                order.push_back(kv.second);
+            }
+        }
+        string pool;
+        vector<DomainTrie::Node> flat(order.size(), DomainTrie::Node{0, 0, 0, 0});
+        for (size_t i = 0; i < order.size(); ++i) {
+            const Node &n = nodes[order[i]];
+            DomainTrie::Node &f = flat[i];
+            f.meta |= n.flags & 0xFF;
+            f.child_count = (uint32_t)n.children.size();
+            f.first_child = n.children.empty() ? 0 : position[n.children.begin()->second];
+            for (const auto &kv : n.children) {
+                DomainTrie::Node &c = flat[position[kv.second]];
+                c.label_off = (uint32_t)pool.size();
+                c.meta |= (uint32_t)kv.first.size() << 8;
+                pool += kv.first;
+            }
+        }
+
+        DomainTrie::Header h;
+        memcpy(h.magic, "DTRIE01", 8);
+        h.node_count = (uint32_t)flat.size();
+        h.pool_size = (uint32_t)pool.size();
+        vector<char> bytes(sizeof(h) + flat.size() * sizeof(DomainTrie::Node) + pool.size());
+        memcpy(bytes.data(), &h, sizeof(h));
+        memcpy(bytes.data() + sizeof(h), flat.data(), flat.size() * sizeof(DomainTrie::Node));
+        memcpy(bytes.data() + sizeof(h) + flat.size() * sizeof(DomainTrie::Node), pool.data(), pool.size());
+        return bytes;
+    }
+};
+
+// Host part of a URL ("https://user@Host.example:8080/x" -> "host.example"),
+// lowercased into out. Returns false for an empty host.
+bool urlHost(string_view url, string &out) {
+    size_t scheme = url.find("://");
+    if (scheme != string_view::npos) url.remove_prefix(scheme + 3);
+    size_t end = url.find_first_of("/?#\\\"'<> \t\r\n");
+    string_view authority = url.substr(0, end);
+    size_t at = authority.rfind('@');
+    if (at != string_view::npos) authority.remove_prefix(at + 1);
+    if (!authority.empty() && authority[0] == '[') {
+        authority = authority.substr(0, authority.find(']') + 1);          // IPv6 literal
+    } else {
+        authority = authority.substr(0, authority.find(':'));
+    }
+    while (!authority.empty() && (authority.back() == '.' || authority.back() == ',' ||
+                                  authority.back() == ')' || authority.back() == ';')) {
+        authority.remove_suffix(1);
+    }
+    out.clear();
+    for (char c : authority) out.push_back(static_cast<char>(tolower(static_cast<unsigned char>(c))));
+    return !out.empty() && out.find('.') != string::npos;
+}
+
+// Calls f(host) for every http(s):// or www. URL found in free text.
+template <class F>
+void forEachUrlHost(string_view text, F f) {
+    string host;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t scheme = text.find("://", pos);
+        size_t www = text.find("www.", pos);
+        size_t hit = min(scheme, www);
+        if (hit == string_view::npos) break;
+        size_t start;
+        if (hit == scheme) {
+            start = scheme;
+            while (start > 0 && isalpha(static_cast<unsigned char>(text[start - 1]))) --start;
+            if (!startsWithNoCase(text.substr(start), "http")) {
+                pos = scheme + 3;
+                continue;
+            }
+        } else {
+            if (www > 0 && (isalnum(static_cast<unsigned char>(text[www - 1])) || text[www - 1] == '/' ||
+                            text[www - 1] == '.')) {
+                pos = www + 4;
+                continue;
+            }
+            start = www;
+        }
+        size_t end = text.find_first_of(" \t\r\n\"'<>", start);
+        if (end == string_view::npos) end = text.size();
+        if (urlHost(text.substr(start, end - start), host)) f(host);
+        pos = end;
+    }
+}
+
+// Domain part of an address header ("PayPal <x@PayPal.com>" -> "paypal.com").
+bool addressDomain(string_view header, string &out) {
+    size_t at = header.rfind('@');
+    if (at == string_view::npos) return false;
+    string_view rest = header.substr(at + 1);
+    rest = rest.substr(0, rest.find_first_of("> \t\r\n;,\""));
+    out.clear();
+    for (char c : rest) out.push_back(static_cast<char>(tolower(static_cast<unsigned char>(c))));
+    return !out.empty();
+}
+
+// Registered domain approximated as the last two labels.
+string_view baseDomain(string_view host) {
+    size_t last = host.rfind('.');
+    if (last == string_view::npos || last == 0) return host;
+    size_t prev = host.rfind('.', last - 1);
+    return prev == string_view::npos ? host : host.substr(prev + 1);
+}
+
+// ---------- Obfuscation normalization ----------
+// Word splitting that sees through "p@yp4l", a Cyrillic "е" in "vеrify"
+// or zero-width joiners. One pass decodes UTF-8, drops invisible code
+// points without splitting the word, and builds the raw word alongside a
+// skeleton in which homoglyphs, fullwidth forms and leetspeak are folded
+// to Latin letters.
+
+enum : uint8_t { CH_SEPARATOR = 0, CH_LETTER, CH_DIGIT, CH_SYMBOL };
+
+// Byte class and skeleton letter for every ASCII character, folded by
+// leet_fold; the '1' it keeps marks the ambiguous i/l reading (see
+// splitNormalized). Symbols only count inside a word.
+struct AsciiFold {
+    uint8_t cls[128];
+    char skel[128];
+};
+
+constexpr AsciiFold makeAsciiFold() {
+    AsciiFold f{};
+    for (int c = 'a'; c <= 'z'; ++c) {
+        f.cls[c] = f.cls[c - 32] = CH_LETTER;
+        f.skel[c] = f.skel[c - 32] = static_cast<char>(c);
+    }
+    for (int c = '0'; c <= '9'; ++c) {
+        f.cls[c] = CH_DIGIT;
+        f.skel[c] = leet_fold[c] ? leet_fold[c] : static_cast<char>(c);
+    }
+    for (int c = 0; c < 128; ++c) {
+        if (leet_fold[c] && f.cls[c] == CH_SEPARATOR) {
+            f.cls[c] = CH_SYMBOL;
+            f.skel[c] = leet_fold[c];
+        }
+    }
+    return f;
+}
+
+constexpr AsciiFold ascii_fold = makeAsciiFold();
+
+// Default-ignorable code points (zero-width space/joiners, bidi controls,
+// soft hyphen, variation selectors, BOM, ...), sorted ranges.
+constexpr pair<uint32_t, uint32_t> invisible_ranges[] = {
+    {0x00AD, 0x00AD}, {0x034F, 0x034F}, {0x061C, 0x061C}, {0x115F, 0x1160},
+    {0x17B4, 0x17B5}, {0x180B, 0x180F}, {0x200B, 0x200F}, {0x202A, 0x202E},
+    {0x2060, 0x206F}, {0x3164, 0x3164}, {0xFE00, 0xFE0F}, {0xFEFF, 0xFEFF},
+    {0xFFA0, 0xFFA0},
+};
+
+constexpr bool isSortedTable() {
+    for (size_t i = 1; i < size(confusables); ++i) {
+        if (confusables[i - 1].first >= confusables[i].first) return false;
+    }
+    for (size_t i = 1; i < size(invisible_ranges); ++i) {
+        if (invisible_ranges[i - 1].second >= invisible_ranges[i].first) return false;
+    }
+    return true;
+}
+static_assert(isSortedTable(), "lookup tables must be sorted for binary search");
+
+bool isInvisible(uint32_t cp) {
+    auto it = upper_bound(begin(invisible_ranges), end(invisible_ranges), cp,
+                          [](uint32_t v, const pair<uint32_t, uint32_t> &r) { return v < r.first; });
+    return it != begin(invisible_ranges) && cp <= prev(it)->second;
+}
+
+// Class and skeleton letter of a non-ASCII code point. Latin, Greek and
+// Cyrillic letters are word characters; only confusables get a Latin
+// skeleton letter (0 = keep the code point as is).
+uint8_t classifyCodePoint(uint32_t cp, char &skel) {
+    skel = 0;
+    if (cp >= 0xFF01 && cp <= 0xFF5E) { // fullwidth ASCII
+        uint32_t ascii = cp - 0xFEE0;
+        skel = ascii_fold.skel[ascii];
+        return ascii_fold.cls[ascii] == CH_SYMBOL ? (uint8_t)CH_SEPARATOR : ascii_fold.cls[ascii];
+    }
+    auto it = lower_bound(begin(confusables), end(confusables), cp,
+                          [](const pair<uint32_t, char> &e, uint32_t v) { return e.first < v; });
+    if (it != end(confusables) && it->first == cp) {
+        skel = it->second;
+        return CH_LETTER;
+    }
+    bool letter = (cp >= 0x00C0 && cp <= 0x024F && cp != 0x00D7 && cp != 0x00F7) ||
+                  (cp >= 0x0370 && cp <= 0x03FF) || (cp >= 0x0400 && cp <= 0x052F);
+    return letter ? CH_LETTER : CH_SEPARATOR;
+}
+
+void appendUtf8(string &out, uint32_t cp) {
+    if (cp < 0x80) {
+        out.push_back(static_cast<char>(cp));
+    } else if (cp < 0x800) {
+        out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    } else {
+        out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    }
+}
+
+// Appends the lowercase raw words of text to words. When a word's
+// skeleton differs from it, the skeleton goes to skeletons as well; a
+// '1' in it yields both the 'i' and the 'l' reading.
+void splitNormalized(string_view text, vector<string> &words, vector<string> &skeletons) {
+    string raw, skel;
+    bool has_letter = false;
+    auto flush = [&] {
+        if (!raw.empty()) {
+            if (has_letter) {
+                if (skel.find('1') == string::npos) {
+                    if (skel != raw) skeletons.push_back(skel);
+                } else {
+                    string as_l = skel;
+                    replace(skel.begin(), skel.end(), '1', 'i');
+                    replace(as_l.begin(), as_l.end(), '1', 'l');
+                    if (skel != raw) skeletons.push_back(skel);
+                    if (as_l != raw) skeletons.push_back(as_l);
+                }
+            }
+            words.push_back(raw);
+        }
+        raw.clear();
+        skel.clear();
+        has_letter = false;
+    };
+    for (size_t i = 0; i < text.size();) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c < 0x80) {
+            uint8_t cls = ascii_fold.cls[c];
+            if (cls == CH_SYMBOL) {
+                // Only between word characters: "p@ypal" but not "a @ b".
+                unsigned char next = i + 1 < text.size() ? static_cast<unsigned char>(text[i + 1]) : 0;
+                bool inner = !raw.empty() && (next >= 0x80 || ascii_fold.cls[next] == CH_LETTER ||
+                                              ascii_fold.cls[next] == CH_DIGIT);
+                cls = inner ? CH_LETTER : CH_SEPARATOR;
+            }
+            ++i;
+            if (cls == CH_SEPARATOR) {
+                flush();
+                continue;
+            }
+            raw.push_back(ascii_fold.cls[c] == CH_LETTER ? ascii_fold.skel[c] : static_cast<char>(c));
+            skel.push_back(ascii_fold.skel[c]);
+            has_letter |= ascii_fold.cls[c] == CH_LETTER;
+            continue;
+        }
+        size_t start = i;
+        uint32_t cp = decodeUtf8(text, i);
+        if (isInvisible(cp)) continue;
+        char folded;
+        uint8_t cls = classifyCodePoint(cp, folded);
+        if (cls == CH_SEPARATOR) {
+            flush();
+            continue;
+        }
+        raw.append(text.data() + start, i - start);
+        if (folded) skel.push_back(folded);
+        else appendUtf8(skel, cp);
+        has_letter |= cls == CH_LETTER;
+    }
+    flush();
+}
+
+// ---------- Quantized scoring kernels ----------
+// Each word's two class log-likelihood terms are packed as int16 fixed
+// point into one 32-bit cell: class 0 in the low half, class 1 in the
+// high half. The kernels sum the cells named by ids into sums[0..1].
+void accumulatePackedScalar(const uint32_t *packed, const int32_t *ids, size_t n, int64_t sums[2]) {
+    int64_t s0 = 0, s1 = 0;
+    for (size_t j = 0; j < n; ++j) {
+        uint32_t cell = packed[ids[j]];
+        s0 += static_cast<int16_t>(cell & 0xFFFF);
+        s1 += static_cast<int16_t>(cell >> 16);
+    }
+    sums[0] += s0;
+    sums[1] += s1;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define R1P1_HAVE_AVX2_KERNEL 1
+// Gathers eight cells per step and widens both halves into int32 lanes.
+// A lane gains at most 32767 per step, so the lanes are flushed to the
+// 64-bit totals every 32768 steps, long before they could overflow.
+__attribute__((target("avx2")))
+void accumulatePackedAvx2(const uint32_t *packed, const int32_t *ids, size_t n, int64_t sums[2]) {
+    size_t j = 0;
+    while (n - j >= 8) {
+        __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+        size_t stop = j + min<size_t>((n - j) / 8, 32768) * 8;
+        for (; j < stop; j += 8) {
+            __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ids + j));
+            __m256i cell = _mm256_i32gather_epi32(reinterpret_cast<const int *>(packed), idx, 4);
+            acc0 = _mm256_add_epi32(acc0, _mm256_srai_epi32(_mm256_slli_epi32(cell, 16), 16));
+            acc1 = _mm256_add_epi32(acc1, _mm256_srai_epi32(cell, 16));
+        }
+        alignas(32) int32_t lanes0[8], lanes1[8];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(lanes0), acc0);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(lanes1), acc1);
+        for (int k = 0; k < 8; ++k) {
+            sums[0] += lanes0[k];
+            sums[1] += lanes1[k];
+        }
+    }
+    accumulatePackedScalar(packed, ids + j, n - j, sums);
+}
+#endif
+
+// Picks the widest kernel the running CPU supports, once.
+void accumulatePacked(const uint32_t *packed, const int32_t *ids, size_t n, int64_t sums[2]) {
+#ifdef R1P1_HAVE_AVX2_KERNEL
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2) {
+        accumulatePackedAvx2(packed, ids, n, sums);
+        return;
+    }
+#endif
+    accumulatePackedScalar(packed, ids, n, sums);
+}
+
+// ---------- String hashing ----------
+// FNV-1a over the bytes, then the murmur3 finalizer so the high bits mix
+// as well as the low ones. Used for SimHash votes, the n-gram sketch and
+// the intern table; none of them is persisted.
+inline uint64_t hashBytes(string_view s) {
+    uint64_t h = 1469598103934665603ull;
+    for (char c : s) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ull;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+// ---------- Near-duplicate cache ----------
+// 64-bit SimHash of a token list: every token votes +1/-1 on each bit of
+// its hash, and the signature keeps the sign of each vote. Messages that
+// share most of their tokens land a few bits apart.
+uint64_t simHash(const vector<string> &tokens) {
+    int votes[64] = {0};
+    for (const string &tok : tokens) {
+        uint64_t h = hashBytes(tok);
+        for (int b = 0; b < 64; ++b) votes[b] += (h >> b) & 1 ? 1 : -1;
+    }
+    uint64_t sig = 0;
+    for (int b = 0; b < 64; ++b) {
+        if (votes[b] > 0) sig |= 1ull << b;
+    }
+    return sig;
+}
+
+// Bounded LSH index over the SimHash signatures of recently classified
+// emails. The signature is cut into four 16-bit bands; two signatures
+// within 3 bits of each other agree on at least one band, so probing the
+// four band buckets finds every such neighbour. Entries live in a ring
+// that overwrites the oldest, and each bucket remembers only its latest
+// few entries, so memory is fixed at construction.
+struct NearDuplicateCache {
+    static constexpr int bands = 4;
+    static constexpr int bucket_slots = 4;
+
+    struct Entry {
+        uint64_t sig = 0;
+        uint64_t campaign = 0; // id of the first email of this cluster
+        int label = 0;
+        double p_phishing = 0.0;
+        bool used = false;
+    };
+
+    struct Hit {
+        int label;
+        double p_phishing;
+        uint64_t campaign;
+    };
+
+    int max_distance;
+    size_t min_tokens;
+    uint32_t verify_every; // rescore every Nth hit to measure false matches
+    vector<Entry> ring;
+    size_t next_slot = 0;
+    uint64_t next_campaign = 1;
+    vector<array<uint32_t, bucket_slots>> buckets; // [band * 65536 + value]
+    vector<uint8_t> bucket_next;
+    mutable shared_mutex mtx;
+
+    // Instrumentation
+    atomic<uint64_t> lookups{0}, hits{0}, skipped{0}, inserts{0}, evictions{0};
+    atomic<uint64_t> verified{0}, false_matches{0};
+
+    NearDuplicateCache(size_t capacity, int maxDistance = 3, size_t minTokens = 8,
+                       uint32_t verifyEvery = 64)
+        : max_distance(min(maxDistance, 3)), min_tokens(minTokens),
+          verify_every(max(1u, verifyEvery)), ring(max<size_t>(capacity, 1)),
+          buckets(bands * 65536), bucket_next(bands * 65536, 0) {
+        for (auto &b : buckets) b.fill(UINT32_MAX);
+    }
+
+    static uint32_t bandValue(uint64_t sig, int band) {
+        return (uint32_t)((sig >> (16 * band)) & 0xFFFF);
+    }
+
+    // Closest cached signature within max_distance, if any.
+    bool lookup(uint64_t sig, size_t tokenCount, Hit &hit) {
+        if (tokenCount < min_tokens) {
+            skipped++;
+            return false;
+        }
+        lookups++;
+        shared_lock<shared_mutex> lk(mtx);
+        int best = max_distance + 1;
+        for (int b = 0; b < bands; ++b) {
+            for (uint32_t slot : buckets[b * 65536 + bandValue(sig, b)]) {
+                if (slot == UINT32_MAX) continue;
+                const Entry &e = ring[slot];
+                // Slots can be stale after eviction; the band must still match
+                if (!e.used || bandValue(e.sig, b) != bandValue(sig, b)) continue;
+                int d = __builtin_popcountll(e.sig ^ sig);
+                if (d < best) {
+                    best = d;
+                    hit = {e.label, e.p_phishing, e.campaign};
+                }
+            }
+        }
+        if (best > max_distance) return false;
+        hits++;
+        return true;
+    }
+
+    // True when this hit should also be scored in full to check it.
+    bool shouldVerify() const { return hits % verify_every == 0; }
+
+    void recordVerification(bool labelsMatch) {
+        verified++;
+        if (!labelsMatch) false_matches++;
+    }
+
+    // Adds a freshly scored email; campaign is the cluster it joined, or 0
+    // to start a new one. Returns the campaign id it was filed under.
+    uint64_t insert(uint64_t sig, size_t tokenCount, int label, double p, uint64_t campaign) {
+        if (tokenCount < min_tokens) return 0;
+        unique_lock<shared_mutex> lk(mtx);
+        uint32_t slot = (uint32_t)next_slot;
+        next_slot = (next_slot + 1) % ring.size();
+        Entry &e = ring[slot];
+        if (e.used) evictions++;
+        if (campaign == 0) campaign = next_campaign++;
+        e = {sig, campaign, label, p, true};
+        for (int b = 0; b < bands; ++b) {
+            size_t idx = b * 65536 + bandValue(sig, b);
+            buckets[idx][bucket_next[idx]] = slot;
+            bucket_next[idx] = (bucket_next[idx] + 1) % bucket_slots;
+        }
+        inserts++;
+        return campaign;
+    }
+
+    // Drops every entry, e.g. after the model changed under the cache.
+    void clear() {
+        unique_lock<shared_mutex> lk(mtx);
+        for (Entry &e : ring) e.used = false;
+        for (auto &b : buckets) b.fill(UINT32_MAX);
+    }
+
+    void report(ostream &os) const {
+        uint64_t l = lookups, h = hits, v = verified, f = false_matches;
+        os << fixed << setprecision(2)
+           << "Near-duplicate cache: " << h << "/" << l << " hits ("
+           << (l ? 100.0 * h / l : 0.0) << "%), " << skipped << " too short, "
+           << inserts << " inserts, " << evictions << " evictions, "
+           << next_campaign - 1 << " campaigns\n"
+           << "False matches: " << f << "/" << v << " verified hits ("
+           << (v ? 100.0 * f / v : 0.0) << "%)\n";
+    }
+};
+
+// ---------- N-gram pruning sketch ----------
+// Count-min sketch with conservative update: every key bumps only the
+// rows that hold its current minimum, which keeps over-estimates from
+// colliding keys much lower than plain count-min. Estimates never
+// under-count, so pruning with it never drops a frequent n-gram; it may
+// admit a few rare ones. Memory is fixed by width * depth.
+struct CountMinSketch {
+    static constexpr int depth = 4;
+    size_t width_mask;
+    vector<uint32_t> cells; // [row * width + col]
+    uint64_t additions = 0;
+
+    // Width is rounded down to a power of two so columns are a mask away.
+    explicit CountMinSketch(size_t bytes) {
+        size_t width = 1;
+        while (width * 2 * depth * sizeof(uint32_t) <= max<size_t>(bytes, depth * sizeof(uint32_t) * 2)) {
+            width *= 2;
+        }
+        width_mask = width - 1;
+        cells.assign(width * depth, 0);
+    }
+
+    size_t bytes() const { return cells.size() * sizeof(uint32_t); }
+
+    // Row r uses column h1 + r * h2 (Kirsch-Mitzenmacher double hashing).
+    size_t column(uint64_t h, int r) const {
+        uint64_t h2 = (h >> 32) | 1;
+        return r * (width_mask + 1) + ((h + r * h2) & width_mask);
+    }
+
+    void add(string_view key) {
+        uint64_t h = hashBytes(key);
+        uint32_t low = UINT32_MAX;
+        for (int r = 0; r < depth; ++r) low = min(low, cells[column(h, r)]);
+        if (low == UINT32_MAX) return;
+        for (int r = 0; r < depth; ++r) {
+            uint32_t &cell = cells[column(h, r)];
+            if (cell == low) cell = low + 1;
+        }
+        additions++;
+    }
+
+    uint32_t estimate(string_view key) const {
+        uint64_t h = hashBytes(key);
+        uint32_t low = UINT32_MAX;
+        for (int r = 0; r < depth; ++r) low = min(low, cells[column(h, r)]);
+        return low;
+    }
+};
+
+// ---------- Model files and linear engines ----------
+// Every model file starts with "R1P1MDL\0", u32 version, u32 engine id,
+// (from version 2) u32 n-gram order and (from version 3) u32 tokenizer
+// feature flags; the rest is the engine's own payload (native byte order).
+constexpr char model_magic[8] = {'R', '1', 'P', '1', 'M', 'D', 'L', '\0'};
+constexpr uint32_t model_version = 3;
+enum FeatureFlags : uint32_t {
+    FEATURE_NORMALIZE = 1, // obfuscation skeleton tokens
+};
+enum EngineId : uint32_t {
+    ENGINE_MULTINOMIAL_NB = 0,
+    ENGINE_COMPLEMENT_NB = 1,
+    ENGINE_LOGISTIC = 2,
+    ENGINE_QUANTIZED_NB = 3, // int16 NB tables written by a frozen classifier
+};
+
+template <class T>
+void writePod(ostream &out, const T &v) {
+    out.write(reinterpret_cast<const char *>(&v), sizeof(T));
+}
+
+template <class T>
+bool readPod(istream &in, T &v) {
+    return (bool)in.read(reinterpret_cast<char *>(&v), sizeof(T));
+}
+
+// Stream buffer that only counts the bytes written through it, to size a
+// file image without building it.
+struct CountingBuf : streambuf {
+    size_t count = 0;
+    int overflow(int c) override {
+        if (c != traits_type::eof()) count++;
+        return traits_type::not_eof(c);
+    }
+    streamsize xsputn(const char *, streamsize n) override {
+        count += (size_t)n;
+        return n;
+    }
+};
+
+// Bytes between the read position and the end of a seekable stream;
+// UINT64_MAX when the stream cannot tell.
+uint64_t bytesLeft(istream &in) {
+    streampos here = in.tellg();
+    if (here < 0 || !in.seekg(0, ios::end)) return UINT64_MAX;
+    streampos end = in.tellg();
+    in.seekg(here);
+    return end < here ? 0 : (uint64_t)(end - here);
+}
+
+void writeWord(ostream &out, string_view w) {
+    writePod(out, (uint32_t)w.size());
+    out.write(w.data(), w.size());
+}
+
+bool readWord(istream &in, string &w) {
+    uint32_t len;
+    if (!readPod(in, len) || len > (1u << 20)) return false;
+    w.resize(len);
+    return len == 0 || (bool)in.read(&w[0], len);
+}
+
+void writeModelHeader(ostream &out, uint32_t engine, uint32_t ngram, uint32_t features) {
+    out.write(model_magic, 8);
+    writePod(out, model_version);
+    writePod(out, engine);
+    writePod(out, ngram);
+    writePod(out, features);
+}
+
+bool readModelHeader(istream &in, uint32_t &engine, uint32_t &ngram, uint32_t &features) {
+    char magic[8];
+    uint32_t version;
+    if (!in.read(magic, 8) || memcmp(magic, model_magic, 8) != 0 || !readPod(in, version) ||
+        version < 1 || version > model_version || !readPod(in, engine)) return false;
+    ngram = 1;
+    features = 0;
+    if (version >= 2 && !(readPod(in, ngram) && ngram >= 1 && ngram <= 8)) return false;
+    return version < 3 || (readPod(in, features) && features <= FEATURE_NORMALIZE);
+}
+
+// A scoring back end that can stand in for the classifier's built-in
+// multinomial NB counts. Engines receive the token lists the classifier
+// produces, so tokenization, MIME decoding and domain features are shared.
+// Labels follow ClassLabel: 0 = phishing, 1 = legit.
+struct EmailEngine {
+    virtual ~EmailEngine() = default;
+    virtual const char *name() const = 0;
+    virtual uint32_t engineId() const = 0;
+    virtual void fit(const vector<pair<int, vector<string>>> &docs, unsigned threads) = 0;
+    // Log-odds of phishing over legit; > 0 means phishing.
+    virtual double margin(const vector<string> &tokens) const = 0;
+    // P(phishing) derived from the margin.
+    virtual double probability(double m) const { return 1.0 / (1.0 + exp(-m)); }
+    virtual void write(ostream &out) const = 0;
+    virtual bool read(istream &in) = 0;
+};
+
+using SparseVector = vector<pair<int32_t, float>>; // (feature id, value), ids ascending
+
+// Feature ids for the linear engines. A document becomes log(1 + tf) per
+// distinct known token, scaled to unit L2 norm.
+struct SparseVocab {
+    unordered_map<string, int32_t> index;
+    vector<string> words; // id -> word, for writing model files
+
+    int32_t size() const { return (int32_t)words.size(); }
+
+    int32_t add(const string &w) {
+        auto it = index.find(w);
+        if (it != index.end()) return it->second;
+        int32_t id = size();
+        index.emplace(w, id);
+        words.push_back(w);
+        return id;
+    }
+
+    // Training-time variant that gives unseen tokens new ids.
+    void vectorizeAdding(const vector<string> &tokens, SparseVector &out) {
+        thread_local vector<int32_t> ids;
+        ids.clear();
+        for (const string &w : tokens) ids.push_back(add(w));
+        finish(ids, out);
+    }
+
+    void vectorize(const vector<string> &tokens, SparseVector &out) const {
+        thread_local vector<int32_t> ids;
+        ids.clear();
+        for (const string &w : tokens) {
+            auto it = index.find(w);
+            if (it != index.end()) ids.push_back(it->second);
+        }
+        finish(ids, out);
+    }
+
+    static void finish(vector<int32_t> &ids, SparseVector &out) {
+        out.clear();
+        sort(ids.begin(), ids.end());
+        double norm = 0.0;
+        for (size_t i = 0; i < ids.size();) {
+            size_t j = i;
+            while (j < ids.size() && ids[j] == ids[i]) ++j;
+            float v = (float)log1p((double)(j - i));
+            out.emplace_back(ids[i], v);
+            norm += (double)v * v;
+            i = j;
+        }
+        if (norm > 0.0) {
+            float inv = (float)(1.0 / sqrt(norm));
+            for (auto &f : out) f.second *= inv;
+        }
+    }
+
+    void write(ostream &out) const {
+        // Words sorted, then the id each had, so tables stay in id order
+        vector<int32_t> order(words.size());
+        iota(order.begin(), order.end(), 0);
+        sort(order.begin(), order.end(), [&](int32_t a, int32_t b) { return words[a] < words[b]; });
+        writePod(out, (uint32_t)order.size());
+        for (int32_t id : order) writeWord(out, words[id]);
+        for (int32_t id : order) writePod(out, id);
+    }
+
+    // Returns the stored id of each word, in file order.
+    bool read(istream &in, vector<int32_t> &stored_ids) {
+        uint32_t V;
+        if (!readPod(in, V)) return false;
+        string w;
+        for (uint32_t i = 0; i < V; ++i) {
+            if (!readWord(in, w)) return false;
+            add(w);
+        }
+        stored_ids.resize(V);
+        for (uint32_t i = 0; i < V; ++i) {
+            if (!readPod(in, stored_ids[i])) return false;
+        }
+        return true;
+    }
+};
+
+// Sparse-dense dot product. Ids are ascending, and the weight of the
+// feature eight entries ahead is prefetched so the random reads into a
+// large weight table overlap instead of stalling one by one.
+inline double sparseDot(const float *w, const SparseVector &x) {
+    double s = 0.0;
+    size_t n = x.size();
+    for (size_t j = 0; j < n; ++j) {
+#ifdef __GNUC__
+        if (j + 8 < n) __builtin_prefetch(w + x[j + 8].first);
+#endif
+        s += (double)w[x[j].first] * x[j].second;
+    }
+    return s;
+}
+
+// Reorders a per-id table read from a model file back to local ids.
+template <class T>
+bool remapTable(const vector<int32_t> &stored_ids, vector<T> &table) {
+    vector<T> local(table.size());
+    for (size_t i = 0; i < stored_ids.size(); ++i) {
+        if (stored_ids[i] < 0 || (size_t)stored_ids[i] >= table.size()) return false;
+        local[i] = table[stored_ids[i]];
+    }
+    table.swap(local);
+    return true;
+}
+
+// Complement Naive Bayes (Rennie et al. 2003): each class is described by
+// the word statistics of all *other* classes, which keeps a small class
+// from being drowned out on imbalanced data. Documents use the shared
+// log(1 + tf), L2-normalized features, and each class's complement
+// weights are normalized to unit L1 norm. The raw margin is then Platt
+// scaled (sigmoid(a * margin + b), fitted on the training set), which
+// also moves the decision threshold to where the classes actually split.
+struct ComplementNBEngine : EmailEngine {
+    SparseVocab vocab;
+    vector<float> weight[2]; // [class][id], lower sum = more likely
+    double platt_a = 1.0, platt_b = 0.0;
+
+    const char *name() const override { return "complement-nb"; }
+    uint32_t engineId() const override { return ENGINE_COMPLEMENT_NB; }
+
+    void fit(const vector<pair<int, vector<string>>> &docs, unsigned) override {
+        vector<SparseVector> xs(docs.size());
+        for (size_t i = 0; i < docs.size(); ++i) vocab.vectorizeAdding(docs[i].second, xs[i]);
+        size_t V = vocab.size();
+        const double alpha = 1.0;
+        vector<double> mass[2] = {vector<double>(V, 0.0), vector<double>(V, 0.0)};
+        double total[2] = {0.0, 0.0};
+        for (size_t i = 0; i < docs.size(); ++i) {
+            int c = docs[i].first;
+            for (const auto &f : xs[i]) {
+                mass[c][f.first] += f.second;
+                total[c] += f.second;
+            }
+        }
+        for (int c = 0; c < 2; ++c) {
+            int other = 1 - c;
+            vector<double> w(V);
+            double l1 = 0.0;
+            for (size_t i = 0; i < V; ++i) {
+                w[i] = log((mass[other][i] + alpha) / (total[other] + alpha * V));
+                l1 += fabs(w[i]);
+            }
+            weight[c].resize(V);
+            for (size_t i = 0; i < V; ++i) weight[c][i] = (float)(l1 > 0 ? w[i] / l1 : 0.0);
+        }
+
+        // Platt scaling by Newton's method on (a, b)
+        vector<double> ms(docs.size());
+        for (size_t i = 0; i < docs.size(); ++i) ms[i] = rawMargin(xs[i]);
+        platt_a = 1.0;
+        platt_b = 0.0;
+        for (int iter = 0; iter < 50; ++iter) {
+            double ga = 0, gb = 0, haa = 1e-9, hab = 0, hbb = 1e-9;
+            for (size_t i = 0; i < docs.size(); ++i) {
+                double y = docs[i].first == 0 ? 1.0 : 0.0;
+                double p = 1.0 / (1.0 + exp(-(platt_a * ms[i] + platt_b)));
+                double r = p - y, v = p * (1 - p);
+                ga += r * ms[i];
+                gb += r;
+                haa += v * ms[i] * ms[i];
+                hab += v * ms[i];
+                hbb += v;
+            }
+            double det = haa * hbb - hab * hab;
+            if (fabs(det) < 1e-300) break;
+            double da = (hbb * ga - hab * gb) / det, db = (haa * gb - hab * ga) / det;
+            platt_a -= da;
+            platt_b -= db;
+            if (fabs(da) < 1e-6 * max(1.0, fabs(platt_a)) && fabs(db) < 1e-6) break;
+        }
+    }
+
+    double rawMargin(const SparseVector &x) const {
+        // Complement scores: the phishing class wins when its complement
+        // (the legit statistics) fits the email worse.
+        return sparseDot(weight[1].data(), x) - sparseDot(weight[0].data(), x);
+    }
+
+    double margin(const vector<string> &tokens) const override {
+        thread_local SparseVector x;
+        vocab.vectorize(tokens, x);
+        return platt_a * rawMargin(x) + platt_b;
+    }
+
+    void write(ostream &out) const override {
+        vocab.write(out);
+        writePod(out, platt_a);
+        writePod(out, platt_b);
+        for (int c = 0; c < 2; ++c) out.write(reinterpret_cast<const char *>(weight[c].data()),
+                                              weight[c].size() * sizeof(float));
+    }
+
+    bool read(istream &in) override {
+        vector<int32_t> ids;
+        if (!vocab.read(in, ids) || !readPod(in, platt_a) || !readPod(in, platt_b)) return false;
+        for (int c = 0; c < 2; ++c) {
+            weight[c].resize(ids.size());
+            if (!in.read(reinterpret_cast<char *>(weight[c].data()), weight[c].size() * sizeof(float)) ||
+                !remapTable(ids, weight[c])) return false;
+        }
+        return true;
+    }
+};
+
+// L2-regularized logistic regression trained with Hogwild-style SGD:
+// worker threads walk disjoint slices of a shuffled order and update one
+// shared weight vector without locks. Sparse documents rarely touch the
+// same weights, so lost updates are rare and harmless. Weights are
+// relaxed atomics during training, so the races are benign by the
+// language rules too. Classes are weighted inversely to their frequency.
+struct LogisticRegressionEngine : EmailEngine {
+    SparseVocab vocab;
+    vector<float> weight; // [id]
+    float bias = 0.0f;
+    int epochs = 5;
+    double learning_rate = 0.5;
+    double l2 = 1e-6;
+
+    const char *name() const override { return "logistic-regression"; }
+    uint32_t engineId() const override { return ENGINE_LOGISTIC; }
+
+    void fit(const vector<pair<int, vector<string>>> &docs, unsigned threads) override {
+        vector<SparseVector> xs(docs.size());
+        for (size_t i = 0; i < docs.size(); ++i) vocab.vectorizeAdding(docs[i].second, xs[i]);
+        size_t V = vocab.size();
+        size_t n_pos = 0;
+        for (const auto &d : docs) n_pos += d.first == 0;
+        size_t n_neg = docs.size() - n_pos;
+        double class_weight[2] = {n_pos ? docs.size() / (2.0 * n_pos) : 1.0,
+                                  n_neg ? docs.size() / (2.0 * n_neg) : 1.0};
+
+        unique_ptr<atomic<float>[]> w(new atomic<float>[V]);
+        for (size_t i = 0; i < V; ++i) w[i].store(0.0f, memory_order_relaxed);
+        atomic<float> b{0.0f};
+        vector<size_t> order(docs.size());
+        iota(order.begin(), order.end(), 0);
+        mt19937_64 rng(42);
+        threads = max(1u, threads);
+
+        for (int epoch = 0; epoch < epochs; ++epoch) {
+            shuffle(order.begin(), order.end(), rng);
+            double lr = learning_rate / (1.0 + epoch);
+            auto work = [&](unsigned t) {
+                for (size_t k = t; k < order.size(); k += threads) {
+                    size_t i = order[k];
+                    const SparseVector &x = xs[i];
+                    double m = b.load(memory_order_relaxed);
+                    for (const auto &f : x) m += (double)w[f.first].load(memory_order_relaxed) * f.second;
+                    double y = docs[i].first == 0 ? 1.0 : 0.0;
+                    double g = (1.0 / (1.0 + exp(-m)) - y) * class_weight[docs[i].first];
+                    // Lazy L2: only the weights this document touches decay
+                    for (const auto &f : x) {
+                        float cur = w[f.first].load(memory_order_relaxed);
+                        w[f.first].store((float)(cur - lr * (g * f.second + l2 * cur)), memory_order_relaxed);
+                    }
+                    b.store((float)(b.load(memory_order_relaxed) - lr * g), memory_order_relaxed);
+                }
+            };
+            vector<thread> pool;
+            for (unsigned t = 1; t < threads; ++t) pool.emplace_back(work, t);
+            work(0);
+            for (thread &th : pool) th.join();
+        }
+
+        weight.resize(V);
+        for (size_t i = 0; i < V; ++i) weight[i] = w[i].load(memory_order_relaxed);
+        bias = b.load();
+    }
+
+    double margin(const vector<string> &tokens) const override {
+        thread_local SparseVector x;
+        vocab.vectorize(tokens, x);
+        return bias + sparseDot(weight.data(), x);
+    }
+
+    void write(ostream &out) const override {
+        vocab.write(out);
+        writePod(out, bias);
+        out.write(reinterpret_cast<const char *>(weight.data()), weight.size() * sizeof(float));
+    }
+
+    bool read(istream &in) override {
+        vector<int32_t> ids;
+        if (!vocab.read(in, ids) || !readPod(in, bias)) return false;
+        weight.resize(ids.size());
+        return in.read(reinterpret_cast<char *>(weight.data()), weight.size() * sizeof(float)) &&
+               remapTable(ids, weight);
+    }
+};
+
+// Engine for an id or a name; nullptr for the built-in multinomial NB.
+unique_ptr<EmailEngine> makeEngine(uint32_t id) {
+    if (id == ENGINE_COMPLEMENT_NB) return unique_ptr<EmailEngine>(new ComplementNBEngine);
+    if (id == ENGINE_LOGISTIC) return unique_ptr<EmailEngine>(new LogisticRegressionEngine);
+    return nullptr;
+}
+
+bool engineIdFromName(const string &name, uint32_t &id) {
+    if (name == "nb" || name == "multinomial-nb") id = ENGINE_MULTINOMIAL_NB;
+    else if (name == "cnb" || name == "complement-nb") id = ENGINE_COMPLEMENT_NB;
+    else if (name == "lr" || name == "logistic-regression") id = ENGINE_LOGISTIC;
+    else return false;
+    return true;
+}
+
+// ---------- Training memory ----------
+// Batch training counts every token of the corpus, so its state is kept
+// out of the general-purpose heap: word bytes go to a bump arena, words
+// are interned to dense ids through one open-addressed table, and counts
+// live in a flat id-indexed array. Tearing it down frees a few large
+// blocks regardless of vocabulary size.
+
+// Peak resident set size of this process in KiB (0 where unavailable).
+long peakRssKiB() {
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+// Build with -DR1P1_ALLOC_STATS to count heap allocations; training then
+// logs how many it made.
+#ifdef R1P1_ALLOC_STATS
+atomic<uint64_t> heap_allocations{0};
+
+// Out of line so the compiler does not pair the inlined malloc/free with
+// new/delete expressions and warn about a mismatch.
+__attribute__((noinline)) void *operator new(size_t n) {
+    heap_allocations.fetch_add(1, memory_order_relaxed);
+    if (void *p = malloc(n ? n : 1)) return p;
+    throw bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void *p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept { free(p); }
+
+uint64_t heapAllocations() { return heap_allocations.load(memory_order_relaxed); }
+#else
+uint64_t heapAllocations() { return 0; }
+#endif
+
+// Bump allocator for word bytes; nothing is freed until the arena is.
+struct Arena {
+    static constexpr size_t block_size = 1u << 20;
+    vector<unique_ptr<char[]>> blocks;
+    char *cursor = nullptr;
+    size_t left = 0;
+    size_t used = 0;
+
+    string_view copy(string_view s) {
+        if (s.size() > left) {
+            size_t size = max(block_size, s.size());
+            blocks.emplace_back(new char[size]);
+            cursor = blocks.back().get();
+            left = size;
+        }
+        memcpy(cursor, s.data(), s.size());
+        string_view stored(cursor, s.size());
+        cursor += s.size();
+        left -= s.size();
+        used += s.size();
+        return stored;
+    }
+
+    size_t blockCount() const { return blocks.size(); }
+};
+
+// Open-addressed (linear probing) word -> id table. Ids are dense and
+// handed out in first-seen order, so they match the vocabulary indices
+// Model::addWord would assign for the same token stream.
+struct InternTable {
+    struct Slot {
+        uint64_t hash;
+        uint32_t id; // empty_id when free
+    };
+    static constexpr uint32_t empty_id = UINT32_MAX;
+
+    vector<Slot> slots;
+    size_t mask;
+    vector<string_view> words; // [id], bytes in arena
+    Arena arena;
+
+    // Starts with room for `expected` words at a load factor of at most
+    // 1/2; intern() doubles the table once the load passes 0.7.
+    explicit InternTable(size_t expected) {
+        size_t capacity = 1024;
+        while (capacity < expected * 2) capacity *= 2;
+        slots.assign(capacity, Slot{0, empty_id});
+        mask = capacity - 1;
+        words.reserve(expected);
+    }
+
+    uint32_t intern(string_view w) {
+        uint64_t h = hashBytes(w);
+        for (size_t i = h & mask;; i = (i + 1) & mask) {
+            Slot &s = slots[i];
+            if (s.id == empty_id) {
+                uint32_t id = (uint32_t)words.size();
+                s = Slot{h, id};
+                words.push_back(arena.copy(w));
+                if (words.size() * 10 > slots.size() * 7) grow();
+                return id;
+            }
+            if (s.hash == h && words[s.id] == w) return s.id;
+        }
+    }
+
+    // Id of w, or empty_id when it was never interned.
+    uint32_t find(string_view w) const {
+        uint64_t h = hashBytes(w);
+        for (size_t i = h & mask;; i = (i + 1) & mask) {
+            const Slot &s = slots[i];
+            if (s.id == empty_id) return empty_id;
+            if (s.hash == h && words[s.id] == w) return s.id;
+        }
+    }
+
+    void grow() {
+        vector<Slot> old(slots.size() * 2, Slot{0, empty_id});
+        old.swap(slots);
+        mask = slots.size() - 1;
+        for (const Slot &s : old) {
+            if (s.id == empty_id) continue;
+            size_t i = s.hash & mask;
+            while (slots[i].id != empty_id) i = (i + 1) & mask;
+            slots[i] = s;
+        }
+    }
+
+    size_t bytes() const {
+        return slots.capacity() * sizeof(Slot) + words.capacity() * sizeof(string_view) +
+               arena.blockCount() * Arena::block_size;
+    }
+};
+
+// Vocabulary size expected for a corpus of `bytes` bytes of text, from
+// Heaps' law V = K * N^beta with typical English values (K = 40,
+// beta = 0.5) and about six bytes per token. It only sizes the tables
+// up front; they still grow if the corpus is richer.
+size_t estimateVocabulary(uint64_t bytes) {
+    double tokens = bytes / 6.0;
+    return (size_t)min(40.0 * sqrt(tokens), 1e8);
+}
+
+// Per-class counts of one training pass over interned words.
+struct TrainingCounts {
+    InternTable table;
+    vector<array<int, 2>> counts; // [id][class]
+    long long total_words[2] = {0, 0};
+    int doc_count[2] = {0, 0};
+
+    explicit TrainingCounts(size_t expectedWords) : table(expectedWords) {
+        counts.reserve(expectedWords);
+    }
+
+    void addDocument(int cls, const vector<string> &tokens) {
+        doc_count[cls]++;
+        for (const string &w : tokens) {
+            uint32_t id = table.intern(w);
+            if (id == counts.size()) counts.push_back({0, 0});
+            counts[id][cls]++;
+            total_words[cls]++;
+        }
+    }
+
+    size_t bytes() const { return table.bytes() + counts.capacity() * sizeof(counts[0]); }
+};
+
+// ---------- External-memory counting ----------
+// Per-class word counts for corpora whose vocabulary does not fit in RAM.
+// Counts gather in a hash table until it passes the memory budget; the
+// table is then sorted and spilled to a run file of
+//   { u32 length, word bytes, i32 count[2] }
+// records (the model file's word layout). merge() k-way merges all runs,
+// and calls back once per distinct word in byte order with summed counts,
+// so the final table can be streamed straight into a model file.
+struct SpillingCounter {
+    // Runs merged at once; more runs are first merged in groups of this
+    // size so the number of open files stays bounded.
+    static constexpr size_t max_fan_in = 64;
+    // Rough heap cost of one table entry beyond the word's characters:
+    // string header, counts, node and bucket pointers.
+    static constexpr size_t entry_overhead = 72;
+
+    size_t budget;
+    filesystem::path dir;
+    unordered_map<string, array<int64_t, 2>> table;
+    size_t table_bytes = 0;
+    vector<filesystem::path> runs;
+    size_t runs_written = 0;
+    uint64_t spilled_bytes = 0;
+    size_t merge_passes = 0;
+
+    SpillingCounter(size_t budgetBytes, const string &spillDir)
+        : budget(max<size_t>(budgetBytes, 1u << 20)),
+          dir(spillDir.empty() ? filesystem::temp_directory_path() : filesystem::path(spillDir)) {}
+
+    ~SpillingCounter() {
+        error_code ec;
+        for (const auto &p : runs) filesystem::remove(p, ec);
+    }
+
+    bool add(const string &w, int cls) {
+        auto it = table.find(w);
+        if (it == table.end()) {
+            it = table.emplace(w, array<int64_t, 2>{0, 0}).first;
+            table_bytes += w.size() + entry_overhead;
+        }
+        it->second[cls]++;
+        return table_bytes < budget || spill();
+    }
+
+    // Buffers are sized from the budget; large sequential reads and
+    // writes keep the spill and merge close to disk bandwidth.
+    size_t bufferBytes(size_t streams) const {
+        return min<size_t>(4u << 20, max<size_t>(64u << 10, budget / (2 * max<size_t>(streams, 1))));
+    }
+
+    filesystem::path nextRunPath() const {
+        static atomic<unsigned> serial{0};
+        string name = "r1p1-run-" + to_string((unsigned long long)chrono::steady_clock::now()
+                                                   .time_since_epoch().count()) +
+                      "-" + to_string(serial++) + ".tmp";
+        return dir / name;
+    }
+
+    bool spill() {
+        if (table.empty()) return true;
+        vector<pair<const string *, const array<int64_t, 2> *>> sorted;
+        sorted.reserve(table.size());
+        for (const auto &e : table) sorted.emplace_back(&e.first, &e.second);
+        sort(sorted.begin(), sorted.end(),
+             [](const auto &a, const auto &b) { return *a.first < *b.first; });
+        filesystem::path path = nextRunPath();
+        vector<char> buffer(bufferBytes(1));
+        ofstream out;
+        out.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+        out.open(path, ios::binary);
+        if (!out.is_open()) {
+            cerr << "Cannot create spill file in " << dir << endl;
+            return false;
+        }
+        runs.push_back(path);
+        runs_written++;
+        for (const auto &e : sorted) {
+            writeWord(out, *e.first);
+            for (int c = 0; c < 2; ++c) writePod(out, (*e.second)[c]);
+        }
+        out.flush();
+        if (!out) {
+            cerr << "Cannot write spill file: " << path << endl;
+            return false;
+        }
+        spilled_bytes += (uint64_t)out.tellp();
+        table = {};
+        table_bytes = 0;
+        return true;
+    }
+
+    // One k-way merge of the given runs; emit sees each word once and
+    // returns false to stop the merge.
+    template <class Emit>
+    bool mergeRuns(const vector<filesystem::path> &inputs, Emit emit) const {
+        struct Source {
+            ifstream in;
+            vector<char> buffer;
+            string word;
+            int64_t count[2];
+            bool next() {
+                return readWord(in, word) && readPod(in, count[0]) && readPod(in, count[1]);
+            }
+        };
+        vector<unique_ptr<Source>> sources;
+        auto later = [&](size_t a, size_t b) { return sources[a]->word > sources[b]->word; };
+        priority_queue<size_t, vector<size_t>, decltype(later)> heap(later);
+        for (const auto &p : inputs) {
+            auto s = make_unique<Source>();
+            s->buffer.resize(bufferBytes(inputs.size()));
+            s->in.rdbuf()->pubsetbuf(s->buffer.data(), s->buffer.size());
+            s->in.open(p, ios::binary);
+            if (!s->in.is_open()) {
+                cerr << "Cannot read spill file: " << p << endl;
+                return false;
+            }
+            sources.push_back(move(s));
+            if (sources.back()->next()) heap.push(sources.size() - 1);
+        }
+        string word;
+        int64_t sum[2];
+        while (!heap.empty()) {
+            size_t i = heap.top();
+            heap.pop();
+            word.swap(sources[i]->word);
+            sum[0] = sources[i]->count[0];
+            sum[1] = sources[i]->count[1];
+            if (sources[i]->next()) heap.push(i);
+            while (!heap.empty() && sources[heap.top()]->word == word) {
+                size_t j = heap.top();
+                heap.pop();
+                sum[0] += sources[j]->count[0];
+                sum[1] += sources[j]->count[1];
+                if (sources[j]->next()) heap.push(j);
+            }
+            if (!emit(word, sum)) return false;
+        }
+        for (const auto &s : sources) {
+            if (!s->in.eof()) {
+                cerr << "Corrupt spill file\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Spills what is left, merges down to at most max_fan_in runs, then
+    // streams the final merge into f(word, count[2]). Runs keep 64-bit
+    // counts; f decides whether a count fits its destination.
+    template <class F>
+    bool merge(F f) {
+        if (!spill()) return false;
+        while (runs.size() > max_fan_in) {
+            vector<filesystem::path> next;
+            for (size_t i = 0; i < runs.size(); i += max_fan_in) {
+                vector<filesystem::path> group(runs.begin() + i,
+                                               runs.begin() + min(runs.size(), i + max_fan_in));
+                filesystem::path path = nextRunPath();
+                vector<char> buffer(bufferBytes(1));
+                ofstream out;
+                out.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+                out.open(path, ios::binary);
+                if (!out.is_open()) {
+                    cerr << "Cannot create spill file in " << dir << endl;
+                    return false;
+                }
+                next.push_back(path);
+                bool ok = mergeRuns(group, [&](const string &w, const int64_t count[2]) {
+                    writeWord(out, w);
+                    for (int c = 0; c < 2; ++c) writePod(out, count[c]);
+                    return true;
+                });
+                out.close();
+                error_code ec;
+                for (const auto &p : group) filesystem::remove(p, ec);
+                if (!ok || !out) {
+                    next.insert(next.end(), runs.begin() + min(runs.size(), i + max_fan_in), runs.end());
+                    runs = move(next);
+                    return false;
+                }
+            }
+            runs = move(next);
+            merge_passes++;
+        }
+        merge_passes++;
+        return mergeRuns(runs, f);
+    }
+};
+
+// ---------- Classifier instrumentation ----------
+// Per-stage timers, size histograms and a sampled slow-message log for
+// classification. Build with -DR1P1_STATS=0 to compile all of it out;
+// when enabled, counters are relaxed atomics in per-thread-group shards
+// so worker threads do not contend on one cache line.
+#ifndef R1P1_STATS
+#define R1P1_STATS 1
+#endif
+constexpr bool stats_enabled = R1P1_STATS != 0;
+
+enum Stage { STAGE_PARSE, STAGE_TOKENIZE, STAGE_LOOKUP, STAGE_SCORE, STAGE_COUNT };
+constexpr const char *stage_names[STAGE_COUNT] = {"parse", "tokenize", "lookup", "score"};
+
+// Sizes and stage times of the message being classified on one thread.
+struct MessageTrace {
+    uint64_t ns[STAGE_COUNT] = {0, 0, 0, 0};
+    uint64_t bytes = 0;
+    uint64_t tokens = 0;
+    uint64_t known = 0; // tokens found in the vocabulary
+};
+
+// Set while this thread classifies a message; stages record into it.
+thread_local MessageTrace *active_trace = nullptr;
+
+// Adds the lifetime of the timer to a stage of the active trace, if any.
+struct StageTimer {
+    MessageTrace *trace;
+    Stage stage;
+    chrono::steady_clock::time_point start;
+
+    explicit StageTimer(Stage s) : trace(stats_enabled ? active_trace : nullptr), stage(s) {
+        if (trace) start = chrono::steady_clock::now();
+    }
+    ~StageTimer() {
+        if (trace) {
+            trace->ns[stage] += chrono::duration_cast<chrono::nanoseconds>(
+                                    chrono::steady_clock::now() - start).count();
+        }
+    }
+};
+
+struct ClassifierStats {
+    static constexpr size_t shard_count = 16;
+    static constexpr int buckets = 24; // power-of-two histogram buckets
+    static constexpr size_t slow_capacity = 32;
+
+    struct alignas(64) Shard {
+        atomic<uint64_t> messages{0}, bytes{0}, tokens{0}, known{0};
+        atomic<uint64_t> stage_ns[STAGE_COUNT] = {};
+        atomic<uint64_t> stage_max_ns[STAGE_COUNT] = {};
+        atomic<uint64_t> token_hist[buckets] = {};
+        atomic<uint64_t> latency_hist[buckets] = {}; // microseconds
+    };
+
+    struct SlowMessage {
+        uint64_t seq;
+        MessageTrace trace;
+        uint64_t total_ns;
+    };
+
+    Shard shards[shard_count];
+    // Messages slower than this are slow; every slow_sample-th is logged.
+    atomic<uint64_t> slow_threshold_ns{10'000'000};
+    atomic<uint64_t> slow_sample{1};
+    atomic<uint64_t> slow_seen{0};
+    mutable mutex slow_mtx;
+    deque<SlowMessage> slow_log; // newest last
+
+    static int bucket(uint64_t v) {
+        int b = 0;
+        while (v > 1 && b < buckets - 1) {
+            v >>= 1;
+            ++b;
+        }
+        return b;
+    }
+
+    Shard &localShard() {
+        thread_local size_t index = hash<thread::id>()(this_thread::get_id()) % shard_count;
+        return shards[index];
+    }
+
+    void record(const MessageTrace &t, uint64_t total_ns) {
+        Shard &s = localShard();
+        s.messages.fetch_add(1, memory_order_relaxed);
+        s.bytes.fetch_add(t.bytes, memory_order_relaxed);
+        s.tokens.fetch_add(t.tokens, memory_order_relaxed);
+        s.known.fetch_add(t.known, memory_order_relaxed);
+        for (int i = 0; i < STAGE_COUNT; ++i) {
+            s.stage_ns[i].fetch_add(t.ns[i], memory_order_relaxed);
+            if (t.ns[i] > s.stage_max_ns[i].load(memory_order_relaxed)) {
+                uint64_t seen = s.stage_max_ns[i].load(memory_order_relaxed);
+                while (t.ns[i] > seen && !s.stage_max_ns[i].compare_exchange_weak(seen, t.ns[i])) {
+                }
+            }
+        }
+        s.token_hist[bucket(t.tokens)].fetch_add(1, memory_order_relaxed);
+        s.latency_hist[bucket(total_ns / 1000)].fetch_add(1, memory_order_relaxed);
+        if (total_ns < slow_threshold_ns.load(memory_order_relaxed)) return;
+        uint64_t seq = slow_seen.fetch_add(1, memory_order_relaxed);
+        if (seq % max<uint64_t>(1, slow_sample.load(memory_order_relaxed)) != 0) return;
+        lock_guard<mutex> lk(slow_mtx);
+        slow_log.push_back({seq, t, total_ns});
+        if (slow_log.size() > slow_capacity) slow_log.pop_front();
+    }
+
+    // Text report, one "key value" line per counter like the daemon's
+    // server statistics.
+    void report(ostream &os) const {
+        uint64_t messages = 0, bytes = 0, tokens = 0, known = 0;
+        uint64_t stage_ns[STAGE_COUNT] = {0, 0, 0, 0}, stage_max[STAGE_COUNT] = {0, 0, 0, 0};
+        uint64_t token_hist[buckets] = {}, latency_hist[buckets] = {};
+        for (const Shard &s : shards) {
+            messages += s.messages.load(memory_order_relaxed);
+            bytes += s.bytes.load(memory_order_relaxed);
+            tokens += s.tokens.load(memory_order_relaxed);
+            known += s.known.load(memory_order_relaxed);
+            for (int i = 0; i < STAGE_COUNT; ++i) {
+                stage_ns[i] += s.stage_ns[i].load(memory_order_relaxed);
+                stage_max[i] = max(stage_max[i], s.stage_max_ns[i].load(memory_order_relaxed));
+            }
+            for (int b = 0; b < buckets; ++b) {
+                token_hist[b] += s.token_hist[b].load(memory_order_relaxed);
+                latency_hist[b] += s.latency_hist[b].load(memory_order_relaxed);
+            }
+        }
+        auto histogram = [&](const char *name, const uint64_t *h) {
+            os << name;
+            for (int b = 0; b < buckets; ++b) {
+                if (h[b]) os << ' ' << (b ? 1ull << b : 0) << ':' << h[b];
+            }
+            os << "\n";
+        };
+        os << fixed << setprecision(2) << "messages " << messages << "\n"
+           << "message_bytes " << bytes << "\n"
+           << "message_tokens " << tokens << "\n"
+           << "vocab_hit_rate " << (tokens ? (double)known / tokens : 0.0) << "\n";
+        for (int i = 0; i < STAGE_COUNT; ++i) {
+            os << "stage_" << stage_names[i] << "_us mean "
+               << (messages ? stage_ns[i] / 1e3 / messages : 0.0) << " max " << stage_max[i] / 1e3
+               << " ns_per_token " << (tokens ? (double)stage_ns[i] / tokens : 0.0) << "\n";
+        }
+        histogram("tokens_hist", token_hist);
+        histogram("latency_us_hist", latency_hist);
+        lock_guard<mutex> lk(slow_mtx);
+        os << "slow_threshold_us " << slow_threshold_ns.load() / 1e3 << "\n"
+           << "slow_messages " << slow_seen.load() << " (1 in " << slow_sample.load()
+           << " logged, last " << slow_log.size() << " kept)\n";
+        for (const SlowMessage &m : slow_log) {
+            os << "slow #" << m.seq << " bytes " << m.trace.bytes << " tokens " << m.trace.tokens
+               << " known " << m.trace.known;
+            for (int i = 0; i < STAGE_COUNT; ++i) os << ' ' << stage_names[i] << "_us " << m.trace.ns[i] / 1e3;
+            os << " total_us " << m.total_ns / 1e3 << "\n";
+        }
+    }
+};
+
+// Process-wide, so counters survive model reloads in the daemon.
+ClassifierStats &classifierStats() {
+    static ClassifierStats stats;
+    return stats;
+}
+
+// Traces one message classification on this thread (the outermost one
+// if calls nest) and records it when the scope ends.
+struct MessageScope {
+    MessageTrace trace;
+    bool owner = false;
+    chrono::steady_clock::time_point start;
+
+    explicit MessageScope(size_t bytes) {
+        if constexpr (stats_enabled) {
+            if (active_trace) return;
+            owner = true;
+            trace.bytes = bytes;
+            active_trace = &trace;
+            start = chrono::steady_clock::now();
+        }
+    }
+    ~MessageScope() {
+        if constexpr (stats_enabled) {
+            if (!owner) return;
+            active_trace = nullptr;
+            uint64_t total = chrono::duration_cast<chrono::nanoseconds>(
+                                 chrono::steady_clock::now() - start).count();
+            classifierStats().record(trace, total);
+        }
+    }
+};
+
+struct NaiveBayesEmailClassifier {
+    // Class labels
+    enum ClassLabel { PHISHING = 0, LEGIT = 1 };
+
+    // Laplace smoothing
+    static constexpr double alpha = 1.0;
+
+    // One consistent view of the model. Only raw counts are stored; the
+    // log-likelihood of a word is log(count + alpha) - log_denom[class],
+    // so learning a document touches its own tokens and two denominators
+    // instead of every entry of the vocabulary.
+    struct Model {
+        // Vocabulary: word -> index
+        unordered_map<string, int> vocab;
+        // Raw word counts per class and their cached log(count + alpha)
+        vector<int> word_count[2];   // [class][wordIndex]
+        vector<double> log_num[2];   // [class][wordIndex]
+        // Total word counts per class (for smoothing)
+        long long total_words[2] = {0, 0};
+        // Class document counts
+        int doc_count[2] = {0, 0};
+        // Prior probabilities P(class), as logs
+        double prior[2] = {0.0, 0.0};
+        // log(total_words[class] + alpha * V)
+        double log_denom[2] = {0.0, 0.0};
+        // Range of log_num[PHISHING][w] - log_num[LEGIT][w] over the
+        // vocabulary, widened to include 0 (an unseen word). learn() only
+        // widens it, so after forgetting documents it may be loose, which
+        // is safe for scoreEarly().
+        double diff_min = 0.0, diff_max = 0.0;
+
+        int vocabSize() const { return (int)vocab.size(); }
+
+        bool ready() const {
+            return !vocab.empty() && (doc_count[0] + doc_count[1]) > 0;
+        }
+
+        // P(word | class) as a log-probability
+        double logLikelihood(int c, int idx) const {
+            return log_num[c][idx] - log_denom[c];
+        }
+
+        int addWord(const string &w) {
+            auto it = vocab.find(w);
+            if (it != vocab.end()) return it->second;
+            int idx = (int)vocab.size();
+            vocab.emplace(w, idx);
+            for (int c = 0; c < 2; ++c) {
+                word_count[c].push_back(0);
+                log_num[c].push_back(log(alpha));
+            }
+            return idx;
+        }
+
+        // Adds (sign = +1) or removes (sign = -1) one document. Removing a
+        // document never drops words from the vocabulary, and counts are
+        // clamped at zero if asked to forget something never learned.
+        void learn(ClassLabel cls, const vector<string> &tokens, int sign) {
+            if (sign > 0) {
+                doc_count[cls]++;
+            } else if (doc_count[cls] > 0) {
+                doc_count[cls]--;
+            }
+            for (const string &w : tokens) {
+                int idx;
+                if (sign > 0) {
+                    idx = addWord(w);
+                } else {
+                    auto it = vocab.find(w);
+                    if (it == vocab.end()) continue;
+                    idx = it->second;
+                    if (word_count[cls][idx] == 0) continue;
+                }
+                word_count[cls][idx] += sign;
+                total_words[cls] += sign;
+                log_num[cls][idx] = log(word_count[cls][idx] + alpha);
+                widenDiffRange(idx);
+            }
+            refresh();
+        }
+
+        // Replaces the model with the result of a batch training pass;
+        // vocabulary indices keep the interned (first-seen) order.
+        void assign(const TrainingCounts &t) {
+            size_t V = t.counts.size();
+            vocab.clear();
+            vocab.reserve(V);
+            for (int c = 0; c < 2; ++c) {
+                word_count[c].resize(V);
+                log_num[c].resize(V);
+                total_words[c] = t.total_words[c];
+                doc_count[c] = t.doc_count[c];
+            }
+            for (size_t id = 0; id < V; ++id) {
+                vocab.emplace(string(t.table.words[id]), (int)id);
+                for (int c = 0; c < 2; ++c) {
+                    word_count[c][id] = t.counts[id][c];
+                    log_num[c][id] = log(t.counts[id][c] + alpha);
+                }
+            }
+            computeDiffRange();
+            refresh();
+        }
+
+        void widenDiffRange(int idx) {
+            double d = log_num[PHISHING][idx] - log_num[LEGIT][idx];
+            diff_min = min(diff_min, d);
+            diff_max = max(diff_max, d);
+        }
+
+        // Full scan after the counts were replaced wholesale: O(V).
+        void computeDiffRange() {
+            diff_min = diff_max = 0.0;
+            for (int i = 0; i < vocabSize(); ++i) widenDiffRange(i);
+        }
+
+        // Approximate heap held: hash nodes and buckets, characters of words
+        // too long for the string's inline buffer, and the count and log
+        // tables.
+        size_t bytes() const {
+            size_t b = vocab.bucket_count() * sizeof(void *) +
+                       vocab.size() * (sizeof(pair<const string, int>) + 2 * sizeof(void *));
+            for (const auto &kv : vocab) {
+                if (kv.first.capacity() > 15) b += kv.first.capacity() + 1;
+            }
+            for (int c = 0; c < 2; ++c) {
+                b += word_count[c].capacity() * sizeof(int) + log_num[c].capacity() * sizeof(double);
+            }
+            return b;
+        }
+
+        // Recomputes the per-class terms that depend on totals: O(1).
+        void refresh() {
+            int total_docs = doc_count[0] + doc_count[1];
+            int V = vocabSize();
+            for (int c = 0; c < 2; ++c) {
+                prior[c] = total_docs ? log((double)doc_count[c] / total_docs) : 0.0;
+                log_denom[c] = log(total_words[c] + alpha * V);
+            }
+        }
+
+        // Adds log P(class) + sum log P(word | class) into log_prob.
+        void score(const vector<string> &tokens, double log_prob[2]) const {
+            if (stats_enabled && active_trace) return scoreStaged(tokens, log_prob);
+            double num[2] = {0.0, 0.0};
+            long long known = 0;
+            for (const string &w : tokens) {
+                auto it = vocab.find(w);
+                if (it == vocab.end()) continue; // unseen word
+                int idx = it->second;
+                num[PHISHING] += log_num[PHISHING][idx];
+                num[LEGIT]    += log_num[LEGIT][idx];
+                known++;
+            }
+            for (int c = 0; c < 2; ++c) {
+                log_prob[c] = prior[c] + num[c] - known * log_denom[c];
+            }
+        }
+
+        // Margin bounds when scoreEarly() stopped before the last token:
+        // the final log P(phishing) - log P(legit) is within
+        // [margin_low, margin_high]. `read` tokens were looked up.
+        struct EarlyBounds {
+            double margin_low = 0.0, margin_high = 0.0;
+            size_t read = 0;
+        };
+        static constexpr size_t early_check_tokens = 64;
+
+        // score() that may stop once the remaining tokens can no longer
+        // change the label. Each known token moves the margin by its diff
+        // minus (log_denom[PHISHING] - log_denom[LEGIT]) and an unseen one
+        // by 0, so r unread tokens move it by at most r times the extreme
+        // step. Bounds are checked every early_check_tokens tokens and must
+        // clear a rounding slack, so the label always equals score()'s.
+        // Returns true with *bounds filled on an early stop; otherwise
+        // log_prob holds exactly what score() computes.
+        bool scoreEarly(const vector<string> &tokens, double log_prob[2], EarlyBounds *bounds) const {
+            double delta = log_denom[PHISHING] - log_denom[LEGIT];
+            double step_low = min(0.0, diff_min - delta);
+            double step_high = max(0.0, diff_max - delta);
+            double prior_margin = prior[PHISHING] - prior[LEGIT];
+            size_t n = tokens.size();
+            // Every term in either sum is at most log_denom[c] in magnitude
+            // (log_num <= log_denom), so this bounds the error of both the
+            // full sums and the bound arithmetic below.
+            double magnitude = fabs(prior[0]) + fabs(prior[1]) +
+                               2.0 * (double)n * (fabs(log_denom[0]) + fabs(log_denom[1]) + 1.0);
+            double slack = 4.0 * (double)(n + 8) * DBL_EPSILON * magnitude;
+            double num[2] = {0.0, 0.0};
+            long long known = 0;
+            for (size_t i = 0; i < n; ++i) {
+                if (i && i % early_check_tokens == 0) {
+                    double m = prior_margin + (num[PHISHING] - num[LEGIT]) - known * delta;
+                    double r = (double)(n - i);
+                    double low = m + r * step_low, high = m + r * step_high;
+                    if (low > slack || high < -slack) {
+                        *bounds = {low, high, i};
+                        return true;
+                    }
+                }
+                auto it = vocab.find(tokens[i]);
+                if (it == vocab.end()) continue; // unseen word
+                int idx = it->second;
+                num[PHISHING] += log_num[PHISHING][idx];
+                num[LEGIT]    += log_num[LEGIT][idx];
+                known++;
+            }
+            for (int c = 0; c < 2; ++c) {
+                log_prob[c] = prior[c] + num[c] - known * log_denom[c];
+            }
+            return false;
+        }
+
+        // score() split into timed lookup and summing passes; same sums in
+        // the same order.
+        void scoreStaged(const vector<string> &tokens, double log_prob[2]) const {
+            thread_local vector<int> ids;
+            ids.clear();
+            {
+                StageTimer t(STAGE_LOOKUP);
+                for (const string &w : tokens) {
+                    auto it = vocab.find(w);
+                    if (it != vocab.end()) ids.push_back(it->second);
+                }
+            }
+            StageTimer t(STAGE_SCORE);
+            double num[2] = {0.0, 0.0};
+            for (int idx : ids) {
+                num[PHISHING] += log_num[PHISHING][idx];
+                num[LEGIT]    += log_num[LEGIT][idx];
+            }
+            long long known = (long long)ids.size();
+            for (int c = 0; c < 2; ++c) {
+                log_prob[c] = prior[c] + num[c] - known * log_denom[c];
+            }
+            active_trace->known += ids.size();
+        }
+    };
+
+    // Frozen, post-training copy of a Model with the log(count + alpha)
+    // terms stored as int16 fixed point, q = round(log_num / scale[c]),
+    // with one scale per class chosen so the largest term maps to 32767.
+    // Tables shrink from 16 to 4 bytes per word.
+    //
+    // Error bound: each term is off by at most scale[c] / 2, so a class
+    // log-probability is within known_tokens * scale[c] / 2 of the double
+    // path, and the two paths agree on the label whenever the double
+    // margin |log P(phishing) - log P(legit)| exceeds
+    // known_tokens * (scale[0] + scale[1]) / 2.
+    //
+    // Next to the double counts (quantize()), the tables are indexed by
+    // the model's own vocabulary: score() looks words up in the Model it
+    // is handed (either left-right copy, they assign the same indices) and
+    // quantizing adds 4 bytes per word. A frozen model (quantize(true) or
+    // a quantized model file) carries its words in a compact InternTable
+    // instead, and the double tables and counts are freed.
+    struct QuantizedModel {
+        vector<uint32_t> packed; // [wordIndex], class 0 low / class 1 high
+        double scale[2] = {1.0, 1.0};
+        double prior[2] = {0.0, 0.0};
+        double log_denom[2] = {0.0, 0.0};
+        int doc_count[2] = {0, 0};
+        unique_ptr<InternTable> vocab; // frozen only: word -> index
+
+        QuantizedModel() = default;
+
+        explicit QuantizedModel(const Model &m) : packed(m.vocabSize()) {
+            for (int c = 0; c < 2; ++c) {
+                doc_count[c] = m.doc_count[c];
+                double top = 0.0;
+                for (double v : m.log_num[c]) top = max(top, fabs(v));
+                scale[c] = top > 0.0 ? top / 32767.0 : 1.0;
+                prior[c] = m.prior[c];
+                log_denom[c] = m.log_denom[c];
+            }
+            for (size_t i = 0; i < packed.size(); ++i) {
+                auto q0 = static_cast<int16_t>(lround(m.log_num[0][i] / scale[0]));
+                auto q1 = static_cast<int16_t>(lround(m.log_num[1][i] / scale[1]));
+                packed[i] = static_cast<uint16_t>(q0) | (static_cast<uint32_t>(static_cast<uint16_t>(q1)) << 16);
+            }
+        }
+
+        // Copies m's words in index order, so m can be freed afterwards.
+        void freezeVocabulary(const Model &m) {
+            vector<const string *> by_index(m.vocab.size());
+            for (const auto &kv : m.vocab) by_index[kv.second] = &kv.first;
+            vocab.reset(new InternTable(by_index.size()));
+            for (const string *w : by_index) vocab->intern(*w);
+        }
+
+        size_t tableBytes() const { return packed.size() * sizeof(uint32_t); }
+        size_t bytes() const { return tableBytes() + (vocab ? vocab->bytes() : 0); }
+
+        // Unless frozen, m must be a copy of the model this was built from,
+        // unedited since; a frozen model ignores m.
+        void score(const Model &m, const vector<string> &tokens, double log_prob[2],
+                   size_t *known_out = nullptr) const {
+            thread_local vector<int32_t> ids;
+            ids.clear();
+            {
+                StageTimer t(STAGE_LOOKUP);
+                if (vocab) {
+                    for (const string &w : tokens) {
+                        uint32_t id = vocab->find(w);
+                        if (id != InternTable::empty_id) ids.push_back((int32_t)id);
+                    }
+                } else {
+                    for (const string &w : tokens) {
+                        auto it = m.vocab.find(w);
+                        if (it != m.vocab.end()) ids.push_back(it->second);
+                    }
+                }
+            }
+            StageTimer t(STAGE_SCORE);
+            int64_t sums[2] = {0, 0};
+            accumulatePacked(packed.data(), ids.data(), ids.size(), sums);
+            for (int c = 0; c < 2; ++c) {
+                log_prob[c] = prior[c] + sums[c] * scale[c] - (double)ids.size() * log_denom[c];
+            }
+            if (known_out) *known_out = ids.size();
+            if (t.trace) t.trace->known += ids.size();
+        }
+    };
+
+    // Two copies of the model in a left-right arrangement: readers use the
+    // active copy while the writer edits the other one, flips `active`,
+    // waits for readers still on the old copy to leave, then replays the
+    // same edit there. Readers never block and always see a whole update.
+    Model models[2];
+    atomic<int> active{0};
+    mutable atomic<int> readers[2] = {{0}, {0}};
+    mutex write_mtx;
+    atomic<bool> trained{false};
+    // Brand / allowlist domains for URL and sender features; optional
+    DomainTrie domains;
+    // Set by quantize(); used for scoring until the next model edit
+    shared_ptr<const QuantizedModel> quantized;
+    // Set by quantize(true) or by loading a quantized file: `quantized`
+    // is all that is left, and edits are refused.
+    atomic<bool> frozen{false};
+    // Alternative scoring engine; when set it replaces the NB counts
+    shared_ptr<const EmailEngine> engine;
+    // Tokenizer settings saved with the model. Immutable once published:
+    // tokenize() takes one reference per email, and load() swaps in a new
+    // object under write_mtx right before the model it belongs to, so a
+    // concurrent load never changes the tokenizer under a reader.
+    struct TokenizerConfig {
+        int ngram = 1;          // word n-gram order (1 = unigrams only)
+        bool normalize = false; // obfuscation normalization (splitNormalized)
+    };
+    shared_ptr<const TokenizerConfig> tokenizer = make_shared<const TokenizerConfig>();
+    // Batch training keeps n-grams seen fewer than ngram_min_count times
+    // in a sketch of the training file out of the vocabulary. Online
+    // learning never adds n-grams: update() only counts those already in
+    // the vocabulary, so it cannot grow it past what training admitted.
+    uint32_t ngram_min_count = 1;
+    size_t ngram_sketch_bytes = 16u << 20;
+    // Admission test for n-gram candidates; an empty one admits all.
+    using NgramAdmit = function<bool(const string &)>;
+    // Stop scoring once the label is settled (Model::scoreEarly). Applies
+    // to the double-precision counts only, not to quantized or engine
+    // scoring; not saved with the model.
+    bool early_exit = false;
+
+    // Label and P(phishing) from a single tokenization pass. When scoring
+    // stopped early, bounded is set, P(phishing) is only known to lie in
+    // [p_low, p_high], and p_phishing is the end nearer 0.5.
+    struct Prediction {
+        ClassLabel label;
+        double p_phishing;
+        bool bounded = false;
+        double p_low = 0.0, p_high = 0.0;
+    };
+
+    static uint32_t featureFlags(const TokenizerConfig &cfg) {
+        return cfg.normalize ? (uint32_t)FEATURE_NORMALIZE : 0u;
+    }
+
+    shared_ptr<const TokenizerConfig> tokenizerConfig() const { return atomic_load(&tokenizer); }
+
+    // Replaces the tokenizer settings; for setup before training.
+    void setTokenizer(const TokenizerConfig &cfg) {
+        lock_guard<mutex> lk(write_mtx);
+        atomic_store(&tokenizer, make_shared<const TokenizerConfig>(cfg));
+    }
+
+    // Tokens of a plain-text email under the current settings: lowercase
+    // words (with their skeletons when normalize is set), n-grams of the
+    // configured order, and features of the URL hosts it links to.
+    vector<string> tokenize(string_view text) const { return tokenizeWith(*tokenizerConfig(), text); }
+
+    // *ngram_span, when given, receives the [begin, end) index range of
+    // the n-gram tokens.
+    vector<string> tokenizeWith(const TokenizerConfig &cfg, string_view text,
+                                const NgramAdmit &admit = nullptr,
+                                pair<size_t, size_t> *ngram_span = nullptr) const {
+        vector<string> skeletons;
+        vector<string> tokens = splitWords(cfg, text, &skeletons);
+        size_t words = tokens.size();
+        if (cfg.ngram > 1) appendNgrams(cfg.ngram, tokens, admit);
+        if (ngram_span) *ngram_span = {words, tokens.size()};
+        for (string &s : skeletons) tokens.push_back(move(s));
+        forEachUrlHost(text, [&](const string &host) {
+            appendDomainFeatures(host, "u:", tokens);
+        });
+        return tokens;
+    }
+
+    // Tokens of an email to learn online: only n-grams already in the
+    // vocabulary are kept (see ngram_min_count).
+    vector<string> tokenizeForLearning(string_view text, bool raw) const {
+        auto cfg = tokenizerConfig();
+        return withSnapshot([&](const Model &m) {
+            NgramAdmit known = [&](const string &gram) { return m.vocab.count(gram) != 0; };
+            if (!raw) return tokenizeWith(*cfg, text, known);
+            thread_local MimeParser parser;
+            thread_local MimeMessage msg;
+            parser.parse(text, msg);
+            return tokenizeMessageWith(*cfg, msg, known);
+        });
+    }
+
+    // With normalize set, obfuscated words also add their skeletons to
+    // *skeletons (see splitNormalized); n-grams use the raw words.
+    vector<string> splitWords(const TokenizerConfig &cfg, string_view text,
+                              vector<string> *skeletons = nullptr) const {
+        if (cfg.normalize) {
+            vector<string> tokens, ignored;
+            splitNormalized(text, tokens, skeletons ? *skeletons : ignored);
+            return tokens;
+        }
+        string clean;
+        clean.reserve(text.size());
+        for (char c : text) {
+            if (isalpha(static_cast<unsigned char>(c))) {
+                clean.push_back(tolower(static_cast<unsigned char>(c)));
+            } else if (isdigit(static_cast<unsigned char>(c))) {
+                clean.push_back(c);
+            } else {
+                clean.push_back(' ');
+            }
+        }
+        vector<string> tokens;
+        stringstream ss(clean);
+        string tok;
+        while (ss >> tok) {
+            tokens.push_back(tok);
+        }
+        return tokens;
+    }
+
+    // Calls f for every 2..ngram word n-gram of words, joined with '_'
+    // (which the word splitter never produces, so no clashes).
+    template <class F>
+    static void forEachNgram(int ngram, const vector<string> &words, F f) {
+        string gram;
+        for (int n = 2; n <= ngram; ++n) {
+            for (size_t i = 0; i + n <= words.size(); ++i) {
+                gram = words[i];
+                for (int k = 1; k < n; ++k) {
+                    gram.push_back('_');
+                    gram += words[i + k];
+                }
+                f(gram);
+            }
+        }
+    }
+
+    // Appends the n-grams of the word tokens that admit accepts.
+    static void appendNgrams(int ngram, vector<string> &tokens, const NgramAdmit &admit) {
+        vector<string> base = tokens;
+        forEachNgram(ngram, base, [&](const string &gram) {
+            if (admit && !admit(gram)) return;
+            tokens.push_back(gram);
+        });
+    }
+
+    // First pass of n-gram training: count every candidate n-gram of the
+    // file in a fixed-size sketch, so the second pass only lets frequent
+    // ones into the vocabulary. Peak memory is the sketch plus the pruned
+    // vocabulary, whatever the corpus size. Returns an empty test when
+    // nothing is pruned.
+    NgramAdmit prepareNgramFilter(const TokenizerConfig &cfg, const string &trainFile) const {
+        if (cfg.ngram <= 1 || ngram_min_count <= 1) return nullptr;
+        ifstream in(trainFile);
+        if (!in.is_open()) return nullptr;
+        auto sketch = make_shared<CountMinSketch>(ngram_sketch_bytes);
+        string line, text;
+        ClassLabel cls;
+        while (getline(in, line)) {
+            if (!parseTrainingLine(line, cls, text)) continue;
+            forEachNgram(cfg.ngram, splitWords(cfg, text), [&](const string &gram) { sketch->add(gram); });
+        }
+        clog << "N-gram sketch: " << sketch->additions << " candidates in "
+             << sketch->bytes() / 1024 << " KiB" << endl;
+        uint32_t min_count = ngram_min_count;
+        return [sketch, min_count](const string &gram) { return sketch->estimate(gram) >= min_count; };
+    }
+
+    // Features describing one host under namespace ns: the host itself,
+    // IP / IDN markers, and what the domain trie says about it.
+    void appendDomainFeatures(const string &host, const string &ns, vector<string> &tokens) const {
+        tokens.push_back(ns + "host:" + host);
+        if (host[0] == '[' || host.find_first_not_of("0123456789.") == string::npos) {
+            tokens.push_back(ns + "ip");
+            return;
+        }
+        bool idn = host.find("xn--") != string::npos ||
+                   any_of(host.begin(), host.end(), [](char c) { return c & 0x80; });
+        if (idn) tokens.push_back(ns + "idn");
+        if (domains.empty()) return;
+
+        string_view brand;
+        uint32_t literal = domains.lookup(host, &brand);
+        if (literal & DomainTrie::ALLOW) {
+            tokens.push_back(ns + "allow");
+            if (literal & DomainTrie::BRAND) tokens.push_back(ns + "brand:" + string(brand));
+            return;
+        }
+        string skel = hostSkeleton(host);
+        if (domains.lookup(skel, &brand) & DomainTrie::BRAND) {
+            tokens.push_back(ns + "lookalike:" + string(brand));
+            return;
+        }
+        // A brand name used as one piece of an unrelated host, as in
+        // "paypal.account-verify.ru" or "secure-paypa1.com".
+        bool found = false;
+        size_t start = 0;
+        while (start < host.size()) {
+            size_t end = host.find_first_of(".-", start);
+            if (end == string::npos) end = host.size();
+            string part = hostSkeleton(string_view(host).substr(start, end - start));
+            if (!part.empty() && (domains.lookupLabel(part) & DomainTrie::BRAND_LABEL)) {
+                tokens.push_back(ns + "brandlabel:" + part);
+                found = true;
+            }
+            start = end + 1;
+        }
+        if (!found) tokens.push_back(ns + "unknown");
+    }
+
+    // Body tokens followed by header tokens in their own namespaces, so
+    // "paypal" in the From line is a different feature from the body word.
+    vector<string> tokenizeMessage(const MimeMessage &msg) const {
+        return tokenizeMessageWith(*tokenizerConfig(), msg);
+    }
+
+    vector<string> tokenizeMessageWith(const TokenizerConfig &cfg, const MimeMessage &msg,
+                                       const NgramAdmit &admit = nullptr) const {
+        vector<string> tokens = tokenizeWith(cfg, msg.body, admit);
+        const pair<const string *, const char *> fields[] = {
+            {&msg.subject, "s:"}, {&msg.from, "f:"}, {&msg.reply_to, "r:"}};
+        for (const auto &field : fields) {
+            NgramAdmit prefixed;
+            if (admit) prefixed = [&](const string &gram) { return admit(field.second + gram); };
+            for (string &tok : tokenizeWith(cfg, *field.first, prefixed)) tokens.push_back(field.second + tok);
+        }
+
+        string host, shown;
+        for (const auto &link : msg.links) {
+            if (!urlHost(link.first, host)) continue;
+            appendDomainFeatures(host, "u:", tokens);
+            // Visible text that is itself a different domain than the target
+            string_view text = trimView(link.second);
+            if (text.find_first_of(" \t\r\n") == string_view::npos && urlHost(text, shown) &&
+                baseDomain(shown) != baseDomain(host)) {
+                tokens.push_back("u:href-mismatch");
+            }
+        }
+        string from_domain, reply_domain;
+        if (addressDomain(msg.from, from_domain)) appendDomainFeatures(from_domain, "f:", tokens);
+        if (addressDomain(msg.reply_to, reply_domain)) {
+            appendDomainFeatures(reply_domain, "r:", tokens);
+            if (!from_domain.empty() && baseDomain(reply_domain) != baseDomain(from_domain)) {
+                tokens.push_back("r:differs");
+            }
+        }
+        return tokens;
+    }
+
+    // Decodes a raw RFC 822 message and tokenizes it. The parser and its
+    // buffers are per thread, so batch workers never reallocate them.
+    vector<string> tokenizeRaw(string_view raw) const {
+        return tokenizeTraced(raw, true);
+    }
+
+    ClassLabel labelFromString(const string &s) const {
+        if (s == "phishing" || s == "spam" || s == "malicious") {
+            return PHISHING;
+        }
+        return LEGIT;
+    }
+
+    string labelToString(ClassLabel c) const {
+        return (c == PHISHING) ? "PHISHING" : "LEGIT";
+    }
+
+    // Splits a "label<whitespace>text" training line.
+    bool parseTrainingLine(const string &line, ClassLabel &cls, string &text) const {
+        if (line.empty()) return false;
+        string labelStr;
+        stringstream ss(line);
+        if (!(ss >> labelStr)) return false;
+        getline(ss, text); // rest of line
+        if (!text.empty() && (text[0] == ' ' || text[0] == '\t')) text.erase(text.begin());
+        cls = labelFromString(labelStr);
+        return true;
+    }
+
+    // Runs f on the active model while holding a reader slot.
+    template <class F>
+    auto withSnapshot(F f) const -> decltype(f(models[0])) {
+        while (true) {
+            int idx = active.load();
+            readers[idx].fetch_add(1);
+            if (active.load() == idx) {
+                struct Leave {
+                    atomic<int> &slot;
+                    ~Leave() { slot.fetch_sub(1); }
+                } leave{readers[idx]};
+                return f(models[idx]);
+            }
+            // The writer flipped between our two loads; retry on the new copy.
+            readers[idx].fetch_sub(1);
+        }
+    }
+
+    // Applies edit to both copies without ever exposing a half-done one.
+    // Callers must hold write_mtx.
+    template <class F>
+    bool publish(F edit) {
+        if (!editable()) return false;
+        // The quantized tables no longer match the counts. Drop them before
+        // either copy changes: a reader that still finds them has pinned a
+        // copy this edit will not touch until the reader leaves.
+        atomic_store(&quantized, shared_ptr<const QuantizedModel>());
+        int old = active.load();
+        edit(models[1 - old]);
+        active.store(1 - old);
+        while (readers[old].load() != 0) this_thread::yield();
+        edit(models[old]);
+        trained = models[old].ready() || atomic_load(&engine);
+        return true;
+    }
+
+    // False, with a message, once the classifier is frozen for serving.
+    bool editable() const {
+        if (!frozen) return true;
+        cerr << "Model is frozen for serving (int16 tables only); it cannot learn or be reloaded in place."
+             << endl;
+        return false;
+    }
+
+    // Converts the current model into int16 tables and scores with them
+    // from now on. Without freeze the double tables stay and any later
+    // update() drops back to them. With freeze, for read-only serving, the
+    // int16 tables get their own vocabulary, both model copies are freed
+    // and later edits are refused; save() then writes a quantized file.
+    void quantize(bool freeze = false) {
+        lock_guard<mutex> lk(write_mtx);
+        if (frozen || atomic_load(&engine)) return; // engines keep their own tables
+        const Model &current = models[active.load()];
+        auto q = make_shared<QuantizedModel>(current);
+        if (!freeze) {
+            atomic_store(&quantized, shared_ptr<const QuantizedModel>(q));
+            return;
+        }
+        q->freezeVocabulary(current);
+        installFrozen(q);
+    }
+
+    // Serves q alone from now on. Readers load `quantized` only after
+    // pinning a copy, so once q is published each copy can be reset as
+    // soon as the readers still on it have left. Callers must hold
+    // write_mtx.
+    void installFrozen(shared_ptr<const QuantizedModel> q) {
+        atomic_store(&quantized, q);
+        frozen = true;
+        trained = true;
+        for (int k = 0; k < 2; ++k) {
+            int old = active.load();
+            active.store(1 - old);
+            while (readers[old].load() != 0) this_thread::yield();
+            models[old] = Model();
+        }
+    }
+
+    void train(const string &trainFile) {
+        ifstream in(trainFile);
+        if (!in.is_open()) {
+            cerr << "Cannot open training file: " << trainFile << endl;
+            return;
+        }
+        auto cfg = tokenizerConfig();
+        NgramAdmit admit = prepareNgramFilter(*cfg, trainFile);
+
+        uint64_t allocations = heapAllocations();
+        error_code ec;
+        uintmax_t fileBytes = filesystem::file_size(trainFile, ec);
+        Model fresh;
+        {
+            TrainingCounts counts(estimateVocabulary(ec ? 0 : fileBytes));
+            string line, text;
+            ClassLabel cls;
+            while (getline(in, line)) {
+                if (!parseTrainingLine(line, cls, text)) continue;
+                counts.addDocument(cls, tokenizeWith(*cfg, text, admit));
+            }
+            in.close();
+            fresh.assign(counts);
+            clog << "Training state: " << counts.bytes() / 1024 << " KiB for "
+                 << counts.counts.size() << " words";
+            if (heapAllocations()) clog << ", " << heapAllocations() - allocations << " allocations";
+            clog << ", peak RSS " << peakRssKiB() << " KiB" << endl;
+        }
+
+        int V = fresh.vocabSize();
+        if (!fresh.ready()) {
+            cerr << "Empty dataset or vocabulary.\n";
+            return;
+        }
+
+        lock_guard<mutex> lk(write_mtx);
+        if (!publish([&](Model &m) { m = fresh; })) return;
+        // Diagnostics go to clog so batch output on stdout stays clean
+        clog << "Training completed. Documents: "
+             << fresh.doc_count[0] + fresh.doc_count[1]
+             << ", Vocab size: " << V << endl;
+    }
+
+    // Out-of-core version of train(): the same counts, but the vocabulary
+    // is accumulated in runs of at most budget bytes, spilled to spillDir
+    // and k-way merged. With modelPath set the merged table is streamed
+    // straight into a model file, byte-identical to save() after train(),
+    // and never held in memory; otherwise the merged model is published.
+    bool trainExternal(const string &trainFile, size_t budget, const string &spillDir,
+                       const string &modelPath = "") {
+        ifstream in(trainFile);
+        if (!in.is_open()) {
+            cerr << "Cannot open training file: " << trainFile << endl;
+            return false;
+        }
+        auto cfg = tokenizerConfig();
+        NgramAdmit admit = prepareNgramFilter(*cfg, trainFile);
+
+        auto start = chrono::steady_clock::now();
+        SpillingCounter counter(budget, spillDir);
+        Model fresh;
+        string line, text;
+        ClassLabel cls;
+        bool ok = true;
+        while (ok && getline(in, line)) {
+            if (!parseTrainingLine(line, cls, text)) continue;
+            if (fresh.doc_count[cls] == INT_MAX) {
+                cerr << "Too many " << labelToString(cls) << " documents for the model format.\n";
+                return false;
+            }
+            fresh.doc_count[cls]++;
+            for (const string &w : tokenizeWith(*cfg, text, admit)) {
+                fresh.total_words[cls]++;
+                if (!counter.add(w, cls)) {
+                    ok = false;
+                    break;
+                }
+            }
+        }
+        in.close();
+        if (!ok) return false;
+        if (fresh.doc_count[0] + fresh.doc_count[1] == 0) {
+            cerr << "Empty dataset or vocabulary.\n";
+            return false;
+        }
+
+        // Model files and tables hold 32-bit counts: refuse rather than wrap.
+        auto fits = [](const string &w, const int64_t count[2]) {
+            if (max(count[0], count[1]) <= INT32_MAX) return true;
+            cerr << "Count of \"" << w << "\" exceeds the model's 32-bit counts.\n";
+            return false;
+        };
+        uint32_t V = 0;
+        if (!modelPath.empty()) {
+            vector<char> buffer(4u << 20);
+            ofstream out;
+            out.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+            out.open(modelPath, ios::binary);
+            if (!out.is_open()) {
+                cerr << "Cannot write model file: " << modelPath << endl;
+                return false;
+            }
+            writeModelHeader(out, ENGINE_MULTINOMIAL_NB, cfg->ngram, featureFlags(*cfg));
+            for (int c = 0; c < 2; ++c) writePod(out, (int32_t)fresh.doc_count[c]);
+            for (int c = 0; c < 2; ++c) writePod(out, (int64_t)fresh.total_words[c]);
+            streampos countAt = out.tellp();
+            writePod(out, V);
+            ok = counter.merge([&](const string &w, const int64_t count[2]) {
+                if (!fits(w, count)) return false;
+                writeWord(out, w);
+                for (int c = 0; c < 2; ++c) writePod(out, (int32_t)count[c]);
+                V++;
+                return true;
+            });
+            out.seekp(countAt);
+            writePod(out, V);
+            out.close();
+            if (!ok || !out) {
+                cerr << "Cannot write model file: " << modelPath << endl;
+                return false;
+            }
+        } else {
+            ok = counter.merge([&](const string &w, const int64_t count[2]) {
+                if (!fits(w, count)) return false;
+                int idx = fresh.addWord(w);
+                for (int c = 0; c < 2; ++c) {
+                    fresh.word_count[c][idx] = (int)count[c];
+                    fresh.log_num[c][idx] = log((int)count[c] + alpha);
+                }
+                return true;
+            });
+            if (!ok) return false;
+            fresh.computeDiffRange();
+            fresh.refresh();
+            V = fresh.vocabSize();
+            lock_guard<mutex> lk(write_mtx);
+            if (!publish([&](Model &m) { m = fresh; })) return false;
+        }
+        double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        clog << "Training completed. Documents: " << fresh.doc_count[0] + fresh.doc_count[1]
+             << ", Vocab size: " << V << endl;
+        clog << "External training: " << counter.runs_written << " runs, "
+             << counter.spilled_bytes / (1 << 20) << " MiB spilled, " << counter.merge_passes
+             << " merge passes, " << fixed << setprecision(2) << secs << " s" << endl;
+        return true;
+    }
+
+    // Multinomial NB payload of a model file (after the common header):
+    //   i32 doc_count[2], i64 total_words[2], u32 V
+    //   V x { u32 length, word bytes, i32 count[2] }, sorted by word
+    // Words are sorted so two equal models always produce identical files.
+    static bool isModelFile(const string &path) {
+        ifstream in(path, ios::binary);
+        char magic[8];
+        return in.read(magic, 8) && memcmp(magic, model_magic, 8) == 0;
+    }
+
+    static void writeModel(ostream &out, const Model &m) {
+        for (int c = 0; c < 2; ++c) writePod(out, (int32_t)m.doc_count[c]);
+        for (int c = 0; c < 2; ++c) writePod(out, (int64_t)m.total_words[c]);
+        vector<pair<string_view, int>> words(m.vocab.begin(), m.vocab.end());
+        sort(words.begin(), words.end());
+        writePod(out, (uint32_t)words.size());
+        for (const auto &w : words) {
+            writeWord(out, w.first);
+            for (int c = 0; c < 2; ++c) writePod(out, (int32_t)m.word_count[c][w.second]);
+        }
+    }
+
+    static bool readModel(istream &in, Model &m) {
+        uint32_t V;
+        for (int c = 0; c < 2; ++c) {
+            int32_t v;
+            if (!readPod(in, v)) return false;
+            m.doc_count[c] = v;
+        }
+        for (int c = 0; c < 2; ++c) {
+            int64_t v;
+            if (!readPod(in, v)) return false;
+            m.total_words[c] = v;
+        }
+        // Each entry takes at least its length and two counts, so a V the
+        // rest of the file cannot hold is corrupt, not a size to reserve.
+        if (!readPod(in, V) || V > bytesLeft(in) / (sizeof(uint32_t) + 2 * sizeof(int32_t))) return false;
+        m.vocab.reserve(V);
+        string word;
+        for (uint32_t i = 0; i < V; ++i) {
+            if (!readWord(in, word)) return false;
+            int idx = m.addWord(word);
+            for (int c = 0; c < 2; ++c) {
+                int32_t count;
+                if (!readPod(in, count) || count < 0) return false;
+                m.word_count[c][idx] = count;
+                m.log_num[c][idx] = log(count + alpha);
+            }
+        }
+        m.computeDiffRange();
+        m.refresh();
+        return true;
+    }
+
+    // Payload of a quantized model file (ENGINE_QUANTIZED_NB), written by
+    // a frozen classifier:
+    //   i32 doc_count[2], f64 prior[2], f64 log_denom[2], f64 scale[2], u32 V
+    //   V x { u32 length, word bytes }, sorted by word
+    //   V x u32 packed int16 pair, in the same order
+    static void writeQuantized(ostream &out, const QuantizedModel &q) {
+        for (int c = 0; c < 2; ++c) writePod(out, (int32_t)q.doc_count[c]);
+        for (int c = 0; c < 2; ++c) writePod(out, q.prior[c]);
+        for (int c = 0; c < 2; ++c) writePod(out, q.log_denom[c]);
+        for (int c = 0; c < 2; ++c) writePod(out, q.scale[c]);
+        const vector<string_view> &words = q.vocab->words;
+        vector<uint32_t> order(words.size());
+        iota(order.begin(), order.end(), 0u);
+        sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return words[a] < words[b]; });
+        writePod(out, (uint32_t)order.size());
+        for (uint32_t id : order) writeWord(out, words[id]);
+        for (uint32_t id : order) writePod(out, q.packed[id]);
+    }
+
+    static bool readQuantized(istream &in, QuantizedModel &q) {
+        uint32_t V;
+        for (int c = 0; c < 2; ++c) {
+            int32_t v;
+            if (!readPod(in, v) || v < 0) return false;
+            q.doc_count[c] = v;
+        }
+        for (int c = 0; c < 2; ++c) {
+            if (!readPod(in, q.prior[c])) return false;
+        }
+        for (int c = 0; c < 2; ++c) {
+            if (!readPod(in, q.log_denom[c])) return false;
+        }
+        for (int c = 0; c < 2; ++c) {
+            if (!readPod(in, q.scale[c]) || !(q.scale[c] > 0.0)) return false;
+        }
+        // An entry takes at least its length and its packed terms.
+        if (!readPod(in, V) || V > bytesLeft(in) / (2 * sizeof(uint32_t))) return false;
+        q.vocab.reset(new InternTable(V));
+        string word;
+        for (uint32_t i = 0; i < V; ++i) {
+            if (!readWord(in, word) || q.vocab->intern(word) != i) return false; // duplicates are corrupt
+        }
+        q.packed.resize(V);
+        return V == 0 || (bool)in.read(reinterpret_cast<char *>(q.packed.data()), V * sizeof(uint32_t));
+    }
+
+    // The model file image: header, then the engine's, the quantized or
+    // the multinomial NB payload.
+    void writeTo(ostream &out) const {
+        auto cfg = tokenizerConfig();
+        if (auto e = atomic_load(&engine)) {
+            writeModelHeader(out, e->engineId(), cfg->ngram, featureFlags(*cfg));
+            e->write(out);
+        } else if (frozen) {
+            writeModelHeader(out, ENGINE_QUANTIZED_NB, cfg->ngram, featureFlags(*cfg));
+            writeQuantized(out, *atomic_load(&quantized));
+        } else {
+            writeModelHeader(out, ENGINE_MULTINOMIAL_NB, cfg->ngram, featureFlags(*cfg));
+            withSnapshot([&](const Model &m) { writeModel(out, m); });
+        }
+    }
+
+    bool save(const string &path) const {
+        ofstream out(path, ios::binary);
+        if (!out.is_open()) {
+            cerr << "Cannot write model file: " << path << endl;
+            return false;
+        }
+        writeTo(out);
+        return (bool)out;
+    }
+
+    // Size save() would write.
+    size_t fileBytes() const {
+        CountingBuf buf;
+        ostream out(&buf);
+        writeTo(out);
+        return buf.count;
+    }
+
+    // Approximate heap held by the NB tables: both model copies and any
+    // int16 tables (engines are not counted).
+    size_t memoryBytes() {
+        lock_guard<mutex> lk(write_mtx);
+        auto q = atomic_load(&quantized);
+        return models[0].bytes() + models[1].bytes() + (q ? q->bytes() : 0);
+    }
+
+    bool load(const string &path) {
+        ifstream in(path, ios::binary);
+        uint32_t id = ENGINE_MULTINOMIAL_NB, order = 1, features = 0;
+        if (!in.is_open() || !readModelHeader(in, id, order, features)) {
+            cerr << "Cannot load model file: " << path << endl;
+            return false;
+        }
+        auto cfg = make_shared<TokenizerConfig>();
+        cfg->ngram = (int)order;
+        cfg->normalize = features & FEATURE_NORMALIZE;
+        if (id == ENGINE_QUANTIZED_NB) {
+            auto q = make_shared<QuantizedModel>();
+            if (!readQuantized(in, *q) || q->packed.empty() || q->doc_count[0] + q->doc_count[1] == 0) {
+                cerr << "Cannot load model file: " << path << endl;
+                return false;
+            }
+            lock_guard<mutex> lk(write_mtx);
+            if (!editable()) return false;
+            atomic_store(&tokenizer, shared_ptr<const TokenizerConfig>(cfg));
+            installFrozen(q);
+            clog << "Model loaded. Documents: " << q->doc_count[0] + q->doc_count[1]
+                 << ", Vocab size: " << q->packed.size() << " (int16 tables, read-only)" << endl;
+            return true;
+        }
+        if (id != ENGINE_MULTINOMIAL_NB) {
+            shared_ptr<EmailEngine> e(makeEngine(id));
+            if (!e || !e->read(in)) {
+                cerr << "Cannot load model file: " << path << endl;
+                return false;
+            }
+            if (!setEngine(e, cfg)) return false;
+            clog << "Model loaded. Engine: " << e->name() << endl;
+            return true;
+        }
+        Model fresh;
+        if (!readModel(in, fresh) || !fresh.ready()) {
+            cerr << "Cannot load model file: " << path << endl;
+            return false;
+        }
+        lock_guard<mutex> lk(write_mtx);
+        if (!editable()) return false;
+        atomic_store(&tokenizer, shared_ptr<const TokenizerConfig>(cfg));
+        publish([&](Model &m) { m = fresh; });
+        clog << "Model loaded. Documents: " << fresh.doc_count[0] + fresh.doc_count[1]
+             << ", Vocab size: " << fresh.vocabSize() << endl;
+        return true;
+    }
+
+    // Reads a labelled training file through the shared tokenizer.
+    // With prune set, n-grams are filtered as in train().
+    bool loadDocuments(const string &path, vector<pair<int, vector<string>>> &docs,
+                       bool prune = false) {
+        ifstream in(path);
+        if (!in.is_open()) {
+            cerr << "Cannot open training file: " << path << endl;
+            return false;
+        }
+        auto cfg = tokenizerConfig();
+        NgramAdmit admit = prune ? prepareNgramFilter(*cfg, path) : nullptr;
+        string line, text;
+        ClassLabel cls;
+        while (getline(in, line)) {
+            if (parseTrainingLine(line, cls, text)) docs.emplace_back(cls, tokenizeWith(*cfg, text, admit));
+        }
+        return true;
+    }
+
+    // Routes scoring through an alternative engine (nullptr restores the
+    // built-in NB counts). Online updates keep editing the NB counts only.
+    // A loaded engine brings the tokenizer settings it was trained with.
+    bool setEngine(shared_ptr<const EmailEngine> e, shared_ptr<const TokenizerConfig> cfg = nullptr) {
+        lock_guard<mutex> lk(write_mtx);
+        if (!editable()) return false;
+        if (cfg) atomic_store(&tokenizer, cfg);
+        atomic_store(&engine, e);
+        trained = e || models[active.load()].ready();
+        return true;
+    }
+
+    bool trainEngine(const string &trainFile, shared_ptr<EmailEngine> e, unsigned threads) {
+        vector<pair<int, vector<string>>> docs;
+        if (!loadDocuments(trainFile, docs, true)) return false;
+        if (docs.empty()) {
+            cerr << "Empty dataset or vocabulary.\n";
+            return false;
+        }
+        e->fit(docs, threads);
+        if (!setEngine(e)) return false;
+        clog << "Training completed. Engine: " << e->name() << ", Documents: " << docs.size() << endl;
+        return true;
+    }
+
+    // Batch and server modes take either a saved model or a training file.
+    bool loadOrTrain(const string &path) {
+        if (isModelFile(path)) return load(path);
+        train(path);
+        return trained;
+    }
+
+    // Online learning: adds one labelled email in O(tokens).
+    bool update(ClassLabel cls, const string &text) {
+        vector<string> tokens = tokenizeForLearning(text, false);
+        lock_guard<mutex> lk(write_mtx);
+        return publish([&](Model &m) { m.learn(cls, tokens, +1); });
+    }
+
+    // Reverses an earlier update() with the same label and text; tokenized
+    // the same way, so the n-grams it admitted are the ones taken back.
+    bool unlearn(ClassLabel cls, const string &text) {
+        vector<string> tokens = tokenizeForLearning(text, false);
+        lock_guard<mutex> lk(write_mtx);
+        return publish([&](Model &m) { m.learn(cls, tokens, -1); });
+    }
+
+    // Applies many labelled emails as one snapshot swap.
+    bool updateBatch(const vector<pair<ClassLabel, string>> &samples) {
+        vector<pair<ClassLabel, vector<string>>> tokenized;
+        tokenized.reserve(samples.size());
+        for (const auto &s : samples) tokenized.emplace_back(s.first, tokenizeForLearning(s.second, false));
+        return updateTokens(tokenized);
+    }
+
+    // Same, for documents that are already tokenized (e.g. parsed mail).
+    bool updateTokens(const vector<pair<ClassLabel, vector<string>>> &tokenized) {
+        lock_guard<mutex> lk(write_mtx);
+        return publish([&](Model &m) {
+            for (const auto &t : tokenized) m.learn(t.first, t.second, +1);
+        });
+    }
+
+    Prediction classify(string_view text) const {
+        MessageScope scope(text.size());
+        return classifyTokens(tokenizeTraced(text, false));
+    }
+
+    // Classifies a raw RFC 822 message (headers, MIME parts and all).
+    Prediction classifyRaw(string_view raw) const {
+        MessageScope scope(raw.size());
+        return classifyTokens(tokenizeTraced(raw, true));
+    }
+
+    // tokenize() or tokenizeRaw() with parse and tokenize stage timings.
+    // Engines look tokens up inside margin(), so for them lookup time is
+    // part of the score stage.
+    vector<string> tokenizeTraced(string_view text, bool raw) const {
+        vector<string> tokens;
+        if (raw) {
+            thread_local MimeParser parser;
+            thread_local MimeMessage msg;
+            {
+                StageTimer t(STAGE_PARSE);
+                parser.parse(text, msg);
+            }
+            StageTimer t(STAGE_TOKENIZE);
+            tokens = tokenizeMessage(msg);
+        } else {
+            StageTimer t(STAGE_TOKENIZE);
+            tokens = tokenize(text);
+        }
+        if (stats_enabled && active_trace) active_trace->tokens += tokens.size();
+        return tokens;
+    }
+
+    Prediction classifyTokens(const vector<string> &tokens) const {
+        if (!trained) {
+            cerr << "Model not trained.\n";
+            return {LEGIT, 0.0};
+        }
+        if (auto e = atomic_load(&engine)) {
+            StageTimer t(STAGE_SCORE);
+            double m = e->margin(tokens);
+            return {m > 0 ? PHISHING : LEGIT, e->probability(m)};
+        }
+        double log_prob[2];
+        Model::EarlyBounds b;
+        bool early = withSnapshot([&](const Model &m) {
+            // Loaded after pinning m, so the tables match it (see publish()).
+            if (auto q = atomic_load(&quantized)) {
+                q->score(m, tokens, log_prob);
+                return false;
+            }
+            if (early_exit) {
+                StageTimer t(STAGE_SCORE);
+                return m.scoreEarly(tokens, log_prob, &b);
+            }
+            m.score(tokens, log_prob);
+            return false;
+        });
+        if (early) return fromMarginBounds(b.margin_low, b.margin_high);
+        return fromLogProb(log_prob);
+    }
+
+    static Prediction fromMarginBounds(double low, double high) {
+        auto sigmoid = [](double m) { return 1.0 / (1.0 + exp(-m)); };
+        Prediction p{low > 0.0 ? PHISHING : LEGIT, 0.0, true, sigmoid(low), sigmoid(high)};
+        p.p_phishing = p.label == PHISHING ? p.p_low : p.p_high;
+        return p;
+    }
+
+    static Prediction fromLogProb(const double log_prob[2]) {
+        // Convert from log-space to probability
+        double max_log = max(log_prob[PHISHING], log_prob[LEGIT]);
+        double p0 = exp(log_prob[PHISHING] - max_log);
+        double p1 = exp(log_prob[LEGIT] - max_log);
+        ClassLabel label = (log_prob[PHISHING] > log_prob[LEGIT]) ? PHISHING : LEGIT;
+        return {label, p0 / (p0 + p1)};
+    }
+
+    ClassLabel predictLabel(string_view text) const {
+        return classify(text).label;
+    }
+
+    double phishingProbability(string_view text) const {
+        if (!trained) return 0.0;
+        return classify(text).p_phishing;
+    }
+
+    struct BatchResult {
+        ClassLabel label;
+        double p_phishing;
+        double micros;     // wall time spent classifying this email
+        uint64_t campaign; // near-duplicate cluster id, 0 without a cache
+        bool cached;       // verdict came from the near-duplicate cache
+        bool bounded;      // scoring stopped early; see Prediction
+        double p_low, p_high;
+    };
+
+    // Scores tokens, going through the near-duplicate cache when given.
+    Prediction classifyTokens(const vector<string> &tokens, NearDuplicateCache *cache,
+                              uint64_t &campaign, bool &cached) const {
+        campaign = 0;
+        cached = false;
+        if (!cache) return classifyTokens(tokens);
+        uint64_t sig = simHash(tokens);
+        NearDuplicateCache::Hit hit{0, 0.0, 0};
+        if (cache->lookup(sig, tokens.size(), hit)) {
+            Prediction p{static_cast<ClassLabel>(hit.label), hit.p_phishing};
+            if (cache->shouldVerify()) {
+                cache->recordVerification(classifyTokens(tokens).label == p.label);
+            }
+            campaign = hit.campaign;
+            cached = true;
+            return p;
+        }
+        Prediction p = classifyTokens(tokens);
+        campaign = cache->insert(sig, tokens.size(), p.label, p.p_phishing, 0);
+        return p;
+    }
+
+    // Classifies emails[i] into out[i] using every thread of the pool.
+    // With raw set, each email is a full RFC 822 message to MIME-decode.
+    void classifyBatch(const vector<string_view> &emails, vector<BatchResult> &out,
+                       ThreadPool &pool, bool raw = false,
+                       NearDuplicateCache *cache = nullptr) const {
+        out.resize(emails.size());
+        pool.parallelFor(emails.size(), [&](size_t i) {
+            MessageScope scope(emails[i].size());
+            auto t0 = chrono::steady_clock::now();
+            vector<string> tokens = tokenizeTraced(emails[i], raw);
+            uint64_t campaign;
+            bool cached;
+            Prediction p = classifyTokens(tokens, cache, campaign, cached);
+            auto t1 = chrono::steady_clock::now();
+            out[i] = {p.label, p.p_phishing,
+                      chrono::duration<double, micro>(t1 - t0).count(), campaign, cached,
+                      p.bounded, p.p_low, p.p_high};
+        });
+    }
+};
+
+// ---------- Model set ----------
+// Several classifiers (per-tenant, global, shadow, ...) scored against one
+// tokenization of each email. build() merges the members' vocabularies
+// into one shared table; a word's entry lists, for each member that knows
+// the word, that member's log(count + alpha) per class. An email is
+// tokenized once, each token is hashed once, and every member's sums are
+// accumulated from the same list, so memory follows the members' own
+// vocabulary sizes rather than union size times member count. Sums run in
+// token order as in Model::score(), so the verdicts match each member's
+// classify().
+//
+// Like quantize(), the table is a frozen copy: build() again after a
+// member learns or reloads. Members with an engine or quantized tables
+// keep their own scoring and are run on the shared tokens. add() rejects
+// a member whose n-gram order, normalization or domain trie differs from
+// the first member's, since the email is tokenized only once.
+struct ModelSet {
+    using NB = NaiveBayesEmailClassifier;
+
+    struct Member {
+        string name;
+        shared_ptr<const NB> clf;
+        int column = -1; // position in the shared rows, -1 when scored alone
+    };
+
+    struct Posting {
+        uint32_t column;
+        double num[2]; // log(count + alpha) per class
+    };
+
+    vector<Member> members;
+    unordered_map<string, uint32_t> vocab; // union of the fused members' words
+    size_t columns = 0;
+    vector<uint32_t> offsets; // [word] first posting; offsets[words] = postings.size()
+    vector<Posting> postings; // grouped by word, one per member that knows it
+    vector<double> prior;     // [column][class]
+    vector<double> log_denom; // [column][class]
+
+    bool add(const string &name, shared_ptr<const NB> clf) {
+        if (!members.empty()) {
+            const Member &first = members.front();
+            auto a = clf->tokenizerConfig(), b = first.clf->tokenizerConfig();
+            if (a->ngram != b->ngram || a->normalize != b->normalize || !clf->domains.sameAs(first.clf->domains)) {
+                cerr << "Model " << name << " tokenizes differently from " << first.name << endl;
+                return false;
+            }
+        }
+        members.push_back({name, std::move(clf), -1});
+        return true;
+    }
+
+    void build() {
+        vocab.clear();
+        offsets.clear();
+        postings.clear();
+        columns = 0;
+        for (Member &m : members) {
+            bool alone = !m.clf->trained || atomic_load(&m.clf->engine) || atomic_load(&m.clf->quantized);
+            m.column = alone ? -1 : (int)columns++;
+        }
+        prior.assign(columns * 2, 0.0);
+        log_denom.assign(columns * 2, 0.0);
+        vector<pair<uint32_t, Posting>> found; // (word, posting) in member order
+        for (const Member &m : members) {
+            if (m.column < 0) continue;
+            uint32_t col = (uint32_t)m.column;
+            m.clf->withSnapshot([&](const NB::Model &model) {
+                for (const auto &kv : model.vocab) {
+                    uint32_t id = vocab.emplace(kv.first, (uint32_t)vocab.size()).first->second;
+                    found.push_back(
+                        {id, {col, {model.log_num[NB::PHISHING][kv.second], model.log_num[NB::LEGIT][kv.second]}}});
+                }
+                for (int c = 0; c < 2; ++c) {
+                    prior[col * 2 + c] = model.prior[c];
+                    log_denom[col * 2 + c] = model.log_denom[c];
+                }
+            });
+        }
+        // Counting sort by word.
+        offsets.assign(vocab.size() + 1, 0);
+        for (const auto &f : found) offsets[f.first + 1]++;
+        partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+        postings.resize(found.size());
+        vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+        for (const auto &f : found) postings[next[f.first]++] = f.second;
+        size_t bytes = postings.size() * sizeof(Posting) + offsets.size() * sizeof(uint32_t);
+        clog << "Model set: " << members.size() << " models (" << columns << " sharing "
+             << vocab.size() << " words, " << bytes / 1024 << " KiB)" << endl;
+    }
+
+    size_t size() const { return members.size(); }
+
+    // Verdicts in member order for an email tokenized by tokenize().
+    void classifyTokens(const vector<string> &tokens, vector<NB::Prediction> &out) const {
+        out.resize(members.size());
+        thread_local vector<double> sums;
+        thread_local vector<long long> known;
+        sums.assign(columns * 2, 0.0);
+        known.assign(columns, 0);
+        {
+            StageTimer t(STAGE_SCORE);
+            for (const string &w : tokens) {
+                auto it = vocab.find(w);
+                if (it == vocab.end()) continue; // unseen by every member
+                const Posting *p = postings.data() + offsets[it->second], *end = postings.data() + offsets[it->second + 1];
+                for (; p != end; ++p) {
+                    sums[p->column * 2] += p->num[0];
+                    sums[p->column * 2 + 1] += p->num[1];
+                    known[p->column]++;
+                }
+            }
+        }
+        for (size_t i = 0; i < members.size(); ++i) {
+            const Member &m = members[i];
+            if (m.column < 0) {
+                out[i] = m.clf->classifyTokens(tokens);
+                continue;
+            }
+            const double *sum = &sums[(size_t)m.column * 2];
+            double log_prob[2];
+            for (int c = 0; c < 2; ++c) {
+                log_prob[c] = prior[m.column * 2 + c] + sum[c] - known[m.column] * log_denom[m.column * 2 + c];
+            }
+            out[i] = NB::fromLogProb(log_prob);
+        }
+    }
+
+    // With raw set, text is a full RFC 822 message to MIME-decode.
+    void classify(string_view text, vector<NB::Prediction> &out, bool raw = false) const {
+        out.clear();
+        if (members.empty()) return;
+        MessageScope scope(text.size());
+        classifyTokens(members.front().clf->tokenizeTraced(text, raw), out);
+    }
+};
+
+// ---------- Batch input ----------
+// Splits a mapped mbox archive into messages without copying them. A file
+// that does not start with a "From " separator is taken as a single .eml.
+struct MboxScanner {
+    string_view data;
+    size_t pos = 0;
+    bool mbox;
+
+    explicit MboxScanner(string_view d) : data(d), mbox(d.compare(0, 5, "From ") == 0) {}
+
+    bool next(string_view &msg) {
+        if (pos >= data.size()) return false;
+        if (!mbox) {
+            msg = data;
+            pos = data.size();
+            return true;
+        }
+        size_t eol = data.find('\n', pos); // skip the "From " line itself
+        if (eol == string_view::npos) {
+            pos = data.size();
+            return false;
+        }
+        size_t start = eol + 1;
+        size_t end = data.find("\nFrom ", start);
+        if (end == string_view::npos) {
+            msg = data.substr(start);
+            pos = data.size();
+        } else {
+            msg = data.substr(start, end + 1 - start);
+            pos = end + 1;
+        }
+        return true;
+    }
+};
+
+// Pulls one email at a time from a stream: either one email per line, or
+// an mbox archive where each message starts with a "From " line.
+struct EmailStreamReader {
+    istream &in;
+    bool mbox;
+    bool have_pending = false; // already consumed the next message's "From " line
+
+    EmailStreamReader(istream &input, bool isMbox) : in(input), mbox(isMbox) {}
+
+    bool next(string &email) {
+        email.clear();
+        string line;
+        if (!mbox) {
+            while (getline(in, line)) {
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                if (line.empty()) continue;
+                email = std::move(line);
+                return true;
+            }
+            return false;
+        }
+
+        bool started = have_pending;
+        have_pending = false;
+        while (getline(in, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.compare(0, 5, "From ") == 0) {
+                if (started) {
+                    have_pending = true;
+                    return true;
+                }
+                started = true;
+                continue;
+            }
+            if (!started) continue; // junk before the first separator
+            // mboxrd quoting: ">From " lines in bodies lose one '>'
+            size_t q = line.find_first_not_of('>');
+            if (q > 0 && q != string::npos && line.compare(q, 5, "From ") == 0) {
+                line.erase(0, 1);
+            }
+            email += line;
+            email.push_back('\n');
+        }
+        return started;
+    }
+};
+
+// Learns every message of a raw mbox/.eml file under one label.
+bool learnArchive(NaiveBayesEmailClassifier &clf, const string &labelStr, const string &path) {
+    MappedFile file;
+    if (!file.open(path)) {
+        cerr << "Cannot open archive: " << path << endl;
+        return false;
+    }
+    auto cls = clf.labelFromString(labelStr);
+    vector<pair<NaiveBayesEmailClassifier::ClassLabel, vector<string>>> docs;
+    MboxScanner scanner(file.view());
+    string_view msg;
+    size_t learned = 0;
+    while (true) {
+        bool more = scanner.next(msg);
+        if (more) docs.emplace_back(cls, clf.tokenizeForLearning(msg, true));
+        if (docs.size() >= 4096 || (!more && !docs.empty())) {
+            if (!clf.updateTokens(docs)) return false;
+            learned += docs.size();
+            docs.clear();
+            file.release(scanner.pos);
+        }
+        if (!more) break;
+    }
+    clog << "Learned " << learned << " " << clf.labelToString(cls)
+         << " messages from " << path << endl;
+    return true;
+}
+
+// Shared by the training modes: consumes --normalize, --ngrams,
+// --ngram-min or --ngram-sketch-mb at argv[i] and returns true if it did.
+bool parseFeatureOption(NaiveBayesEmailClassifier &clf, int argc, char **argv, int &i) {
+    string arg = argv[i];
+    NaiveBayesEmailClassifier::TokenizerConfig cfg = *clf.tokenizerConfig();
+    if (arg == "--normalize") {
+        cfg.normalize = true;
+        clf.setTokenizer(cfg);
+        return true;
+    }
+    if (i + 1 >= argc) return false;
+    if (arg == "--ngrams") {
+        cfg.ngram = min(8, max(1, atoi(argv[++i])));
+        clf.setTokenizer(cfg);
+    } else if (arg == "--ngram-min") {
+        clf.ngram_min_count = (uint32_t)max(1, atoi(argv[++i]));
+    } else if (arg == "--ngram-sketch-mb") {
+        clf.ngram_sketch_bytes = (size_t)max(1, atoi(argv[++i])) << 20;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Shared by the classifying modes: --slow-us and --slow-sample set up the
+// slow-message log of classifierStats().
+bool parseStatsOption(int argc, char **argv, int &i) {
+    string arg = argv[i];
+    if (i + 1 >= argc) return false;
+    if (arg == "--slow-us") {
+        classifierStats().slow_threshold_ns = (uint64_t)max(0.0, atof(argv[++i])) * 1000;
+    } else if (arg == "--slow-sample") {
+        classifierStats().slow_sample = (uint64_t)max(1, atoi(argv[++i]));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int runTrain(int argc, char **argv) {
+    if (argc < 4) {
+        cerr << "Usage: " << argv[0]
+             << " --train <train> <model> [--engine nb|cnb|lr] [--threads N] [--epochs E]"
+                " [--l2 X] [--domains F] [--learn-mbox <label> <file>]..."
+                " [--ngrams N] [--ngram-min C] [--ngram-sketch-mb M] [--normalize]"
+                " [--memory-mb M] [--spill-dir D] [--quantize]\n";
+        return 2;
+    }
+    NaiveBayesEmailClassifier clf;
+    vector<pair<string, string>> archives;
+    uint32_t engineId = ENGINE_MULTINOMIAL_NB;
+    unsigned threads = max(1u, thread::hardware_concurrency());
+    int epochs = 0;
+    double l2 = -1.0;
+    size_t memoryBudget = 0;
+    string spillDir;
+    bool quantize = false;
+    for (int i = 4; i < argc; ++i) {
+        string arg = argv[i];
+        if (parseFeatureOption(clf, argc, argv, i)) continue;
+        if (arg == "--domains" && i + 1 < argc) {
+            if (!clf.domains.load(argv[++i])) return 1;
+        } else if (arg == "--learn-mbox" && i + 2 < argc) {
+            archives.emplace_back(argv[i + 1], argv[i + 2]);
+            i += 2;
+        } else if (arg == "--engine" && i + 1 < argc) {
+            if (!engineIdFromName(argv[++i], engineId)) {
+                cerr << "Unknown engine: " << argv[i] << endl;
+                return 2;
+            }
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = max(1, atoi(argv[++i]));
+        } else if (arg == "--epochs" && i + 1 < argc) {
+            epochs = max(1, atoi(argv[++i]));
+        } else if (arg == "--l2" && i + 1 < argc) {
+            l2 = atof(argv[++i]);
+        } else if (arg == "--memory-mb" && i + 1 < argc) {
+            memoryBudget = (size_t)max(1, atoi(argv[++i])) << 20;
+        } else if (arg == "--spill-dir" && i + 1 < argc) {
+            spillDir = argv[++i];
+        } else if (arg == "--quantize") {
+            quantize = true;
+        }
+    }
+    if (quantize && engineId != ENGINE_MULTINOMIAL_NB) {
+        cerr << "--quantize only applies to the nb engine\n";
+        return 2;
+    }
+    if (engineId != ENGINE_MULTINOMIAL_NB) {
+        if (!archives.empty()) {
+            cerr << "--learn-mbox only applies to the nb engine\n";
+            return 2;
+        }
+        shared_ptr<EmailEngine> e(makeEngine(engineId));
+        if (auto lr = dynamic_cast<LogisticRegressionEngine *>(e.get())) {
+            if (epochs > 0) lr->epochs = epochs;
+            if (l2 >= 0.0) lr->l2 = l2;
+        }
+        if (!clf.trainEngine(argv[2], e, threads)) return 1;
+    } else if (memoryBudget && !NaiveBayesEmailClassifier::isModelFile(argv[2])) {
+        // Without archives to add or tables to quantize the merged counts
+        // go straight to disk.
+        if (archives.empty() && !quantize) {
+            if (!clf.trainExternal(argv[2], memoryBudget, spillDir, argv[3])) return 1;
+            clog << "Saved model to " << argv[3] << endl;
+            return 0;
+        }
+        if (!clf.trainExternal(argv[2], memoryBudget, spillDir)) return 1;
+    } else if (!clf.loadOrTrain(argv[2])) {
+        return 1;
+    }
+    for (const auto &a : archives) {
+        if (!learnArchive(clf, a.first, a.second)) return 1;
+    }
+    if (quantize) {
+        if (atomic_load(&clf.engine)) {
+            cerr << "--quantize only applies to nb models\n";
+            return 2;
+        }
+        clf.quantize(true);
+    }
+    if (!clf.save(argv[3])) return 1;
+    clog << "Saved model to " << argv[3] << endl;
+    return 0;
+}
+
+// Trains every engine on the same tokenized corpus and compares training
+// time, scoring throughput and held-out accuracy.
+int runBenchEngines(int argc, char **argv) {
+    if (argc < 4) {
+        cerr << "Usage: " << argv[0] << " --bench-engines <train> <heldout> [--threads N]\n";
+        return 2;
+    }
+    unsigned threads = max(1u, thread::hardware_concurrency());
+    for (int i = 4; i + 1 < argc; ++i) {
+        if (string(argv[i]) == "--threads") threads = max(1, atoi(argv[++i]));
+    }
+    using NB = NaiveBayesEmailClassifier;
+    NB clf;
+    vector<pair<int, vector<string>>> train, heldout;
+    if (!clf.loadDocuments(argv[2], train) || !clf.loadDocuments(argv[3], heldout)) return 1;
+    if (train.empty() || heldout.empty()) {
+        cerr << "Empty training or held-out set.\n";
+        return 1;
+    }
+
+    cout << left << setw(22) << "engine" << right << setw(12) << "train_s" << setw(14)
+         << "emails/sec" << setw(10) << "accuracy" << setw(11) << "precision" << setw(9)
+         << "recall" << setw(8) << "f1" << "\n";
+    for (uint32_t id : {ENGINE_MULTINOMIAL_NB, ENGINE_COMPLEMENT_NB, ENGINE_LOGISTIC}) {
+        NB::Model nb;
+        shared_ptr<EmailEngine> e(makeEngine(id));
+        auto t0 = chrono::steady_clock::now();
+        if (e) {
+            e->fit(train, threads);
+        } else {
+            for (const auto &d : train) nb.learn(static_cast<NB::ClassLabel>(d.first), d.second, +1);
+        }
+        auto t1 = chrono::steady_clock::now();
+        vector<double> margins(heldout.size());
+        for (size_t i = 0; i < heldout.size(); ++i) {
+            if (e) {
+                margins[i] = e->margin(heldout[i].second);
+            } else {
+                double lp[2];
+                nb.score(heldout[i].second, lp);
+                margins[i] = lp[0] - lp[1];
+            }
+        }
+        auto t2 = chrono::steady_clock::now();
+
+        size_t tp = 0, fp = 0, fn = 0, correct = 0;
+        for (size_t i = 0; i < heldout.size(); ++i) {
+            bool predicted = margins[i] > 0, actual = heldout[i].first == NB::PHISHING;
+            correct += predicted == actual;
+            tp += predicted && actual;
+            fp += predicted && !actual;
+            fn += !predicted && actual;
+        }
+        double precision = tp + fp ? (double)tp / (tp + fp) : 0.0;
+        double recall = tp + fn ? (double)tp / (tp + fn) : 0.0;
+        double f1 = precision + recall > 0 ? 2 * precision * recall / (precision + recall) : 0.0;
+        double score_secs = max(chrono::duration<double>(t2 - t1).count(), 1e-9);
+        cout << left << setw(22) << (e ? e->name() : "multinomial-nb") << right << fixed
+             << setprecision(3) << setw(12) << chrono::duration<double>(t1 - t0).count()
+             << setprecision(0) << setw(14) << heldout.size() / score_secs << setprecision(4)
+             << setw(10) << (double)correct / heldout.size() << setw(11) << precision
+             << setw(9) << recall << setw(8) << f1 << "\n";
+    }
+    return 0;
+}
+
+string jsonEscape(string_view s) {
+    string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        if ((unsigned char)c < 0x20) {
+            char hex[8];
+            snprintf(hex, sizeof hex, "\\u%04x", c);
+            out += hex;
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+// Confusion counts with phishing as the positive class.
+struct Confusion {
+    size_t tp = 0, fp = 0, fn = 0, tn = 0;
+
+    void add(bool predicted, bool actual) {
+        tp += predicted && actual;
+        fp += predicted && !actual;
+        fn += !predicted && actual;
+        tn += !predicted && !actual;
+    }
+    double precision() const { return tp + fp ? (double)tp / (tp + fp) : 0.0; }
+    double recall() const { return tp + fn ? (double)tp / (tp + fn) : 0.0; }
+    double f1() const {
+        double p = precision(), r = recall();
+        return p + r > 0 ? 2 * p * r / (p + r) : 0.0;
+    }
+    double accuracy() const {
+        size_t n = tp + fp + fn + tn;
+        return n ? (double)(tp + tn) / n : 0.0;
+    }
+};
+
+// ROC-AUC of margins (higher = more phishing) via the Mann-Whitney rank
+// sum; tied margins share their average rank. NaN when only one class
+// is present and the AUC is undefined.
+double rocAuc(vector<pair<double, bool>> scored) {
+    sort(scored.begin(), scored.end());
+    double rank_sum = 0.0;
+    size_t positives = 0;
+    for (size_t i = 0; i < scored.size();) {
+        size_t j = i;
+        while (j < scored.size() && scored[j].first == scored[i].first) ++j;
+        double rank = (i + 1 + j) / 2.0;
+        for (size_t k = i; k < j; ++k) {
+            if (scored[k].second) {
+                rank_sum += rank;
+                positives++;
+            }
+        }
+        i = j;
+    }
+    size_t negatives = scored.size() - positives;
+    if (!positives || !negatives) return numeric_limits<double>::quiet_NaN();
+    return (rank_sum - positives * (positives + 1) / 2.0) / ((double)positives * negatives);
+}
+
+// k-fold cross-validation of the multinomial NB model. The file is read
+// and tokenized once; every fold trains on references into that shared
+// corpus and folds run in parallel. With --ngram-min each fold builds its
+// own pruning sketch from its training documents only, so held-out
+// counts never influence which n-grams are learned, and held-out emails
+// are scored unpruned as in production. Results go to stdout as one JSON
+// object so runs from different builds can be diffed or plotted.
+int runEval(int argc, char **argv) {
+    if (argc < 3) {
+        cerr << "Usage: " << argv[0]
+             << " --eval <labelled> [--folds K] [--threads N] [--seed S] [--domains F]"
+                " [--ngrams N] [--ngram-min C] [--ngram-sketch-mb M] [--normalize]\n";
+        return 2;
+    }
+    using NB = NaiveBayesEmailClassifier;
+    NB clf;
+    string path = argv[2];
+    size_t folds = 5;
+    unsigned threads = max(1u, thread::hardware_concurrency());
+    uint64_t seed = 1;
+    for (int i = 3; i < argc; ++i) {
+        string arg = argv[i];
+        if (parseFeatureOption(clf, argc, argv, i)) continue;
+        if (arg == "--folds" && i + 1 < argc) {
+            folds = max(2, atoi(argv[++i]));
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = max(1, atoi(argv[++i]));
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--domains" && i + 1 < argc) {
+            if (!clf.domains.load(argv[++i])) return 1;
+        }
+    }
+
+    ifstream in(path);
+    if (!in.is_open()) {
+        cerr << "Cannot open training file: " << path << endl;
+        return 1;
+    }
+    vector<pair<int, string>> lines;
+    string line, text;
+    NB::ClassLabel cls;
+    while (getline(in, line)) {
+        if (clf.parseTrainingLine(line, cls, text)) lines.emplace_back(cls, move(text));
+    }
+    in.close();
+    if (lines.size() < folds) {
+        cerr << "Need at least " << folds << " labelled emails.\n";
+        return 1;
+    }
+    auto cfg = clf.tokenizerConfig();
+    bool prune = cfg->ngram > 1 && clf.ngram_min_count > 1;
+
+    ThreadPool pool(threads - 1);
+    using Clock = chrono::steady_clock;
+    auto nanos = [](Clock::time_point a, Clock::time_point b) {
+        return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(b - a).count();
+    };
+
+    // Tokenize once; per-document times are summed so ns/token is a
+    // per-core cost independent of the thread count.
+    vector<pair<int, vector<string>>> docs(lines.size());
+    vector<pair<size_t, size_t>> ngram_spans(lines.size());
+    atomic<uint64_t> tokenize_ns{0};
+    auto t0 = Clock::now();
+    pool.parallelFor(lines.size(), [&](size_t i) {
+        auto s = Clock::now();
+        docs[i] = {lines[i].first, clf.tokenizeWith(*cfg, lines[i].second, nullptr, &ngram_spans[i])};
+        tokenize_ns += nanos(s, Clock::now());
+    });
+    double tokenize_wall = chrono::duration<double>(Clock::now() - t0).count();
+    uint64_t bytes = 0, tokens = 0;
+    for (size_t i = 0; i < docs.size(); ++i) {
+        bytes += lines[i].second.size();
+        tokens += docs[i].second.size();
+    }
+    lines = {};
+
+    // Stratified assignment: shuffle each class, then deal round-robin.
+    vector<size_t> fold_of(docs.size());
+    mt19937_64 rng(seed);
+    for (int c = 0; c < 2; ++c) {
+        vector<size_t> members;
+        for (size_t i = 0; i < docs.size(); ++i) {
+            if (docs[i].first == c) members.push_back(i);
+        }
+        shuffle(members.begin(), members.end(), rng);
+        for (size_t k = 0; k < members.size(); ++k) fold_of[members[k]] = (k + c) % folds;
+    }
 
-    // Basic lowercase + alphanumeric tokenizer
-    vector<string> tokenize(const string &text) const {
-        string clean;
-        clean.reserve(text.size());
-        for (char c : text) {
-            if (isalpha(static_cast<unsigned char>(c))) {
-                clean.push_back(tolower(static_cast<unsigned char>(c)));
-            } else if (isdigit(static_cast<unsigned char>(c))) {
-                clean.push_back(c);
-            } else {
-                clean.push_back(' ');
+    struct FoldResult {
+        Confusion confusion;
+        double auc = 0.0;
+        uint64_t train_ns = 0, train_tokens = 0, score_ns = 0, score_tokens = 0;
+        size_t vocab = 0, scored = 0;
+    };
+    vector<FoldResult> results(folds);
+    vector<double> margins(docs.size());
+    t0 = Clock::now();
+    pool.parallelFor(folds, [&](size_t f) {
+        FoldResult &r = results[f];
+        NB::Model model;
+        auto s = Clock::now();
+        unique_ptr<CountMinSketch> sketch;
+        if (prune) {
+            sketch.reset(new CountMinSketch(clf.ngram_sketch_bytes));
+            for (size_t i = 0; i < docs.size(); ++i) {
+                if (fold_of[i] == f) continue;
+                for (size_t k = ngram_spans[i].first; k < ngram_spans[i].second; ++k) sketch->add(docs[i].second[k]);
             }
         }
-        vector<string> tokens;
-        stringstream ss(clean);
-        string tok;
-        while (ss >> tok) {
-            tokens.push_back(tok);
+        vector<string> kept;
+        for (size_t i = 0; i < docs.size(); ++i) {
+            if (fold_of[i] == f) continue;
+            const vector<string> *doc = &docs[i].second;
+            if (sketch) {
+                kept.clear();
+                for (size_t k = 0; k < doc->size(); ++k) {
+                    bool ngram = k >= ngram_spans[i].first && k < ngram_spans[i].second;
+                    if (!ngram || sketch->estimate((*doc)[k]) >= clf.ngram_min_count) kept.push_back((*doc)[k]);
+                }
+                doc = &kept;
+            }
+            model.learn(static_cast<NB::ClassLabel>(docs[i].first), *doc, +1);
+            r.train_tokens += doc->size();
         }
-        return tokens;
+        auto e = Clock::now();
+        r.train_ns = nanos(s, e);
+        r.vocab = model.vocabSize();
+        vector<pair<double, bool>> scored;
+        for (size_t i = 0; i < docs.size(); ++i) {
+            if (fold_of[i] != f) continue;
+            double lp[2];
+            model.score(docs[i].second, lp);
+            margins[i] = lp[NB::PHISHING] - lp[NB::LEGIT];
+            bool actual = docs[i].first == NB::PHISHING;
+            r.confusion.add(margins[i] > 0, actual);
+            scored.emplace_back(margins[i], actual);
+            r.score_tokens += docs[i].second.size();
+        }
+        r.score_ns = nanos(e, Clock::now());
+        r.scored = scored.size();
+        r.auc = rocAuc(move(scored));
+    });
+    double folds_wall = chrono::duration<double>(Clock::now() - t0).count();
+
+    Confusion total;
+    vector<pair<double, bool>> pooled;
+    uint64_t train_ns = 0, train_tokens = 0, score_ns = 0, score_tokens = 0;
+    for (size_t i = 0; i < docs.size(); ++i) {
+        bool actual = docs[i].first == NB::PHISHING;
+        total.add(margins[i] > 0, actual);
+        pooled.emplace_back(margins[i], actual);
+    }
+    for (const auto &r : results) {
+        train_ns += r.train_ns;
+        train_tokens += r.train_tokens;
+        score_ns += r.score_ns;
+        score_tokens += r.score_tokens;
     }
 
-    ClassLabel labelFromString(const string &s) {
-        if (s == "phishing" || s == "spam" || s == "malicious") {
-            return PHISHING;
+    auto perToken = [](uint64_t ns, uint64_t n) { return n ? (double)ns / n : 0.0; };
+    auto perSec = [](size_t n, uint64_t ns) { return ns ? n * 1e9 / ns : 0.0; };
+    auto aucJson = [](double auc) {
+        ostringstream o;
+        if (isnan(auc)) o << "null";
+        else o << fixed << setprecision(6) << auc;
+        return o.str();
+    };
+    auto confusionJson = [](const Confusion &c) {
+        ostringstream o;
+        o << fixed << setprecision(6) << "\"confusion\": {\"tp\": " << c.tp << ", \"fp\": " << c.fp
+          << ", \"fn\": " << c.fn << ", \"tn\": " << c.tn << "}, \"accuracy\": " << c.accuracy()
+          << ", \"precision\": " << c.precision() << ", \"recall\": " << c.recall()
+          << ", \"f1\": " << c.f1();
+        return o.str();
+    };
+
+    cout << fixed << setprecision(6);
+    cout << "{\n  \"file\": \"" << jsonEscape(path) << "\", \"emails\": " << docs.size()
+         << ", \"tokens\": " << tokens << ", \"bytes\": " << bytes << ", \"folds\": " << folds
+         << ", \"threads\": " << threads << ", \"seed\": " << seed << ", \"ngram\": " << cfg->ngram
+         << ",\n";
+    cout << "  \"overall\": {" << confusionJson(total) << ", \"roc_auc\": " << aucJson(rocAuc(move(pooled)))
+         << "},\n";
+    cout << "  \"per_fold\": [\n";
+    for (size_t f = 0; f < folds; ++f) {
+        const FoldResult &r = results[f];
+        cout << "    {\"fold\": " << f << ", \"emails\": " << r.scored << ", \"vocab\": " << r.vocab
+             << ", " << confusionJson(r.confusion) << ", \"roc_auc\": " << aucJson(r.auc)
+             << ", \"train_ns_per_token\": " << perToken(r.train_ns, r.train_tokens)
+             << ", \"score_ns_per_token\": " << perToken(r.score_ns, r.score_tokens) << "}"
+             << (f + 1 < folds ? "," : "") << "\n";
+    }
+    cout << "  ],\n";
+    cout << "  \"timing\": {\n"
+         << "    \"tokenize\": {\"wall_s\": " << tokenize_wall
+         << ", \"ns_per_token\": " << perToken(tokenize_ns, tokens)
+         << ", \"emails_per_sec\": " << perSec(docs.size(), tokenize_ns)
+         << ", \"mb_per_sec\": " << (tokenize_ns ? bytes * 1e3 / tokenize_ns : 0.0) << "},\n"
+         << "    \"train\": {\"ns_per_token\": " << perToken(train_ns, train_tokens)
+         << ", \"emails_per_sec\": " << perSec(docs.size() * (folds - 1), train_ns) << "},\n"
+         << "    \"score\": {\"ns_per_token\": " << perToken(score_ns, score_tokens)
+         << ", \"emails_per_sec\": " << perSec(docs.size(), score_ns) << "},\n"
+         << "    \"folds_wall_s\": " << folds_wall << "\n  },\n";
+    cout << "  \"peak_rss_kib\": " << peakRssKiB() << "\n}\n";
+    return 0;
+}
+
+int runBatch(int argc, char **argv) {
+    if (argc < 3) {
+        cerr << "Usage: " << argv[0]
+             << " --batch <train> [input|-] [--threads N] [--chunk N] [--mbox]"
+                " [--learn-mbox <label> <file>]... [--domains F]"
+                " [--dedup N] [--dedup-distance D] [--quantize] [--early-exit]"
+                " [--ngrams N] [--ngram-min C] [--ngram-sketch-mb M] [--normalize]"
+                " [--slow-us U] [--slow-sample K]\n";
+        return 2;
+    }
+    string trainFile = argv[2];
+    string inputFile = "-";
+    bool inputSet = false;
+    unsigned threads = max(1u, thread::hardware_concurrency());
+    size_t chunk = 4096;
+    bool mbox = false;
+    vector<pair<string, string>> archives;
+    string domainFile;
+    size_t dedupCapacity = 0;
+    int dedupDistance = 3;
+    bool quantize = false;
+    NaiveBayesEmailClassifier clf;
+    for (int i = 3; i < argc; ++i) {
+        string arg = argv[i];
+        if (parseFeatureOption(clf, argc, argv, i) || parseStatsOption(argc, argv, i)) continue;
+        if (arg == "--threads" && i + 1 < argc) {
+            threads = max(1, atoi(argv[++i]));
+        } else if (arg == "--chunk" && i + 1 < argc) {
+            chunk = max(1, atoi(argv[++i]));
+        } else if (arg == "--mbox") {
+            mbox = true;
+        } else if (arg == "--learn-mbox" && i + 2 < argc) {
+            archives.emplace_back(argv[i + 1], argv[i + 2]);
+            i += 2;
+        } else if (arg == "--domains" && i + 1 < argc) {
+            domainFile = argv[++i];
+        } else if (arg == "--dedup" && i + 1 < argc) {
+            dedupCapacity = max(0, atoi(argv[++i]));
+        } else if (arg == "--quantize") {
+            quantize = true;
+        } else if (arg == "--early-exit") {
+            clf.early_exit = true;
+        } else if (arg == "--dedup-distance" && i + 1 < argc) {
+            dedupDistance = max(0, atoi(argv[++i]));
+        } else if (arg.compare(0, 2, "--") == 0) {
+            cerr << "Unknown option or missing value: " << arg << endl;
+            return 2;
+        } else if (!inputSet) {
+            inputFile = arg;
+            inputSet = true;
+        } else {
+            cerr << "Unexpected argument: " << arg << endl;
+            return 2;
         }
-        return LEGIT;
     }
 
-    string labelToString(ClassLabel c) const {
-        return (c == PHISHING) ? "PHISHING" : "LEGIT";
+    // Domain features are part of the vocabulary, so load before training.
+    if (!domainFile.empty() && !clf.domains.load(domainFile)) return 1;
+    if (!clf.loadOrTrain(trainFile)) return 1;
+    for (const auto &a : archives) {
+        if (!learnArchive(clf, a.first, a.second)) return 1;
     }
+    if (quantize) clf.quantize(true);
 
-    void train(const string &trainFile) {
-        // First pass: build vocabulary and count words per class
-        ifstream in(trainFile);
-        if (!in.is_open()) {
-            cerr << "Cannot open training file: " << trainFile << endl;
-            return;
+    // Archives on disk are mapped and scanned in place; anything else
+    // (plain text, stdin) goes through the stream reader.
+    bool mapped = mbox && inputFile != "-";
+    MappedFile map;
+    ifstream file;
+    if (mapped) {
+        if (!map.open(inputFile)) {
+            cerr << "Cannot open input file: " << inputFile << endl;
+            return 1;
         }
+    } else if (inputFile != "-") {
+        file.open(inputFile, ios::binary);
+        if (!file.is_open()) {
+            cerr << "Cannot open input file: " << inputFile << endl;
+            return 1;
+        }
+    }
+    MboxScanner scanner(map.view());
+    EmailStreamReader reader(inputFile == "-" ? cin : file, mbox);
 
-        // Temporary counts: wordIndex -> count per class
-        vector<unordered_map<int, int>> word_counts(2);
-        string line;
+    unique_ptr<NearDuplicateCache> cache;
+    if (dedupCapacity > 0) cache.reset(new NearDuplicateCache(dedupCapacity, dedupDistance));
 
-        while (getline(in, line)) {
-            if (line.empty()) continue;
-            string labelStr;
-            string text;
+    // The caller thread works too, so spawn one worker fewer.
+    ThreadPool pool(threads - 1);
+    vector<string> owned;
+    vector<string_view> emails;
+    vector<NaiveBayesEmailClassifier::BatchResult> results;
+    owned.reserve(chunk);
+    emails.reserve(chunk);
+    size_t index = 0, bytes = 0;
+    size_t label_count[2] = {0, 0};
 
-            // Split label and text at first whitespace
-            stringstream ss(line);
-            if (!(ss >> labelStr)) continue;
-            getline(ss, text); // rest of line
-            if (!text.empty() && text[0] == ' ') text.erase(text.begin());
+    cout << fixed << setprecision(4);
+    auto start = chrono::steady_clock::now();
+    // Memory stays bounded by one chunk of input and results.
+    while (true) {
+        owned.clear();
+        emails.clear();
+        if (mapped) {
+            string_view msg;
+            while (emails.size() < chunk && scanner.next(msg)) emails.push_back(msg);
+        } else {
+            string email;
+            while (owned.size() < chunk && reader.next(email)) owned.push_back(std::move(email));
+            emails.assign(owned.begin(), owned.end());
+        }
+        if (emails.empty()) break;
+        for (string_view e : emails) bytes += e.size();
 
-            ClassLabel cls = labelFromString(labelStr);
-            doc_count[cls]++;
+        clf.classifyBatch(emails, results, pool, mbox, cache.get());
+        for (const auto &r : results) {
+            label_count[r.label]++;
+            cout << index++ << '\t' << clf.labelToString(r.label) << '\t'
+                 << r.p_phishing << '\t' << setprecision(1) << r.micros
+                 << setprecision(4);
+            if (cache) cout << '\t' << r.campaign << '\t' << (r.cached ? 'H' : 'M');
+            if (clf.early_exit) {
+                if (r.bounded) cout << "\t[" << r.p_low << ',' << r.p_high << ']';
+                else cout << "\t-";
+            }
+            cout << '\n';
+        }
+        if (mapped) map.release(scanner.pos);
+    }
+    cout.flush();
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    secs = max(secs, 1e-9);
 
-            vector<string> tokens = tokenize(text);
-            for (const string &w : tokens) {
-                int idx;
-                auto it = vocab.find(w);
-                if (it == vocab.end()) {
-                    idx = (int)vocab.size();
-                    vocab[w] = idx;
-                } else {
-                    idx = it->second;
+    cerr << fixed << setprecision(2)
+         << "Classified " << index << " emails (" << label_count[0]
+         << " phishing, " << label_count[1] << " legit) in " << secs << " s\n"
+         << "Throughput: " << index / secs << " emails/sec, "
+         << bytes / secs / (1024.0 * 1024.0) << " MB/sec with "
+         << threads << " threads\n";
+    if (cache) cache->report(cerr);
+    if (stats_enabled) classifierStats().report(cerr);
+    return 0;
+}
+
+// Classifies every email with several models through one ModelSet. Each
+// output line is the email index followed by label and P(phishing) per
+// model, in command-line order.
+int runModelSet(int argc, char **argv) {
+    if (argc < 4) {
+        cerr << "Usage: " << argv[0]
+             << " --models <input|-> <model|train>... [--threads N] [--chunk N] [--mbox]"
+                " [--domains F] [--compare]\n";
+        return 2;
+    }
+    using NB = NaiveBayesEmailClassifier;
+    string inputFile = argv[2];
+    vector<string> modelFiles;
+    unsigned threads = max(1u, thread::hardware_concurrency());
+    size_t chunk = 4096;
+    bool mbox = false, compare = false;
+    string domainFile;
+    for (int i = 3; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            threads = max(1, atoi(argv[++i]));
+        } else if (arg == "--chunk" && i + 1 < argc) {
+            chunk = max(1, atoi(argv[++i]));
+        } else if (arg == "--mbox") {
+            mbox = true;
+        } else if (arg == "--domains" && i + 1 < argc) {
+            domainFile = argv[++i];
+        } else if (arg == "--compare") {
+            compare = true;
+        } else {
+            modelFiles.push_back(arg);
+        }
+    }
+    if (modelFiles.empty()) {
+        cerr << "No models given.\n";
+        return 2;
+    }
+
+    ModelSet set;
+    for (const string &path : modelFiles) {
+        auto clf = make_shared<NB>();
+        if (!domainFile.empty() && !clf->domains.load(domainFile)) return 1;
+        if (!clf->loadOrTrain(path)) return 1;
+        if (!set.add(path, clf)) return 1;
+    }
+    set.build();
+
+    ifstream file;
+    if (inputFile != "-") {
+        file.open(inputFile, ios::binary);
+        if (!file.is_open()) {
+            cerr << "Cannot open input file: " << inputFile << endl;
+            return 1;
+        }
+    }
+    EmailStreamReader reader(inputFile == "-" ? cin : file, mbox);
+
+    ThreadPool pool(threads - 1);
+    size_t M = set.size();
+    vector<string> emails;
+    vector<vector<NB::Prediction>> verdicts;
+    vector<size_t> phishing(M, 0), disagree(M, 0);
+    size_t index = 0;
+    double secs_set = 0.0, secs_each = 0.0;
+
+    cout << fixed << setprecision(4);
+    while (true) {
+        emails.clear();
+        string email;
+        while (emails.size() < chunk && reader.next(email)) emails.push_back(std::move(email));
+        if (emails.empty()) break;
+        verdicts.resize(emails.size());
+
+        auto t0 = chrono::steady_clock::now();
+        pool.parallelFor(emails.size(), [&](size_t i) { set.classify(emails[i], verdicts[i], mbox); });
+        auto t1 = chrono::steady_clock::now();
+        secs_set += chrono::duration<double>(t1 - t0).count();
+
+        if (compare) {
+            // The per-model path: every model tokenizes the email again.
+            vector<vector<NB::ClassLabel>> each(emails.size(), vector<NB::ClassLabel>(M));
+            pool.parallelFor(emails.size(), [&](size_t i) {
+                for (size_t k = 0; k < M; ++k) {
+                    const NB &clf = *set.members[k].clf;
+                    each[i][k] = (mbox ? clf.classifyRaw(emails[i]) : clf.classify(emails[i])).label;
                 }
-                word_counts[cls][idx]++;
-                total_words[cls]++;
+            });
+            secs_each += chrono::duration<double>(chrono::steady_clock::now() - t1).count();
+            for (size_t i = 0; i < emails.size(); ++i) {
+                for (size_t k = 0; k < M; ++k) disagree[k] += each[i][k] != verdicts[i][k].label;
             }
         }
-        in.close();
 
-        int V = (int)vocab.size();
-        if (V == 0 || (doc_count[0] + doc_count[1]) == 0) {
-            cerr << "Empty dataset or vocabulary.\n";
-            return;
+        for (const auto &v : verdicts) {
+            cout << index++;
+            for (size_t k = 0; k < M; ++k) {
+                phishing[k] += v[k].label == NB::PHISHING;
+                cout << '\t' << set.members[k].clf->labelToString(v[k].label) << '\t' << v[k].p_phishing;
+            }
+            cout << '\n';
         }
+    }
+    cout.flush();
 
-        // Compute priors
-        int total_docs = doc_count[0] + doc_count[1];
-        prior[PHISHING] = log((double)doc_count[PHISHING] / total_docs);
-        prior[LEGIT]    = log((double)doc_count[LEGIT] / total_docs);
+    secs_set = max(secs_set, 1e-9);
+    cerr << fixed << setprecision(2) << "Classified " << index << " emails with " << M
+         << " models in " << secs_set << " s (" << index / secs_set << " emails/sec, "
+         << threads << " threads)\n";
+    for (size_t k = 0; k < M; ++k) {
+        cerr << "  " << set.members[k].name << ": " << phishing[k] << " phishing";
+        if (compare) cerr << ", " << disagree[k] << " disagreements";
+        cerr << '\n';
+    }
+    if (compare) {
+        secs_each = max(secs_each, 1e-9);
+        cerr << "Per-model classify(): " << secs_each << " s (" << index / secs_each
+             << " emails/sec); model set is " << secs_each / secs_set << "x faster\n";
+    }
+    if (stats_enabled) classifierStats().report(cerr);
+    return 0;
+}
 
-        // Allocate likelihoods
-        log_likelihood.assign(2, vector<double>(V, 0.0));
+// ---------- Classification daemon ----------
+#ifdef __linux__
+// Wire protocol on the Unix socket (native byte order):
+//   request:  u32 length, u8 type, payload[length - 1]
+//   response: u32 length, u8 status (0 = ok, 1 = error), body[length - 1]
+// Request types:
+//   'C' classify one plain-text email   -> u8 label (0 = phishing), f64 P(phishing)
+//   'M' classify a raw RFC 822 message  -> same
+//   'L' reload the model from the path it was started with; payload
+//       must be empty (or that same path) -> text
+//   'S' server statistics -> text
+// A connection has at most one request in flight; clients that want
+// concurrency open more connections.
+namespace daemon_io {
 
-        // Laplace smoothing
-        const double alpha = 1.0;
+bool writeAll(int fd, const char *data, size_t n) {
+    while (n > 0) {
+        ssize_t w = send(fd, data, n, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        data += w;
+        n -= (size_t)w;
+    }
+    return true;
+}
 
-        for (int c = 0; c < 2; ++c) {
-            for (int i = 0; i < V; ++i) {
-                int count_wc = 0;
-                auto it = word_counts[c].find(i);
-                if (it != word_counts[c].end()) {
-                    count_wc = it->second;
-                }
-                double num = count_wc + alpha;
-                double denom = total_words[c] + alpha * V;
-                log_likelihood[c][i] = log(num / denom);
+bool readAll(int fd, char *data, size_t n) {
+    while (n > 0) {
+        ssize_t r = recv(fd, data, n, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        data += r;
+        n -= (size_t)r;
+    }
+    return true;
+}
+
+string frame(char head, string_view body) {
+    uint32_t len = (uint32_t)body.size() + 1;
+    string out(sizeof(len), '\0');
+    memcpy(&out[0], &len, sizeof(len));
+    out.push_back(head);
+    out.append(body);
+    return out;
+}
+
+bool unixAddress(const string &path, sockaddr_un &addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        cerr << "Socket path too long: " << path << endl;
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+} // namespace daemon_io
+
+atomic<bool> daemon_reload_requested{false};
+atomic<bool> daemon_stop_requested{false};
+int daemon_wake_fd = -1;
+
+void daemonSignal(int sig) {
+    if (sig == SIGHUP) daemon_reload_requested = true;
+    else daemon_stop_requested = true;
+    uint64_t one = 1;
+    ssize_t ignored = write(daemon_wake_fd, &one, sizeof(one));
+    (void)ignored;
+}
+
+struct ClassifierDaemon {
+    static constexpr uint32_t max_request = 64u << 20;
+    // Input buffered from a stalled client (see stalled()); past this the
+    // connection is not read until it can make progress again.
+    static constexpr size_t max_read_ahead = 1u << 20;
+    // Replies queued for a client that is not reading them; past this no
+    // further requests of the connection are answered.
+    static constexpr size_t max_write_behind = 1u << 20;
+
+    struct Connection {
+        int fd;
+        string in, out;
+        size_t in_off = 0;       // start of the first unconsumed request in `in`
+        size_t out_off = 0;
+        bool busy = false;       // a request is with the workers
+        bool want_write = false; // EPOLLOUT registered
+        bool paused = false;     // EPOLLIN dropped until the connection is no longer stalled
+        bool closed = false;
+    };
+
+    // Fixed at startup: 'L' and SIGHUP reread model_path, never another file.
+    string socket_path, model_path, domain_path;
+    bool quantize = false;
+    bool early_exit = false;
+
+    // Readers take a reference with atomic_load; a reload swaps in a new
+    // model and the old one is freed when its last in-flight request ends.
+    shared_ptr<NaiveBayesEmailClassifier> model;
+
+    int listen_fd = -1, epoll_fd = -1, wake_fd = -1;
+    unordered_map<int, shared_ptr<Connection>> conns;
+
+    mutex job_mtx;
+    condition_variable job_cv;
+    deque<function<void()>> jobs;
+    bool stopping = false;
+    vector<thread> workers;
+
+    mutex done_mtx;
+    vector<pair<shared_ptr<Connection>, string>> done;
+
+    atomic<uint64_t> served{0}, failed{0}, reloads{0};
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+
+    shared_ptr<NaiveBayesEmailClassifier> loadModel(const string &path) {
+        auto m = make_shared<NaiveBayesEmailClassifier>();
+        if (!domain_path.empty() && !m->domains.load(domain_path)) return nullptr;
+        if (!m->loadOrTrain(path)) return nullptr;
+        if (quantize) m->quantize(true);
+        m->early_exit = early_exit;
+        return m;
+    }
+
+    void submit(function<void()> job) {
+        {
+            lock_guard<mutex> lk(job_mtx);
+            jobs.push_back(std::move(job));
+        }
+        job_cv.notify_one();
+    }
+
+    void workerLoop() {
+        while (true) {
+            function<void()> job;
+            {
+                unique_lock<mutex> lk(job_mtx);
+                job_cv.wait(lk, [&] { return stopping || !jobs.empty(); });
+                if (jobs.empty()) return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
             }
+            job();
         }
+    }
 
-        trained = true;
-        cout << "Training completed. Documents: " << total_docs
-             << ", Vocab size: " << V << endl;
+    void wake() {
+        uint64_t one = 1;
+        ssize_t ignored = write(wake_fd, &one, sizeof(one));
+        (void)ignored;
     }
 
-    ClassLabel predictLabel(const string &text) const {
-        if (!trained) {
-            cerr << "Model not trained.\n";
-            return LEGIT;
+    void complete(const shared_ptr<Connection> &conn, string response) {
+        {
+            lock_guard<mutex> lk(done_mtx);
+            done.emplace_back(conn, std::move(response));
         }
-        vector<string> tokens = tokenize(text);
-        double log_prob[2] = {prior[PHISHING], prior[LEGIT]};
+        wake();
+    }
 
-        for (const string &w : tokens) {
-            auto it = vocab.find(w);
-            if (it == vocab.end()) continue; // unseen word
-            int idx = it->second;
-            log_prob[PHISHING] += log_likelihood[PHISHING][idx];
-            log_prob[LEGIT]    += log_likelihood[LEGIT][idx];
+    string reload() {
+        auto fresh = loadModel(model_path);
+        if (!fresh) {
+            failed++;
+            return daemon_io::frame(1, "reload failed: " + model_path);
         }
+        atomic_store(&model, fresh);
+        reloads++;
+        clog << "Reloaded model from " << model_path << endl;
+        return daemon_io::frame(0, "reloaded " + model_path);
+    }
 
-        return (log_prob[PHISHING] > log_prob[LEGIT]) ? PHISHING : LEGIT;
+    string stats() {
+        ostringstream os;
+        double up = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        os << "uptime_sec " << fixed << setprecision(1) << up << "\n"
+           << "requests " << served.load() << "\n"
+           << "errors " << failed.load() << "\n"
+           << "reloads " << reloads.load() << "\n"
+           << "connections " << conns.size() << "\n"
+           << "workers " << workers.size() << "\n";
+        if (stats_enabled) classifierStats().report(os);
+        return os.str();
     }
 
-    double phishingProbability(const string &text) const {
-        if (!trained) return 0.0;
-        vector<string> tokens = tokenize(text);
-        double log_prob[2] = {prior[PHISHING], prior[LEGIT]};
+    // Runs on a worker thread.
+    string handle(char type, const string &payload) {
+        if (type == 'C' || type == 'M') {
+            auto m = atomic_load(&model);
+            auto p = type == 'C' ? m->classify(payload) : m->classifyRaw(payload);
+            string body(1, static_cast<char>(p.label));
+            body.append(reinterpret_cast<const char *>(&p.p_phishing), sizeof(double));
+            served++;
+            return daemon_io::frame(0, body);
+        }
+        if (type == 'L') {
+            if (payload.empty() || payload == model_path) return reload();
+            failed++;
+            return daemon_io::frame(1, "reload only rereads the configured model");
+        }
+        failed++;
+        return daemon_io::frame(1, "unknown request type");
+    }
 
-        for (const string &w : tokens) {
-            auto it = vocab.find(w);
-            if (it == vocab.end()) continue;
-            int idx = it->second;
-            log_prob[PHISHING] += log_likelihood[PHISHING][idx];
-            log_prob[LEGIT]    += log_likelihood[LEGIT][idx];
+    void closeConnection(const shared_ptr<Connection> &conn) {
+        if (conn->closed) return;
+        conn->closed = true;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, nullptr);
+        close(conn->fd);
+        conns.erase(conn->fd);
+    }
+
+    void updateInterest(const shared_ptr<Connection> &conn) {
+        epoll_event ev{};
+        ev.events = (conn->paused ? 0u : (uint32_t)(EPOLLIN | EPOLLRDHUP)) |
+                    (conn->want_write ? (uint32_t)EPOLLOUT : 0u);
+        ev.data.fd = conn->fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+    }
+
+    void setWriteInterest(const shared_ptr<Connection> &conn, bool want) {
+        if (conn->want_write == want) return;
+        conn->want_write = want;
+        updateInterest(conn);
+    }
+
+    void setPaused(const shared_ptr<Connection> &conn, bool paused) {
+        if (conn->paused == paused) return;
+        conn->paused = paused;
+        updateInterest(conn);
+    }
+
+    void flush(const shared_ptr<Connection> &conn) {
+        while (conn->out_off < conn->out.size()) {
+            ssize_t w = send(conn->fd, conn->out.data() + conn->out_off,
+                             conn->out.size() - conn->out_off, MSG_NOSIGNAL);
+            if (w < 0 && errno == EINTR) continue;
+            if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                setWriteInterest(conn, true);
+                return;
+            }
+            if (w <= 0) {
+                closeConnection(conn);
+                return;
+            }
+            conn->out_off += (size_t)w;
         }
+        conn->out.clear();
+        conn->out_off = 0;
+        setWriteInterest(conn, false);
+    }
 
-        // Convert from log-space to probability
-        double max_log = max(log_prob[PHISHING], log_prob[LEGIT]);
-        double p0 = exp(log_prob[PHISHING] - max_log);
-        double p1 = exp(log_prob[LEGIT] - max_log);
-        double sum = p0 + p1;
-        return p0 / sum;
+    static size_t pendingOut(const Connection &c) { return c.out.size() - c.out_off; }
+    static size_t pendingIn(const Connection &c) { return c.in.size() - c.in_off; }
+
+    // No further request of conn can be dispatched: one is with the
+    // workers, or the client has stopped reading its replies.
+    static bool stalled(const Connection &c) { return c.busy || pendingOut(c) >= max_write_behind; }
+
+    // Consumes the complete requests buffered for conn: 'S' is answered
+    // inline, the first other request goes to the workers and ends the run.
+    // The consumed prefix is erased once at the end.
+    void dispatch(const shared_ptr<Connection> &conn) {
+        size_t answered = 0;
+        while (!conn->closed && !stalled(*conn) && pendingIn(*conn) >= sizeof(uint32_t)) {
+            uint32_t len;
+            memcpy(&len, conn->in.data() + conn->in_off, sizeof(len));
+            if (len == 0 || len > max_request) {
+                closeConnection(conn);
+                return;
+            }
+            if (pendingIn(*conn) < sizeof(len) + len) break;
+            size_t at = conn->in_off + sizeof(len);
+            char type = conn->in[at];
+            conn->in_off += sizeof(len) + len;
+
+            if (type == 'S') { // answered inline: it reads main-loop state
+                conn->out += daemon_io::frame(0, stats());
+                if (++answered % 64 == 0) flush(conn);
+                continue;
+            }
+            conn->busy = true;
+            submit([this, conn, type, payload = conn->in.substr(at + 1, len - 1)] {
+                complete(conn, handle(type, payload));
+            });
+        }
+        if (answered) flush(conn);
+        if (conn->closed || conn->in_off == 0) return;
+        conn->in.erase(0, conn->in_off);
+        conn->in_off = 0;
+    }
+
+    // Dispatches what was held back while conn was stalled and reads from
+    // it again once the read-ahead allows.
+    void resume(const shared_ptr<Connection> &conn) {
+        if (conn->closed) return;
+        dispatch(conn);
+        if (!conn->closed && (!stalled(*conn) || pendingIn(*conn) < max_read_ahead)) setPaused(conn, false);
+    }
+
+    void drainCompletions() {
+        vector<pair<shared_ptr<Connection>, string>> ready;
+        {
+            lock_guard<mutex> lk(done_mtx);
+            ready.swap(done);
+        }
+        for (auto &r : ready) {
+            auto &conn = r.first;
+            conn->busy = false;
+            if (conn->closed) continue;
+            conn->out += r.second;
+            flush(conn);
+            resume(conn);
+        }
+    }
+
+    void acceptAll() {
+        while (true) {
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+            auto conn = make_shared<Connection>();
+            conn->fd = fd;
+            epoll_event ev{};
+            ev.events = EPOLLIN | EPOLLRDHUP;
+            ev.data.fd = fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+            conns[fd] = conn;
+        }
+    }
+
+    // Dispatches after every chunk, so what stays buffered is either one
+    // partial request (bounded by max_request) or, once the connection
+    // stalls, at most max_read_ahead bytes.
+    void readFrom(const shared_ptr<Connection> &conn) {
+        char buf[65536];
+        while (!conn->closed) {
+            if (stalled(*conn) && pendingIn(*conn) >= max_read_ahead) {
+                setPaused(conn, true);
+                return;
+            }
+            ssize_t r = recv(conn->fd, buf, sizeof(buf), 0);
+            if (r > 0) {
+                conn->in.append(buf, (size_t)r);
+                dispatch(conn);
+                continue;
+            }
+            if (r < 0 && errno == EINTR) continue;
+            if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            closeConnection(conn); // EOF or error
+            return;
+        }
+    }
+
+    bool listenOn() {
+        sockaddr_un addr;
+        if (!daemon_io::unixAddress(socket_path, addr)) return false;
+        unlink(socket_path.c_str());
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0 || bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+            listen(listen_fd, 512) != 0) {
+            cerr << "Cannot listen on " << socket_path << ": " << strerror(errno) << endl;
+            return false;
+        }
+        return true;
+    }
+
+    int run(unsigned threads) {
+        model = loadModel(model_path);
+        if (!model) return 1;
+        if (!listenOn()) return 1;
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        daemon_wake_fd = wake_fd;
+        for (int fd : {listen_fd, wake_fd}) {
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.fd = fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        }
+        signal(SIGPIPE, SIG_IGN);
+        signal(SIGHUP, daemonSignal);
+        signal(SIGINT, daemonSignal);
+        signal(SIGTERM, daemonSignal);
+        for (unsigned i = 0; i < threads; ++i) workers.emplace_back([this] { workerLoop(); });
+        clog << "Serving on " << socket_path << " with " << threads
+             << " workers (SIGHUP reloads the model)" << endl;
+
+        epoll_event events[128];
+        while (!daemon_stop_requested) {
+            int n = epoll_wait(epoll_fd, events, 128, -1);
+            if (n < 0 && errno != EINTR) break;
+            for (int i = 0; i < n; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == listen_fd) {
+                    acceptAll();
+                } else if (fd == wake_fd) {
+                    uint64_t v;
+                    while (read(wake_fd, &v, sizeof(v)) > 0) {}
+                    if (daemon_reload_requested.exchange(false)) {
+                        submit([this] { reload(); });
+                    }
+                    drainCompletions();
+                } else {
+                    auto it = conns.find(fd);
+                    if (it == conns.end()) continue;
+                    auto conn = it->second;
+                    if (events[i].events & EPOLLOUT) {
+                        flush(conn);
+                        if (conn->paused) resume(conn);
+                    }
+                    if (conn->paused && (events[i].events & (EPOLLHUP | EPOLLERR))) {
+                        closeConnection(conn); // reported even while paused; nobody is left to answer
+                    } else if (!conn->closed && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+                        readFrom(conn);
+                    }
+                }
+            }
+        }
+
+        clog << "Shutting down after " << served.load() << " requests" << endl;
+        {
+            lock_guard<mutex> lk(job_mtx);
+            stopping = true;
+        }
+        job_cv.notify_all();
+        for (thread &t : workers) t.join();
+        close(listen_fd);
+        unlink(socket_path.c_str());
+        return 0;
     }
 };
 
-int main() {
+int runDaemon(int argc, char **argv) {
+    if (argc < 4) {
+        cerr << "Usage: " << argv[0]
+             << " --daemon <socket> <model|train> [--threads N] [--domains F] [--quantize]"
+                " [--early-exit] [--slow-us U] [--slow-sample K]\n";
+        return 2;
+    }
+    ClassifierDaemon d;
+    d.socket_path = argv[2];
+    d.model_path = argv[3];
+    unsigned threads = max(1u, thread::hardware_concurrency());
+    for (int i = 4; i < argc; ++i) {
+        string arg = argv[i];
+        if (parseStatsOption(argc, argv, i)) continue;
+        if (arg == "--threads" && i + 1 < argc) threads = max(1, atoi(argv[++i]));
+        else if (arg == "--domains" && i + 1 < argc) d.domain_path = argv[++i];
+        else if (arg == "--quantize") d.quantize = true;
+        else if (arg == "--early-exit") d.early_exit = true;
+    }
+    return d.run(threads);
+}
+
+// Closed-loop load generator: each of C connections sends requests back
+// to back, and the latency of every request is recorded.
+int runBenchClient(int argc, char **argv) {
+    if (argc < 4) {
+        cerr << "Usage: " << argv[0]
+             << " --bench-client <socket> <emails> [--concurrency C] [--requests N] [--raw]"
+                " [--stats]\n";
+        return 2;
+    }
+    string socket_path = argv[2];
+    size_t concurrency = 8, requests = 100000;
+    char type = 'C';
+    bool fetchStats = false;
+    for (int i = 4; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--concurrency" && i + 1 < argc) concurrency = max(1, atoi(argv[++i]));
+        else if (arg == "--requests" && i + 1 < argc) requests = max(1, atoi(argv[++i]));
+        else if (arg == "--raw") type = 'M';
+        else if (arg == "--stats") fetchStats = true;
+    }
+
+    // Plain requests take one email per line; --raw sends each message of
+    // an mbox/.eml archive whole, as the daemon's 'M' request expects.
+    vector<string> emails;
+    if (type == 'M') {
+        MappedFile file;
+        if (!file.open(argv[3])) {
+            cerr << "Cannot open archive: " << argv[3] << endl;
+            return 1;
+        }
+        MboxScanner scanner(file.view());
+        string_view msg;
+        while (scanner.next(msg)) {
+            if (!msg.empty()) emails.push_back(daemon_io::frame(type, msg));
+        }
+    } else {
+        ifstream in(argv[3], ios::binary);
+        string line;
+        while (getline(in, line)) {
+            if (!line.empty()) emails.push_back(daemon_io::frame(type, line));
+        }
+    }
+    if (emails.empty()) {
+        cerr << "No emails in " << argv[3] << endl;
+        return 1;
+    }
+
+    vector<vector<double>> latencies(concurrency);
+    atomic<size_t> next{0}, phishing{0}, errors{0};
+    auto start = chrono::steady_clock::now();
+    vector<thread> clients;
+    for (size_t c = 0; c < concurrency; ++c) {
+        clients.emplace_back([&, c] {
+            sockaddr_un addr;
+            if (!daemon_io::unixAddress(socket_path, addr)) return;
+            int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd < 0 || connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+                cerr << "Cannot connect to " << socket_path << endl;
+                errors++;
+                if (fd >= 0) close(fd);
+                return;
+            }
+            string reply;
+            size_t i;
+            while ((i = next.fetch_add(1)) < requests) {
+                const string &req = emails[i % emails.size()];
+                auto t0 = chrono::steady_clock::now();
+                uint32_t len;
+                if (!daemon_io::writeAll(fd, req.data(), req.size()) ||
+                    !daemon_io::readAll(fd, reinterpret_cast<char *>(&len), sizeof(len)) ||
+                    len == 0 || len > ClassifierDaemon::max_request) {
+                    errors++;
+                    break;
+                }
+                reply.resize(len);
+                if (!daemon_io::readAll(fd, &reply[0], len)) {
+                    errors++;
+                    break;
+                }
+                auto t1 = chrono::steady_clock::now();
+                latencies[c].push_back(chrono::duration<double, micro>(t1 - t0).count());
+                if (reply[0] != 0) errors++;
+                else if (reply.size() > 1 && reply[1] == 0) phishing++;
+            }
+            close(fd);
+        });
+    }
+    for (thread &t : clients) t.join();
+    double secs = max(chrono::duration<double>(chrono::steady_clock::now() - start).count(), 1e-9);
+
+    vector<double> all;
+    for (auto &l : latencies) all.insert(all.end(), l.begin(), l.end());
+    if (all.empty()) return 1;
+    sort(all.begin(), all.end());
+    auto pct = [&](double q) { return all[min(all.size() - 1, (size_t)(q * all.size()))]; };
+    cout << fixed << setprecision(1)
+         << "Requests:    " << all.size() << " (" << errors.load() << " errors, "
+         << phishing.load() << " phishing) over " << concurrency << " connections\n"
+         << "Throughput:  " << all.size() / secs << " req/sec\n"
+         << "Latency us:  p50 " << pct(0.50) << "  p99 " << pct(0.99)
+         << "  p999 " << pct(0.999) << "  max " << all.back() << "\n";
+    if (fetchStats) {
+        sockaddr_un addr;
+        int fd = daemon_io::unixAddress(socket_path, addr) ? socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0) : -1;
+        string req = daemon_io::frame('S', ""), reply;
+        uint32_t len;
+        if (fd >= 0 && connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0 &&
+            daemon_io::writeAll(fd, req.data(), req.size()) &&
+            daemon_io::readAll(fd, reinterpret_cast<char *>(&len), sizeof(len)) && len > 0) {
+            reply.resize(len);
+            if (daemon_io::readAll(fd, &reply[0], len)) cout << "\nServer statistics:\n" << reply.substr(1);
+        }
+        if (fd >= 0) close(fd);
+    }
+    return errors ? 1 : 0;
+}
+#endif
+
+// Scores a held-out set with the double and the int16 tables and reports
+// size, speed and how far the two paths drift apart.
+int runQuantizeReport(int argc, char **argv) {
+    if (argc < 4) {
+        cerr << "Usage: " << argv[0] << " --quantize-report <train> <heldout>\n";
+        return 2;
+    }
+    using NB = NaiveBayesEmailClassifier;
+    NB clf;
+    if (!clf.loadOrTrain(argv[2])) return 1;
+    if (atomic_load(&clf.engine)) {
+        cerr << "Quantization applies to nb models only.\n";
+        return 1;
+    }
+
+    ifstream in(argv[3]);
+    if (!in.is_open()) {
+        cerr << "Cannot open held-out file: " << argv[3] << endl;
+        return 1;
+    }
+    vector<vector<string>> docs;
+    vector<NB::ClassLabel> truth;
+    string line, text;
+    NB::ClassLabel cls;
+    while (getline(in, line)) {
+        if (!clf.parseTrainingLine(line, cls, text)) continue;
+        docs.push_back(clf.tokenize(text));
+        truth.push_back(cls);
+    }
+    if (docs.empty()) {
+        cerr << "Empty held-out set.\n";
+        return 1;
+    }
+
+    size_t n = docs.size();
+    vector<array<double, 2>> exact(n), approx(n);
+    vector<size_t> known(n);
+    size_t resident_before = clf.memoryBytes(), file_before = clf.fileBytes();
+
+    auto t0 = chrono::steady_clock::now();
+    clf.withSnapshot([&](const NB::Model &m) {
+        for (size_t i = 0; i < n; ++i) m.score(docs[i], exact[i].data());
+    });
+    auto t1 = chrono::steady_clock::now();
+    // Frozen as --batch/--daemon --quantize serve it: the double tables
+    // are gone and only the int16 tables and their vocabulary remain.
+    clf.quantize(true);
+    auto q = atomic_load(&clf.quantized);
+    auto t2 = chrono::steady_clock::now();
+    clf.withSnapshot([&](const NB::Model &m) {
+        for (size_t i = 0; i < n; ++i) q->score(m, docs[i], approx[i].data(), &known[i]);
+    });
+    auto t3 = chrono::steady_clock::now();
+    size_t resident_after = clf.memoryBytes(), file_after = clf.fileBytes();
+
+    size_t correct_exact = 0, correct_approx = 0, disagree = 0;
+    double max_dp = 0.0, max_dmargin = 0.0, worst_ratio = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        NB::Prediction pe = NB::fromLogProb(exact[i].data());
+        NB::Prediction pa = NB::fromLogProb(approx[i].data());
+        correct_exact += pe.label == truth[i];
+        correct_approx += pa.label == truth[i];
+        disagree += pe.label != pa.label;
+        max_dp = max(max_dp, fabs(pe.p_phishing - pa.p_phishing));
+        double dmargin = fabs((exact[i][0] - exact[i][1]) - (approx[i][0] - approx[i][1]));
+        max_dmargin = max(max_dmargin, dmargin);
+        double bound = known[i] * (q->scale[0] + q->scale[1]) / 2;
+        if (bound > 0) worst_ratio = max(worst_ratio, dmargin / bound);
+    }
+
+    size_t V = q->packed.size();
+    size_t double_bytes = V * 2 * sizeof(double);
+    auto ratio = [](size_t before, size_t after) { return (double)before / max<size_t>(after, 1); };
+    double secs_exact = max(chrono::duration<double>(t1 - t0).count(), 1e-9);
+    double secs_approx = max(chrono::duration<double>(t3 - t2).count(), 1e-9);
+    cout << fixed << setprecision(6)
+         << "Held-out emails:      " << n << "\n"
+         << "Accuracy (double):    " << (double)correct_exact / n << "\n"
+         << "Accuracy (int16):     " << (double)correct_approx / n << "\n"
+         << "Accuracy delta:       " << ((double)correct_approx - (double)correct_exact) / n << "\n"
+         << "Label disagreements:  " << disagree << "\n"
+         << "Max |dP(phishing)|:   " << max_dp << "\n"
+         << "Max |d margin|:       " << max_dmargin << " nats ("
+         << worst_ratio * 100 << "% of the documented bound)\n"
+         << "Scales (phish/legit): " << q->scale[0] << " / " << q->scale[1] << "\n"
+         << setprecision(1)
+         << "Likelihood tables:    " << double_bytes << " -> " << q->tableBytes()
+         << " bytes (" << ratio(double_bytes, q->tableBytes()) << "x smaller)\n"
+         << "Resident model:       " << resident_before << " -> " << resident_after
+         << " bytes (" << ratio(resident_before, resident_after) << "x smaller)\n"
+         << "Model file:           " << file_before << " -> " << file_after
+         << " bytes (" << ratio(file_before, file_after) << "x smaller)\n"
+         << "Scoring (double):     " << n / secs_exact << " emails/sec\n"
+         << "Scoring (int16):      " << n / secs_approx << " emails/sec"
+#ifdef R1P1_HAVE_AVX2_KERNEL
+         << (__builtin_cpu_supports("avx2") ? " (AVX2 gather)" : " (scalar)")
+#endif
+         << "\n";
+    return 0;
+}
+
+// Scores every held-out email fully and with early exit, checks that the
+// labels agree and reports how many tokens the bounds let it skip.
+int runEarlyExitReport(int argc, char **argv) {
+    if (argc < 4) {
+        cerr << "Usage: " << argv[0] << " --early-exit-report <train> <heldout> [--repeat R]\n";
+        return 2;
+    }
+    int repeat = 5;
+    for (int i = 4; i + 1 < argc; ++i) {
+        if (string(argv[i]) == "--repeat") repeat = max(1, atoi(argv[++i]));
+    }
+    using NB = NaiveBayesEmailClassifier;
+    NB clf;
+    if (!clf.loadOrTrain(argv[2])) return 1;
+    if (atomic_load(&clf.engine)) {
+        cerr << "Early exit applies to nb models only.\n";
+        return 1;
+    }
+
+    ifstream in(argv[3]);
+    if (!in.is_open()) {
+        cerr << "Cannot open held-out file: " << argv[3] << endl;
+        return 1;
+    }
+    vector<vector<string>> docs;
+    string line, text;
+    NB::ClassLabel cls;
+    size_t total_tokens = 0;
+    while (getline(in, line)) {
+        if (!clf.parseTrainingLine(line, cls, text)) continue;
+        docs.push_back(clf.tokenize(text));
+        total_tokens += docs.back().size();
+    }
+    if (docs.empty()) {
+        cerr << "Empty held-out set.\n";
+        return 1;
+    }
+
+    size_t n = docs.size();
+    vector<NB::Prediction> full(n), early(n);
+    vector<size_t> read(n);
+    double secs_full = 0.0, secs_early = 0.0;
+    clf.withSnapshot([&](const NB::Model &m) {
+        double log_prob[2];
+        NB::Model::EarlyBounds b;
+        // Interleaved rounds so both paths see the same cache state.
+        for (int r = 0; r < repeat; ++r) {
+            auto t0 = chrono::steady_clock::now();
+            for (size_t i = 0; i < n; ++i) {
+                m.score(docs[i], log_prob);
+                full[i] = NB::fromLogProb(log_prob);
+            }
+            auto t1 = chrono::steady_clock::now();
+            for (size_t i = 0; i < n; ++i) {
+                if (m.scoreEarly(docs[i], log_prob, &b)) {
+                    early[i] = NB::fromMarginBounds(b.margin_low, b.margin_high);
+                    read[i] = b.read;
+                } else {
+                    early[i] = NB::fromLogProb(log_prob);
+                    read[i] = docs[i].size();
+                }
+            }
+            auto t2 = chrono::steady_clock::now();
+            secs_full += chrono::duration<double>(t1 - t0).count();
+            secs_early += chrono::duration<double>(t2 - t1).count();
+        }
+    });
+
+    size_t stopped = 0, disagree = 0, outside = 0, tokens_read = 0;
+    for (size_t i = 0; i < n; ++i) {
+        tokens_read += read[i];
+        disagree += full[i].label != early[i].label;
+        if (!early[i].bounded) continue;
+        stopped++;
+        outside += full[i].p_phishing < early[i].p_low || full[i].p_phishing > early[i].p_high;
+    }
+    vector<size_t> sorted_read(read);
+    sort(sorted_read.begin(), sorted_read.end());
+    secs_full = max(secs_full, 1e-9);
+    secs_early = max(secs_early, 1e-9);
+    double us_full = secs_full * 1e6 / ((double)n * repeat);
+    double us_early = secs_early * 1e6 / ((double)n * repeat);
+    cout << fixed << setprecision(4)
+         << "Held-out emails:      " << n << " (" << (double)total_tokens / n << " tokens avg)\n"
+         << "Stopped early:        " << stopped << " (" << 100.0 * stopped / n << "%)\n"
+         << "Tokens skipped:       " << total_tokens - tokens_read << " ("
+         << 100.0 * (total_tokens - tokens_read) / max<size_t>(total_tokens, 1) << "%)\n"
+         << "Tokens read p50/max:  " << sorted_read[n / 2] << " / " << sorted_read.back() << "\n"
+         << "Label disagreements:  " << disagree << "\n"
+         << "Full P outside bound: " << outside << "\n"
+         << setprecision(2)
+         << "Scoring (full):       " << us_full << " us/email\n"
+         << "Scoring (early exit): " << us_early << " us/email ("
+         << 100.0 * (1.0 - us_early / us_full) << "% saved)\n";
+    return disagree == 0 ? 0 : 1;
+}
+
+int runBuildTrie(int argc, char **argv) {
+    if (argc < 3) {
+        cerr << "Usage: " << argv[0] << " --build-trie <out> [--brands F] [--allow F]\n";
+        return 2;
+    }
+    DomainTrieBuilder builder;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        string arg = argv[i];
+        if (arg != "--brands" && arg != "--allow") {
+            cerr << "Unknown option: " << arg << endl;
+            return 2;
+        }
+        if (!builder.addFile(argv[i + 1], arg == "--brands")) return 1;
+    }
+    vector<char> bytes = builder.build();
+    ofstream out(argv[2], ios::binary);
+    out.write(bytes.data(), bytes.size());
+    if (!out) {
+        cerr << "Cannot write trie file: " << argv[2] << endl;
+        return 1;
+    }
+    clog << "Wrote " << builder.nodes.size() << " trie nodes (" << bytes.size()
+         << " bytes) to " << argv[2] << endl;
+    return 0;
+}
+
+// Embedders (e.g. the Python extension) include this file with
+// R1P1_NO_MAIN defined and use the classifier directly.
+#ifndef R1P1_NO_MAIN
+int main(int argc, char **argv) {
     ios::sync_with_stdio(false);
     cin.tie(nullptr);
 
+    if (argc > 1 && string(argv[1]) == "--batch") {
+        return runBatch(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--models") {
+        return runModelSet(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--build-trie") {
+        return runBuildTrie(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--quantize-report") {
+        return runQuantizeReport(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--early-exit-report") {
+        return runEarlyExitReport(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--train") {
+        return runTrain(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-engines") {
+        return runBenchEngines(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--eval") {
+        return runEval(argc, argv);
+    }
+#ifdef __linux__
+    if (argc > 1 && string(argv[1]) == "--daemon") {
+        return runDaemon(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-client") {
+        return runBenchClient(argc, argv);
+    }
+#endif
+
     NaiveBayesEmailClassifier clf;
 
     cout << "=== Phishing Email Classifier (Naive Bayes, C++) ===\n";
     cout << "Enter path to training file (e.g., training_data.txt): ";
     string trainFile;
     getline(cin, trainFile);
+    cout.flush();
 
     clf.train(trainFile);
 
@@ -234,12 +5588,21 @@ int main() {
         string email;
         getline(cin, email);
         if (email.empty()) break;
-        auto label = clf.predictLabel(email);
-        double p_phish = clf.phishingProbability(email);
-        cout << "Predicted: " << clf.labelToString(label)
+        if (email.compare(0, 7, ":learn ") == 0 || email.compare(0, 9, ":unlearn ") == 0) {
+            bool learn = email[1] == 'l';
+            NaiveBayesEmailClassifier::ClassLabel cls;
+            string text;
+            if (!clf.parseTrainingLine(email.substr(email.find(' ') + 1), cls, text)) continue;
+            if (!(learn ? clf.update(cls, text) : clf.unlearn(cls, text))) continue;
+            cout << (learn ? "Learned " : "Unlearned ") << clf.labelToString(cls) << " example\n";
+            continue;
+        }
+        auto result = clf.classify(email);
+        cout << "Predicted: " << clf.labelToString(result.label)
              << " (P(phishing) = " << fixed << setprecision(4)
-             << p_phish << ")\n";
+             << result.p_phishing << ")\n";
     }
 
     return 0;
 }
+#endif